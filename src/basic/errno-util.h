@@ -79,6 +79,21 @@ static inline bool ERRNO_IS_ACCEPT_AGAIN(int r) {
                        EOPNOTSUPP);
 }
 
+/* Three different errors for "operation/system call/ioctl/socket feature not supported" */
+static inline bool ERRNO_IS_NOT_SUPPORTED(int r) {
+        return IN_SET(abs(r),
+                      EOPNOTSUPP,
+                      ENOTTY,
+                      ENOSYS);
+}
+
+/* Two different errors for access problems */
+static inline bool ERRNO_IS_PRIVILEGE(int r) {
+        return IN_SET(abs(r),
+                      EACCES,
+                      EPERM);
+}
+
 /* Resource exhaustion, could be our fault or general system trouble */
 static inline bool ERRNO_IS_RESOURCE(int r) {
         return IN_SET(abs(r),
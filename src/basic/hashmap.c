@@ -18,12 +18,18 @@
 #include "siphash24.h"
 #include "string-util.h"
 #include "strv.h"
+#include "unaligned.h"
+#include "util.h"
 
 #if ENABLE_DEBUG_HASHMAP
 #include <pthread.h>
 #include "list.h"
 #endif
 
+#if ENABLE_SWISS_HASHMAP && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
  * Implementation of hashmaps.
  * Addressing: open
@@ -66,6 +72,25 @@
  * - Short summary of random vs. linear probing, and tombstones vs. backward shift.
  */
 
+/*
+ * Alternatively, if built with -Dhashmap=swiss (ENABLE_SWISS_HASHMAP):
+ * Addressing: open, same storage layout
+ * Collision resolution: none, entries stay in the bucket they were put into
+ *   - each bucket has a control byte instead of the DIB byte, holding 7 bits
+ *     of the hash of the key stored in it, or marking it free or deleted.
+ *     A whole group of 16 control bytes is matched against the hash at once
+ *     (SSE2, or a portable SWAR fallback), so keys are compared almost only
+ *     when they are equal, and a lookup usually touches a single group.
+ * Probe sequence: linear, over groups
+ * Deletion: with tombstones, unless the group still has a free bucket
+ *   - entries only ever move when the table is rehashed.
+ *
+ * References:
+ * Kulukundis, M. 2017. Designing a Fast, Efficient, Cache-friendly Hash Table, Step by Step.
+ * CppCon 2017. https://www.youtube.com/watch?v=ncHmEUmJZf4
+ * - The "Swiss table" design, as used by Abseil's flat_hash_map.
+ */
+
 /*
  * XXX Ideas for improvement:
  * For unordered hashmaps, randomize iteration order, similarly to Perl:
@@ -73,8 +98,9 @@
  */
 
 /* INV_KEEP_FREE = 1 / (1 - max_load_factor)
- * e.g. 1 / (1 - 0.8) = 5 ... keep one fifth of the buckets free. */
-#define INV_KEEP_FREE            5U
+ * e.g. 1 / (1 - 0.8) = 5 ... keep one fifth of the buckets free.
+ * Group probing copes well with higher load, keep one eighth free there. */
+#define INV_KEEP_FREE            HASHMAP_INV_KEEP_FREE
 
 /* Fields common to entries of all hashmap/set types */
 struct hashmap_base_entry {
@@ -118,6 +144,19 @@ struct swap_entries {
         struct ordered_hashmap_entry e[_IDX_SWAP_END - _IDX_SWAP_BEGIN];
 };
 
+#if ENABLE_SWISS_HASHMAP
+/* Control byte: 0b0hhhhhhh for a used bucket, storing the 7 low bits of the hash of its key */
+typedef int8_t ctrl_t;
+#define CTRL_EMPTY       ((ctrl_t) -128)      /* 0b10000000: a free bucket */
+#define CTRL_DELETED     ((ctrl_t) -2)        /* 0b11111110: a tombstone */
+#define CTRL_SENTINEL    ((ctrl_t) -1)        /* 0b11111111: pads a partial group, matches nothing */
+
+/* Number of buckets probed at once. Tables with fewer buckets consist of a single partial group, larger
+ * tables only of whole groups. */
+#define GROUP_WIDTH      16U
+
+typedef ctrl_t bucket_meta_t;
+#else
 /* Distance from Initial Bucket */
 typedef uint8_t dib_raw_t;
 #define DIB_RAW_OVERFLOW ((dib_raw_t)0xfdU)   /* indicates DIB value is greater than representable */
@@ -127,6 +166,9 @@ typedef uint8_t dib_raw_t;
 
 #define DIB_FREE UINT_MAX
 
+typedef dib_raw_t bucket_meta_t;
+#endif
+
 #if ENABLE_DEBUG_HASHMAP
 struct hashmap_debug_info {
         LIST_FIELDS(struct hashmap_debug_info, debug_list);
@@ -170,19 +212,26 @@ struct _packed_ indirect_storage {
         unsigned idx_lowest_entry;         /* Index below which all buckets are free.
                                               Makes "while(hashmap_steal_first())" loops
                                               O(n) instead of O(n^2) for unordered hashmaps. */
+#if ENABLE_SWISS_HASHMAP
+        unsigned n_deleted;                /* number of tombstones; they count towards the load */
+        uint8_t  _pad[sizeof(void*) - 1];  /* padding for the whole HashmapBase */
+#else
         uint8_t  _pad[3];                  /* padding for the whole HashmapBase */
+#endif
         /* The bitfields in HashmapBase complete the alignment of the whole thing. */
 };
 
 struct direct_storage {
         /* This gives us 39 bytes on 64bit, or 35 bytes on 32bit.
          * That's room for 4 set_entries + 4 DIB bytes + 3 unused bytes on 64bit,
-         *              or 7 set_entries + 7 DIB bytes + 0 unused bytes on 32bit. */
+         *              or 7 set_entries + 7 DIB bytes + 0 unused bytes on 32bit.
+         * With the Swiss table it's 47 bytes on 64bit, or 39 bytes on 32bit, i.e.
+         *     room for 5 set_entries + 5 control bytes + 2 unused bytes on 64bit. */
         uint8_t storage[sizeof(struct indirect_storage)];
 };
 
 #define DIRECT_BUCKETS(entry_t) \
-        (sizeof(struct direct_storage) / (sizeof(entry_t) + sizeof(dib_raw_t)))
+        (sizeof(struct direct_storage) / (sizeof(entry_t) + sizeof(bucket_meta_t)))
 
 /* We should be able to store at least one entry directly. */
 assert_cc(DIRECT_BUCKETS(struct ordered_hashmap_entry) >= 1);
@@ -346,7 +395,12 @@ static unsigned base_bucket_hash(HashmapBase *h, const void *p) {
 
         hash = siphash24_finalize(&state);
 
+#if ENABLE_SWISS_HASHMAP
+        /* Not a bucket index, see hash_ctrl() and hash_group() */
+        return (unsigned) hash;
+#else
         return (unsigned) (hash % n_buckets(h));
+#endif
 }
 #define bucket_hash(h, p) base_bucket_hash(HASHMAP_BASE(h), p)
 
@@ -408,6 +462,128 @@ static struct hashmap_base_entry *bucket_at_virtual(HashmapBase *h, struct swap_
         assert_not_reached("Invalid index");
 }
 
+#if ENABLE_SWISS_HASHMAP
+static ctrl_t *ctrl_ptr(HashmapBase *h) {
+        return (ctrl_t*)
+                ((uint8_t*) storage_ptr(h) + hashmap_type_info[h->type].entry_size * n_buckets(h));
+}
+
+static unsigned n_groups(HashmapBase *h) {
+        return DIV_ROUND_UP(n_buckets(h), GROUP_WIDTH);
+}
+
+/* The 7 low bits of the hash go into the control byte, the rest picks the group to start probing at. */
+static ctrl_t hash_ctrl(unsigned hash) {
+        return (ctrl_t) (hash & 0x7fU);
+}
+
+static unsigned hash_group(unsigned hash, unsigned n) {
+        /* Maps the remaining 25 bits onto [0, n) by multiplication, which is cheaper than a division */
+        return (unsigned) (((uint64_t) (hash >> 7) * n) >> 25);
+}
+
+static unsigned next_group(unsigned group, unsigned n) {
+        return group + 1U < n ? group + 1U : 0U;
+}
+
+/* The control bytes of a group are matched all at once. Matches are returned as a bit mask, with
+ * bit i set for the i-th bucket of the group. */
+#ifdef __SSE2__
+typedef __m128i group_t;
+
+static group_t group_load(const ctrl_t *ctrl) {
+        return _mm_loadu_si128((const __m128i*) ctrl);
+}
+
+static unsigned group_match(group_t g, ctrl_t c) {
+        return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(c), g));
+}
+
+static unsigned group_match_empty(group_t g) {
+        return group_match(g, CTRL_EMPTY);
+}
+
+static unsigned group_match_empty_or_deleted(group_t g) {
+        /* Signed comparison: free buckets and tombstones are below CTRL_SENTINEL, used buckets above */
+        return (unsigned) _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(CTRL_SENTINEL), g));
+}
+
+static unsigned group_match_used(group_t g) {
+        return ~(unsigned) _mm_movemask_epi8(g) & 0xffffU;
+}
+#else
+/* Portable fallback, testing the bytes of two 64bit words in parallel */
+typedef struct group_t {
+        uint64_t w[2];
+} group_t;
+
+#define GROUP_LSBS UINT64_C(0x0101010101010101)
+#define GROUP_MSBS UINT64_C(0x8080808080808080)
+
+static group_t group_load(const ctrl_t *ctrl) {
+        return (group_t) {
+                .w = { unaligned_read_le64(ctrl), unaligned_read_le64(ctrl + 8) },
+        };
+}
+
+/* Gathers the high bits of the bytes of both words into one bit per byte */
+static unsigned group_mask(uint64_t m0, uint64_t m1) {
+        m0 = ((m0 & GROUP_MSBS) >> 7) * UINT64_C(0x0102040810204080) >> 56;
+        m1 = ((m1 & GROUP_MSBS) >> 7) * UINT64_C(0x0102040810204080) >> 56;
+
+        return (unsigned) (m0 | m1 << 8);
+}
+
+static unsigned group_match(group_t g, ctrl_t c) {
+        uint64_t x0 = g.w[0] ^ (GROUP_LSBS * (uint8_t) c),
+                 x1 = g.w[1] ^ (GROUP_LSBS * (uint8_t) c);
+
+        /* Finds the zero bytes. A byte of 0x01 directly following a zero byte is reported too, i.e. a
+         * used bucket with a slightly different hash. That's harmless, the keys are compared anyway. */
+        return group_mask((x0 - GROUP_LSBS) & ~x0, (x1 - GROUP_LSBS) & ~x1);
+}
+
+static unsigned group_match_empty(group_t g) {
+        /* High bit set, bit 1 unset */
+        return group_mask(g.w[0] & ~(g.w[0] << 6), g.w[1] & ~(g.w[1] << 6));
+}
+
+static unsigned group_match_empty_or_deleted(group_t g) {
+        /* High bit set, bit 0 unset */
+        return group_mask(g.w[0] & ~(g.w[0] << 7), g.w[1] & ~(g.w[1] << 7));
+}
+
+static unsigned group_match_used(group_t g) {
+        return group_mask(~g.w[0], ~g.w[1]);
+}
+#endif
+
+static group_t group_load_at(HashmapBase *h, unsigned group) {
+        ctrl_t buf[GROUP_WIDTH];
+
+        if (_likely_(n_buckets(h) >= GROUP_WIDTH))
+                return group_load(ctrl_ptr(h) + group * GROUP_WIDTH);
+
+        /* Don't read past the end of a partial group */
+        assert(group == 0);
+        memset(mempcpy(buf, ctrl_ptr(h), n_buckets(h)), CTRL_SENTINEL, GROUP_WIDTH - n_buckets(h));
+        return group_load(buf);
+}
+
+static unsigned skip_free_buckets(HashmapBase *h, unsigned idx) {
+        unsigned m;
+
+        while (idx < n_buckets(h)) {
+                m = group_match_used(group_load_at(h, idx / GROUP_WIDTH)) >> (idx % GROUP_WIDTH);
+                if (m != 0)
+                        return idx + u32ctz(m);
+
+                idx = ALIGN_TO(idx + 1, GROUP_WIDTH);
+        }
+
+        return IDX_NIL;
+}
+#else
 static dib_raw_t *dib_raw_ptr(HashmapBase *h) {
         return (dib_raw_t*)
                 ((uint8_t*) storage_ptr(h) + hashmap_type_info[h->type].entry_size * n_buckets(h));
@@ -461,6 +637,7 @@ static void bucket_mark_free(HashmapBase *h, unsigned idx) {
         memzero(bucket_at(h, idx), hashmap_type_info[h->type].entry_size);
         bucket_set_dib(h, idx, DIB_FREE);
 }
+#endif
 
 static void bucket_move_entry(HashmapBase *h, struct swap_entries *swap,
                               unsigned from, unsigned to) {
@@ -498,6 +675,7 @@ static void bucket_move_entry(HashmapBase *h, struct swap_entries *swap,
         }
 }
 
+#if !ENABLE_SWISS_HASHMAP
 static unsigned next_idx(HashmapBase *h, unsigned idx) {
         return (idx + 1U) % n_buckets(h);
 }
@@ -505,6 +683,7 @@ static unsigned next_idx(HashmapBase *h, unsigned idx) {
 static unsigned prev_idx(HashmapBase *h, unsigned idx) {
         return (n_buckets(h) + idx - 1U) % n_buckets(h);
 }
+#endif
 
 static void *entry_value(HashmapBase *h, struct hashmap_base_entry *e) {
         switch (h->type) {
@@ -521,6 +700,55 @@ static void *entry_value(HashmapBase *h, struct hashmap_base_entry *e) {
         }
 }
 
+static void unlink_ordered_entry(HashmapBase *h, unsigned idx) {
+        OrderedHashmap *lh = (OrderedHashmap*) h;
+        struct ordered_hashmap_entry *le;
+
+        if (h->type != HASHMAP_TYPE_ORDERED)
+                return;
+
+        le = ordered_bucket_at(lh, idx);
+
+        if (le->iterate_next != IDX_NIL)
+                ordered_bucket_at(lh, le->iterate_next)->iterate_previous = le->iterate_previous;
+        else
+                lh->iterate_list_tail = le->iterate_previous;
+
+        if (le->iterate_previous != IDX_NIL)
+                ordered_bucket_at(lh, le->iterate_previous)->iterate_next = le->iterate_next;
+        else
+                lh->iterate_list_head = le->iterate_next;
+}
+
+#if ENABLE_SWISS_HASHMAP
+static void base_remove_entry(HashmapBase *h, unsigned idx) {
+        ctrl_t *ctrl;
+
+        ctrl = ctrl_ptr(h);
+        assert(ctrl[idx] >= 0);
+
+#if ENABLE_DEBUG_HASHMAP
+        h->debug.rem_count++;
+        h->debug.last_rem_idx = idx;
+#endif
+
+        unlink_ordered_entry(h, idx);
+        memzero(bucket_at(h, idx), hashmap_type_info[h->type].entry_size);
+
+        /* Lookups stop at the first group with a free bucket. If this group still has one, no lookup went
+         * past it and the bucket may simply become free. Otherwise, leave a tombstone so that lookups for
+         * the entries which were put further on still get there. */
+        if (n_groups(h) == 1 || group_match_empty(group_load_at(h, idx / GROUP_WIDTH)) != 0)
+                ctrl[idx] = CTRL_EMPTY;
+        else {
+                ctrl[idx] = CTRL_DELETED;
+                h->indirect.n_deleted++;
+        }
+
+        n_entries_dec(h);
+        base_set_dirty(h);
+}
+#else
 static void base_remove_entry(HashmapBase *h, unsigned idx) {
         unsigned left, right, prev, dib;
         dib_raw_t raw_dib, *dibs;
@@ -546,20 +774,7 @@ static void base_remove_entry(HashmapBase *h, unsigned idx) {
                 assert(left != right);
         }
 
-        if (h->type == HASHMAP_TYPE_ORDERED) {
-                OrderedHashmap *lh = (OrderedHashmap*) h;
-                struct ordered_hashmap_entry *le = ordered_bucket_at(lh, idx);
-
-                if (le->iterate_next != IDX_NIL)
-                        ordered_bucket_at(lh, le->iterate_next)->iterate_previous = le->iterate_previous;
-                else
-                        lh->iterate_list_tail = le->iterate_previous;
-
-                if (le->iterate_previous != IDX_NIL)
-                        ordered_bucket_at(lh, le->iterate_previous)->iterate_next = le->iterate_next;
-                else
-                        lh->iterate_list_head = le->iterate_next;
-        }
+        unlink_ordered_entry(h, idx);
 
         /* Now shift all buckets in the interval (left, right) one step backwards */
         for (prev = left, left = next_idx(h, left); left != right;
@@ -574,6 +789,7 @@ static void base_remove_entry(HashmapBase *h, unsigned idx) {
         n_entries_dec(h);
         base_set_dirty(h);
 }
+#endif
 #define remove_entry(h, idx) base_remove_entry(HASHMAP_BASE(h), idx)
 
 static unsigned hashmap_iterate_in_insertion_order(OrderedHashmap *h, Iterator *i) {
@@ -595,6 +811,7 @@ static unsigned hashmap_iterate_in_insertion_order(OrderedHashmap *h, Iterator *
         } else {
                 idx = i->idx;
                 e = ordered_bucket_at(h, idx);
+#if !ENABLE_SWISS_HASHMAP
                 /*
                  * We allow removing the current entry while iterating, but removal may cause
                  * a backward shift. The next entry may thus move one bucket to the left.
@@ -605,6 +822,7 @@ static unsigned hashmap_iterate_in_insertion_order(OrderedHashmap *h, Iterator *
                         idx = prev_idx(HASHMAP_BASE(h), idx);
                         e = ordered_bucket_at(h, idx);
                 }
+#endif
                 assert(e->p.b.key == i->next_key);
         }
 
@@ -652,6 +870,7 @@ static unsigned hashmap_iterate_in_internal_order(HashmapBase *h, Iterator *i) {
                 assert(i->idx > 0);
 
                 e = bucket_at(h, i->idx);
+#if !ENABLE_SWISS_HASHMAP
                 /*
                  * We allow removing the current entry while iterating, but removal may cause
                  * a backward shift. The next entry may thus move one bucket to the left.
@@ -660,6 +879,7 @@ static unsigned hashmap_iterate_in_internal_order(HashmapBase *h, Iterator *i) {
                  */
                 if (e->key != i->next_key)
                         e = bucket_at(h, --i->idx);
+#endif
 
                 assert(e->key == i->next_key);
         }
@@ -768,7 +988,11 @@ static void reset_direct_storage(HashmapBase *h) {
         assert(!h->has_indirect);
 
         p = mempset(h->direct.storage, 0, hi->entry_size * hi->n_direct_buckets);
+#if ENABLE_SWISS_HASHMAP
+        memset(p, CTRL_EMPTY, sizeof(ctrl_t) * hi->n_direct_buckets);
+#else
         memset(p, DIB_RAW_INIT, sizeof(dib_raw_t) * hi->n_direct_buckets);
+#endif
 }
 
 static struct HashmapBase *hashmap_base_new(const struct hash_ops *hash_ops, enum HashmapType type HASHMAP_DEBUG_PARAMS) {
@@ -924,6 +1148,46 @@ void internal_hashmap_clear(HashmapBase *h, free_func_t default_free_key, free_f
 
 static int resize_buckets(HashmapBase *h, unsigned entries_add);
 
+#if ENABLE_SWISS_HASHMAP
+/*
+ * Puts the entry from swap slot IDX_PUT into the first free bucket or tombstone
+ * on the probe sequence of 'hash'.
+ */
+static void hashmap_put_swiss(HashmapBase *h, unsigned hash, struct swap_entries *swap) {
+        ctrl_t *ctrl;
+        unsigned group, idx, m, n, probes;
+
+#if ENABLE_DEBUG_HASHMAP
+        h->debug.put_count++;
+#endif
+
+        ctrl = ctrl_ptr(h);
+        n = n_groups(h);
+        group = hash_group(hash, n);
+
+        for (probes = 0; ; probes++) {
+                /* The caller made sure there is room */
+                assert(probes < n);
+
+                m = group_match_empty_or_deleted(group_load_at(h, group));
+                if (m != 0)
+                        break;
+
+                group = next_group(group, n);
+        }
+
+        idx = group * GROUP_WIDTH + u32ctz(m);
+
+        if (ctrl[idx] == CTRL_DELETED)
+                h->indirect.n_deleted--;
+
+        if (h->has_indirect && h->indirect.idx_lowest_entry > idx)
+                h->indirect.idx_lowest_entry = idx;
+
+        ctrl[idx] = hash_ctrl(hash);
+        bucket_move_entry(h, swap, IDX_PUT, idx);
+}
+#else
 /*
  * Finds an empty bucket to put an entry into, starting the scan at 'idx'.
  * Performs Robin Hood swaps as it goes. The entry to put must be placed
@@ -980,11 +1244,13 @@ static bool hashmap_put_robin_hood(HashmapBase *h, unsigned idx,
                 idx = next_idx(h, idx);
         }
 }
+#endif
 
 /*
  * Puts an entry into a hashmap, boldly - no check whether key already exists.
  * The caller must place the entry (only its key and value, not link indexes)
  * in swap slot IDX_PUT.
+ * 'idx' is what bucket_hash() returned for the key.
  * Caller must ensure: the key does not exist yet in the hashmap.
  *                     that resize is not needed if !may_resize.
  * Returns: 1 if entry was put successfully.
@@ -996,7 +1262,9 @@ static int hashmap_base_put_boldly(HashmapBase *h, unsigned idx,
         struct ordered_hashmap_entry *new_entry;
         int r;
 
+#if !ENABLE_SWISS_HASHMAP
         assert(idx < n_buckets(h));
+#endif
 
         new_entry = bucket_at_swap(swap, IDX_PUT);
 
@@ -1028,7 +1296,11 @@ static int hashmap_base_put_boldly(HashmapBase *h, unsigned idx,
                         lh->iterate_list_head = IDX_PUT;
         }
 
+#if ENABLE_SWISS_HASHMAP
+        hashmap_put_swiss(h, idx, swap);
+#else
         assert_se(hashmap_put_robin_hood(h, idx, swap) == false);
+#endif
 
         n_entries_inc(h);
 #if ENABLE_DEBUG_HASHMAP
@@ -1042,6 +1314,131 @@ static int hashmap_base_put_boldly(HashmapBase *h, unsigned idx,
 #define hashmap_put_boldly(h, idx, swap, may_resize) \
         hashmap_base_put_boldly(HASHMAP_BASE(h), idx, swap, may_resize)
 
+#if ENABLE_SWISS_HASHMAP
+/*
+ * Returns 0 if resize is not needed.
+ *         1 if successfully resized.
+ *         -ENOMEM on allocation failure.
+ */
+static int resize_buckets(HashmapBase *h, unsigned entries_add) {
+        struct swap_entries swap;
+        struct direct_storage old_direct;
+        const struct hashmap_type_info *hi;
+        uint8_t *old_storage, *new_storage;
+        ctrl_t *old_ctrl;
+        unsigned idx, old_n_buckets, new_n_buckets, old_n_entries, new_n_entries, old_head = IDX_NIL;
+        uint8_t new_shift;
+        bool had_indirect;
+
+        assert(h);
+
+        hi = &hashmap_type_info[h->type];
+        old_n_entries = n_entries(h);
+        new_n_entries = old_n_entries + entries_add;
+
+        /* overflow? */
+        if (_unlikely_(new_n_entries < entries_add))
+                return -ENOMEM;
+
+        /* For direct storage we allow 100% load, because it's tiny. */
+        if (!h->has_indirect && new_n_entries <= hi->n_direct_buckets)
+                return 0;
+
+        /* Load factor = n/m <= 1 - (1/INV_KEEP_FREE), see above. */
+        new_n_buckets = new_n_entries + new_n_entries / (INV_KEEP_FREE - 1) + 1;
+        /* overflow? */
+        if (_unlikely_(new_n_buckets <= new_n_entries))
+                return -ENOMEM;
+
+        if (_unlikely_(new_n_buckets > UINT_MAX / (hi->entry_size + sizeof(ctrl_t)) - GROUP_WIDTH))
+                return -ENOMEM;
+
+        old_n_buckets = n_buckets(h);
+
+        if (h->has_indirect) {
+                /* Tombstones take up buckets as far as probing is concerned */
+                if (_likely_(new_n_buckets + h->indirect.n_deleted <= old_n_buckets))
+                        return 0;
+
+                /* If the live entries would fill no more than half of the table, it's the tombstones that
+                 * are in the way. Rehash into a table of the same size then, which drops them. */
+                if (new_n_buckets > old_n_buckets / 2)
+                        new_n_buckets = MAX(new_n_buckets, old_n_buckets + 1);
+        }
+
+        if (new_n_buckets > GROUP_WIDTH)
+                new_n_buckets = ALIGN_TO(new_n_buckets, GROUP_WIDTH);
+
+        new_shift = log2u_round_up(MAX(
+                        new_n_buckets * (hi->entry_size + sizeof(ctrl_t)),
+                        2 * sizeof(struct direct_storage)));
+
+        /* Entries are not moved in place, but rehashed into new storage. Thus
+         * a failed allocation leaves everything as it was. */
+        new_storage = malloc(1U << new_shift);
+        if (!new_storage)
+                return -ENOMEM;
+
+        had_indirect = h->has_indirect;
+        if (had_indirect)
+                old_storage = h->indirect.storage;
+        else {
+                /* The direct storage is overwritten by the indirect one below */
+                old_direct = h->direct;
+                old_storage = old_direct.storage;
+        }
+        old_ctrl = (ctrl_t*) (old_storage + hi->entry_size * old_n_buckets);
+
+        if (h->type == HASHMAP_TYPE_ORDERED) {
+                OrderedHashmap *lh = (OrderedHashmap*) h;
+
+                old_head = lh->iterate_list_head;
+                lh->iterate_list_head = lh->iterate_list_tail = IDX_NIL;
+        }
+
+        /* Get a new hash key. If we're just upgrading to indirect storage,
+         * allow reusing a previously generated key. It's still a different key
+         * from the shared one that we used for direct storage. */
+        get_hash_key(h->indirect.hash_key, !had_indirect);
+
+        h->has_indirect = true;
+        h->n_direct_entries = 0;
+        h->indirect.storage = new_storage;
+        h->indirect.n_buckets = (1U << new_shift) / (hi->entry_size + sizeof(ctrl_t));
+        if (h->indirect.n_buckets > GROUP_WIDTH)
+                h->indirect.n_buckets -= h->indirect.n_buckets % GROUP_WIDTH;
+        h->indirect.n_entries = 0;
+        h->indirect.n_deleted = 0;
+        h->indirect.idx_lowest_entry = n_buckets(h);
+
+        memzero(new_storage, n_buckets(h) * hi->entry_size);
+        memset(ctrl_ptr(h), CTRL_EMPTY, n_buckets(h) * sizeof(ctrl_t));
+
+        /* Put all entries again. Ordered hashmaps are walked in insertion order,
+         * so that their iteration list is rebuilt as we go. */
+        idx = h->type == HASHMAP_TYPE_ORDERED ? old_head : 0;
+        while (idx != IDX_NIL && idx < old_n_buckets) {
+                struct ordered_hashmap_entry *e;
+
+                e = (struct ordered_hashmap_entry*) (old_storage + idx * hi->entry_size);
+
+                if (h->type == HASHMAP_TYPE_ORDERED)
+                        idx = e->iterate_next;
+                else if (old_ctrl[idx++] < 0)
+                        continue;
+
+                memcpy(bucket_at_swap(&swap, IDX_PUT), e, hi->entry_size);
+                assert_se(hashmap_base_put_boldly(h, bucket_hash(h, e->p.b.key), &swap, false) == 1);
+        }
+
+        assert(n_entries(h) == old_n_entries);
+
+        if (had_indirect)
+                free(old_storage);
+
+        return 1;
+}
+#else
 /*
  * Returns 0 if resize is not needed.
  *         1 if successfully resized.
@@ -1180,7 +1577,42 @@ static int resize_buckets(HashmapBase *h, unsigned entries_add) {
 
         return 1;
 }
+#endif
+
+#if ENABLE_SWISS_HASHMAP
+/*
+ * Finds an entry with a matching key
+ * 'hash' is what bucket_hash() returned for the key.
+ * Returns: index of the found entry, or IDX_NIL if not found.
+ */
+static unsigned base_bucket_scan(HashmapBase *h, unsigned hash, const void *key) {
+        struct hashmap_base_entry *e;
+        unsigned group, idx, m, n, probes;
+        group_t g;
+
+        n = n_groups(h);
+        group = hash_group(hash, n);
+
+        for (probes = 0; probes < n; probes++) {
+                g = group_load_at(h, group);
+
+                for (m = group_match(g, hash_ctrl(hash)); m != 0; m &= m - 1) {
+                        idx = group * GROUP_WIDTH + u32ctz(m);
+                        e = bucket_at(h, idx);
+                        if (h->hash_ops->compare(e->key, key) == 0)
+                                return idx;
+                }
+
+                /* The entry would have been put into a free bucket of this group */
+                if (group_match_empty(g) != 0)
+                        return IDX_NIL;
+
+                group = next_group(group, n);
+        }
 
+        return IDX_NIL;
+}
+#else
 /*
  * Finds an entry with a matching key
  * Returns: index of the found entry, or IDX_NIL if not found.
@@ -1209,6 +1641,7 @@ static unsigned base_bucket_scan(HashmapBase *h, unsigned idx, const void *key)
                 idx = next_idx(h, idx);
         }
 }
+#endif
 #define bucket_scan(h, idx, key) base_bucket_scan(HASHMAP_BASE(h), idx, key)
 
 int hashmap_put(Hashmap *h, const void *key, void *value) {
@@ -1396,14 +1829,40 @@ void *hashmap_remove2(Hashmap *h, const void *key, void **rkey) {
         return data;
 }
 
+/*
+ * The remove-and-put operations below put the new entry with may_resize=false, as they never increase the
+ * number of entries. With the swiss table the removal may leave a tombstone behind though, and tombstones
+ * take up buckets too. Make room for one more beforehand, so that the table is rehashed if they are what
+ * fills it. Done before the lookups, so that nothing is modified if it fails.
+ */
+static int reserve_for_remove_and_put(HashmapBase *h) {
+#if ENABLE_SWISS_HASHMAP
+        int r;
+
+        /* Removing from a single group never leaves a tombstone */
+        if (n_groups(h) == 1)
+                return 0;
+
+        r = resize_buckets(h, 1);
+        if (r < 0)
+                return r;
+#endif
+        return 0;
+}
+
 int hashmap_remove_and_put(Hashmap *h, const void *old_key, const void *new_key, void *value) {
         struct swap_entries swap;
         struct plain_hashmap_entry *e;
         unsigned old_hash, new_hash, idx;
+        int r;
 
         if (!h)
                 return -ENOENT;
 
+        r = reserve_for_remove_and_put(HASHMAP_BASE(h));
+        if (r < 0)
+                return r;
+
         old_hash = bucket_hash(h, old_key);
         idx = bucket_scan(h, old_hash, old_key);
         if (idx == IDX_NIL)
@@ -1427,10 +1886,15 @@ int set_remove_and_put(Set *s, const void *old_key, const void *new_key) {
         struct swap_entries swap;
         struct hashmap_base_entry *e;
         unsigned old_hash, new_hash, idx;
+        int r;
 
         if (!s)
                 return -ENOENT;
 
+        r = reserve_for_remove_and_put(HASHMAP_BASE(s));
+        if (r < 0)
+                return r;
+
         old_hash = bucket_hash(s, old_key);
         idx = bucket_scan(s, old_hash, old_key);
         if (idx == IDX_NIL)
@@ -1453,10 +1917,15 @@ int hashmap_remove_and_replace(Hashmap *h, const void *old_key, const void *new_
         struct swap_entries swap;
         struct plain_hashmap_entry *e;
         unsigned old_hash, new_hash, idx_old, idx_new;
+        int r;
 
         if (!h)
                 return -ENOENT;
 
+        r = reserve_for_remove_and_put(HASHMAP_BASE(h));
+        if (r < 0)
+                return r;
+
         old_hash = bucket_hash(h, old_key);
         idx_old = bucket_scan(h, old_hash, old_key);
         if (idx_old == IDX_NIL)
@@ -1469,9 +1938,11 @@ int hashmap_remove_and_replace(Hashmap *h, const void *old_key, const void *new_
         if (idx_new != IDX_NIL)
                 if (idx_old != idx_new) {
                         remove_entry(h, idx_new);
+#if !ENABLE_SWISS_HASHMAP
                         /* Compensate for a possible backward shift. */
                         if (old_key != bucket_at(HASHMAP_BASE(h), idx_old)->key)
                                 idx_old = prev_idx(HASHMAP_BASE(h), idx_old);
+#endif
                         assert(old_key == bucket_at(HASHMAP_BASE(h), idx_old)->key);
                 }
 
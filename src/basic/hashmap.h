@@ -22,6 +22,13 @@
 
 #define HASH_KEY_SIZE 16
 
+/* 1 / (1 - max_load_factor), see hashmap.c */
+#if ENABLE_SWISS_HASHMAP
+#define HASHMAP_INV_KEEP_FREE 8U
+#else
+#define HASHMAP_INV_KEEP_FREE 5U
+#endif
+
 typedef void* (*hashmap_destroy_t)(void *p);
 
 /* The base type for all hashmap and set types. Many functions in the
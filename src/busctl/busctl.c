@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 
 #include "sd-bus.h"
 
@@ -9,6 +11,7 @@
 #include "bus-internal.h"
 #include "bus-message.h"
 #include "bus-signature.h"
+#include "bus-statistics.h"
 #include "bus-type.h"
 #include "bus-util.h"
 #include "busctl-introspect.h"
@@ -25,7 +28,9 @@
 #include "path-util.h"
 #include "pretty-print.h"
 #include "set.h"
+#include "signal-util.h"
 #include "sort-util.h"
+#include "stdio-util.h"
 #include "strv.h"
 #include "terminal-util.h"
 #include "user-util.h"
@@ -59,9 +64,18 @@ static bool arg_augment_creds = true;
 static bool arg_watch_bind = false;
 static usec_t arg_timeout = 0;
 static const char *arg_destination = NULL;
+static bool arg_client = false;
 
 STATIC_DESTRUCTOR_REGISTER(arg_matches, strv_freep);
 
+/* How much captured output we buffer before writing it out, unless the bus runs idle first */
+#define MONITOR_BUFFER_SIZE (256U*1024U)
+
+/* Upper bound on method calls we remember while waiting for their replies in "busctl stats" */
+#define STATS_PENDING_MAX 65536U
+
+static volatile sig_atomic_t monitor_quit = false;
+
 #define NAME_IS_ACQUIRED INT_TO_PTR(1)
 #define NAME_IS_ACTIVATABLE INT_TO_PTR(2)
 
@@ -1155,15 +1169,15 @@ static int introspect(int argc, char **argv, void *userdata) {
         return 0;
 }
 
-static int message_dump(sd_bus_message *m, FILE *f) {
+static int message_dump(sd_bus_message *m, FILE *f, void *userdata) {
         return bus_message_dump(m, f, BUS_MESSAGE_DUMP_WITH_HEADER);
 }
 
-static int message_pcap(sd_bus_message *m, FILE *f) {
+static int message_pcap(sd_bus_message *m, FILE *f, void *userdata) {
         return bus_message_pcap_frame(m, arg_snaplen, f);
 }
 
-static int message_json(sd_bus_message *m, FILE *f) {
+static int message_json(sd_bus_message *m, FILE *f, void *userdata) {
         _cleanup_(json_variant_unrefp) JsonVariant *v = NULL, *w = NULL;
         char e[2];
         int r;
@@ -1200,7 +1214,47 @@ static int message_json(sd_bus_message *m, FILE *f) {
         return 0;
 }
 
-static int monitor(int argc, char **argv, int (*dump)(sd_bus_message *m, FILE *f)) {
+static void monitor_sigterm(int sig) {
+        monitor_quit = true;
+}
+
+/* Like sd_bus_wait(), but atomically switches to the signal mask 'ss' while sleeping */
+static int monitor_wait(sd_bus *bus, const sigset_t *ss) {
+        struct pollfd p = {};
+        struct timespec ts;
+        uint64_t until;
+        int r;
+
+        p.fd = sd_bus_get_fd(bus);
+        if (p.fd < 0)
+                return p.fd;
+
+        r = sd_bus_get_events(bus);
+        if (r < 0)
+                return r;
+        p.events = r;
+
+        r = sd_bus_get_timeout(bus, &until);
+        if (r < 0)
+                return r;
+        if (until != UINT64_MAX) {
+                usec_t n;
+
+                n = now(CLOCK_MONOTONIC);
+                timespec_store(&ts, until > n ? until - n : 0);
+        }
+
+        if (ppoll(&p, 1, until == UINT64_MAX ? NULL : &ts, ss) < 0)
+                return -errno;
+
+        return 0;
+}
+
+static int monitor(int argc, char **argv, int (*dump)(sd_bus_message *m, FILE *f, void *userdata), void *userdata) {
+        static const struct sigaction sa = {
+                .sa_handler = monitor_sigterm,
+        };
+        sigset_t ss;
         _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *message = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
@@ -1275,9 +1329,15 @@ static int monitor(int argc, char **argv, int (*dump)(sd_bus_message *m, FILE *f
         if (r < 0)
                 return log_error_errno(r, "Failed to get unique name: %m");
 
+        /* Terminate cleanly on SIGINT/SIGTERM, so that buffered output is written and statistics are
+         * shown. The signals are only let through while we sleep in ppoll(), so that one arriving right
+         * after monitor_quit was checked still wakes us up. */
+        assert_se(sigaction_many(&sa, SIGINT, SIGTERM, -1) >= 0);
+        assert_se(sigprocmask_many(SIG_BLOCK, &ss, SIGINT, SIGTERM, -1) >= 0);
+
         log_info("Monitoring bus message stream.");
 
-        for (;;) {
+        while (!monitor_quit) {
                 _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
 
                 r = sd_bus_process(bus, &m);
@@ -1302,8 +1362,11 @@ static int monitor(int argc, char **argv, int (*dump)(sd_bus_message *m, FILE *f
                 }
 
                 if (m) {
-                        dump(m, stdout);
-                        fflush(stdout);
+                        r = dump(m, stdout, userdata);
+                        if (r == -ENOMEM)
+                                return log_oom();
+                        if (r < 0)
+                                log_debug_errno(r, "Failed to show message, ignoring: %m");
 
                         if (sd_bus_message_is_signal(m, "org.freedesktop.DBus.Local", "Disconnected") > 0) {
                                 log_info("Connection terminated, exiting.");
@@ -1316,14 +1379,32 @@ static int monitor(int argc, char **argv, int (*dump)(sd_bus_message *m, FILE *f
                 if (r > 0)
                         continue;
 
-                r = sd_bus_wait(bus, (uint64_t) -1);
+                /* Only write out what we collected when the bus runs idle, so that a busy bus results in
+                 * large writes instead of one per message. */
+                r = fflush_and_check(stdout);
                 if (r < 0)
+                        return log_error_errno(r, "Failed to write output: %m");
+
+                r = monitor_wait(bus, &ss);
+                if (r < 0 && r != -EINTR)
                         return log_error_errno(r, "Failed to wait for bus: %m");
         }
+
+        return 0;
 }
 
 static int verb_monitor(int argc, char **argv, void *userdata) {
-        return monitor(argc, argv, arg_json != JSON_OFF ? message_json : message_dump);
+        int r;
+
+        r = monitor(argc, argv, arg_json != JSON_OFF ? message_json : message_dump, NULL);
+        if (r < 0)
+                return r;
+
+        r = fflush_and_check(stdout);
+        if (r < 0)
+                return log_error_errno(r, "Failed to write output: %m");
+
+        return 0;
 }
 
 static int verb_capture(int argc, char **argv, void *userdata) {
@@ -1333,9 +1414,12 @@ static int verb_capture(int argc, char **argv, void *userdata) {
                 return log_error_errno(SYNTHETIC_ERRNO(EINVAL),
                                        "Refusing to write message data to console, please redirect output to a file.");
 
+        /* Must be called before anything is written to the stream */
+        (void) setvbuf(stdout, NULL, _IOFBF, MONITOR_BUFFER_SIZE);
+
         bus_pcap_header(arg_snaplen, stdout);
 
-        r = monitor(argc, argv, message_pcap);
+        r = monitor(argc, argv, message_pcap, NULL);
         if (r < 0)
                 return r;
 
@@ -1346,6 +1430,362 @@ static int verb_capture(int argc, char **argv, void *userdata) {
         return r;
 }
 
+typedef struct MemberStats {
+        char *key;
+        uint8_t type;
+        char *interface;
+        char *member;
+        uint64_t n_messages;
+        uint64_t n_bytes;
+        uint64_t n_replies;
+        uint64_t n_errors;
+        usec_t latency_total;
+        usec_t latency_max;
+} MemberStats;
+
+typedef struct PendingCall {
+        MemberStats *stats;
+        usec_t timestamp;
+} PendingCall;
+
+typedef struct MonitorStats {
+        Hashmap *members;   /* "type interface member" → MemberStats */
+        Hashmap *pending;   /* "sender cookie" → PendingCall */
+} MonitorStats;
+
+static MemberStats* member_stats_free(MemberStats *s) {
+        if (!s)
+                return NULL;
+
+        free(s->key);
+        free(s->interface);
+        free(s->member);
+        return mfree(s);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(MemberStats*, member_stats_free);
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(member_stats_hash_ops, char, string_hash_func, string_compare_func,
+                                              MemberStats, member_stats_free);
+
+static void monitor_stats_done(MonitorStats *s) {
+        assert(s);
+
+        hashmap_free(s->members);
+        hashmap_free(s->pending);
+}
+
+static int monitor_stats_get(MonitorStats *s, sd_bus_message *m, MemberStats **ret) {
+        _cleanup_(member_stats_freep) MemberStats *n = NULL;
+        MemberStats *existing;
+        const char *k;
+        uint8_t type;
+        int r;
+
+        assert(s);
+        assert(m);
+        assert(ret);
+
+        assert_se(sd_bus_message_get_type(m, &type) >= 0);
+
+        k = strjoina(bus_message_type_to_string(type), " ", strempty(m->interface), " ", strempty(m->member));
+
+        existing = hashmap_get(s->members, k);
+        if (existing) {
+                *ret = existing;
+                return 0;
+        }
+
+        n = new(MemberStats, 1);
+        if (!n)
+                return -ENOMEM;
+
+        *n = (MemberStats) {
+                .type = type,
+        };
+
+        n->key = strdup(k);
+        if (!n->key)
+                return -ENOMEM;
+
+        if (m->interface) {
+                n->interface = strdup(m->interface);
+                if (!n->interface)
+                        return -ENOMEM;
+        }
+
+        if (m->member) {
+                n->member = strdup(m->member);
+                if (!n->member)
+                        return -ENOMEM;
+        }
+
+        r = hashmap_ensure_allocated(&s->members, &member_stats_hash_ops);
+        if (r < 0)
+                return r;
+
+        r = hashmap_put(s->members, n->key, n);
+        if (r < 0)
+                return r;
+
+        *ret = TAKE_PTR(n);
+        return 0;
+}
+
+static char *pending_call_key(const char *peer, uint64_t cookie) {
+        char c[DECIMAL_STR_MAX(uint64_t)];
+
+        xsprintf(c, "%" PRIu64, cookie);
+        return strjoin(peer, " ", c);
+}
+
+static int monitor_stats_call(MonitorStats *s, sd_bus_message *m, MemberStats *stats) {
+        _cleanup_free_ PendingCall *p = NULL;
+        _cleanup_free_ char *k = NULL;
+        uint64_t cookie;
+        int r;
+
+        assert(s);
+        assert(m);
+        assert(stats);
+
+        if (!m->sender || !sd_bus_message_get_expect_reply(m))
+                return 0;
+
+        /* Don't grow without bounds if replies never show up, e.g. because they are filtered */
+        if (hashmap_size(s->pending) >= STATS_PENDING_MAX)
+                return 0;
+
+        assert_se(sd_bus_message_get_cookie(m, &cookie) >= 0);
+
+        k = pending_call_key(m->sender, cookie);
+        if (!k)
+                return -ENOMEM;
+
+        p = new(PendingCall, 1);
+        if (!p)
+                return -ENOMEM;
+
+        *p = (PendingCall) {
+                .stats = stats,
+                .timestamp = now(CLOCK_MONOTONIC),
+        };
+
+        r = hashmap_ensure_allocated(&s->pending, &string_hash_ops_free_free);
+        if (r < 0)
+                return r;
+
+        r = hashmap_put(s->pending, k, p);
+        if (r == -EEXIST) /* cookie reuse by a broken client, ignore */
+                return 0;
+        if (r < 0)
+                return r;
+
+        TAKE_PTR(k);
+        TAKE_PTR(p);
+        return 0;
+}
+
+static PendingCall *monitor_stats_reply(MonitorStats *s, sd_bus_message *m, char **ret_key) {
+        _cleanup_free_ char *k = NULL;
+        uint64_t cookie;
+
+        assert(s);
+        assert(m);
+        assert(ret_key);
+
+        if (!m->destination || sd_bus_message_get_reply_cookie(m, &cookie) < 0)
+                return NULL;
+
+        k = pending_call_key(m->destination, cookie);
+        if (!k)
+                return NULL;
+
+        return hashmap_remove2(s->pending, k, (void**) ret_key);
+}
+
+static int message_stats(sd_bus_message *m, FILE *f, void *userdata) {
+        MonitorStats *s = userdata;
+        MemberStats *stats;
+        uint8_t type;
+        int r;
+
+        assert(m);
+        assert(s);
+
+        assert_se(sd_bus_message_get_type(m, &type) >= 0);
+
+        if (IN_SET(type, SD_BUS_MESSAGE_METHOD_RETURN, SD_BUS_MESSAGE_METHOD_ERROR)) {
+                _cleanup_free_ PendingCall *p = NULL;
+                _cleanup_free_ char *k = NULL;
+
+                /* Account replies to the call they belong to, if we saw it */
+                p = monitor_stats_reply(s, m, &k);
+                if (p) {
+                        usec_t t;
+
+                        t = usec_sub_unsigned(now(CLOCK_MONOTONIC), p->timestamp);
+
+                        stats = p->stats;
+                        stats->n_bytes += BUS_MESSAGE_SIZE(m);
+                        stats->latency_total += t;
+                        stats->latency_max = MAX(stats->latency_max, t);
+
+                        if (type == SD_BUS_MESSAGE_METHOD_ERROR)
+                                stats->n_errors++;
+                        else
+                                stats->n_replies++;
+
+                        return 0;
+                }
+        }
+
+        r = monitor_stats_get(s, m, &stats);
+        if (r < 0)
+                return log_oom();
+
+        stats->n_messages++;
+        stats->n_bytes += BUS_MESSAGE_SIZE(m);
+
+        if (type == SD_BUS_MESSAGE_METHOD_CALL) {
+                r = monitor_stats_call(s, m, stats);
+                if (r < 0)
+                        return log_oom();
+        }
+
+        return 0;
+}
+
+static int client_stats(const char *service) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        const char *text;
+        int r;
+
+        r = acquire_bus(false, &bus);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_call_method(bus, service, "/", BUS_STATISTICS_INTERFACE, "GetStatistics", &error, &reply, NULL);
+        if (r < 0) {
+                if (sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_OBJECT) ||
+                    sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_INTERFACE) ||
+                    sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD))
+                        return log_error_errno(r, "Service %s does not collect bus statistics.", service);
+
+                return log_error_errno(r, "Failed to get statistics of %s: %s", service, bus_error_message(&error, r));
+        }
+
+        r = sd_bus_message_read(reply, "s", &text);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        (void) pager_open(arg_pager_flags);
+
+        fputs(text, stdout);
+        return 0;
+}
+
+static int verb_stats(int argc, char **argv, void *userdata) {
+        _cleanup_(monitor_stats_done) MonitorStats s = {};
+        _cleanup_(table_unrefp) Table *table = NULL;
+        MemberStats *stats;
+        Iterator i;
+        size_t c;
+        int r;
+
+        enum {
+                COLUMN_TYPE,
+                COLUMN_INTERFACE,
+                COLUMN_MEMBER,
+                COLUMN_MESSAGES,
+                COLUMN_BYTES,
+                COLUMN_REPLIES,
+                COLUMN_ERRORS,
+                COLUMN_LATENCY_AVG,
+                COLUMN_LATENCY_MAX,
+        };
+
+        if (arg_client) {
+                if (argc != 2)
+                        return log_error_errno(SYNTHETIC_ERRNO(EINVAL), "--client expects exactly one service name.");
+
+                return client_stats(argv[1]);
+        }
+
+        r = monitor(argc, argv, message_stats, &s);
+        if (r < 0)
+                return r;
+
+        table = table_new("type", "interface", "member", "messages", "bytes", "replies", "errors", "avg latency", "max latency");
+        if (!table)
+                return log_oom();
+
+        table_set_header(table, arg_legend);
+
+        r = table_set_empty_string(table, "-");
+        if (r < 0)
+                return log_error_errno(r, "Failed to set empty string: %m");
+
+        for (c = COLUMN_MESSAGES; c <= COLUMN_LATENCY_MAX; c++) {
+                r = table_set_align_percent(table, table_get_cell(table, 0, c), 100);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to set alignment: %m");
+        }
+
+        r = table_set_sort(table, (size_t) COLUMN_MESSAGES, (size_t) COLUMN_INTERFACE, (size_t) COLUMN_MEMBER, (size_t) -1);
+        if (r < 0)
+                return log_error_errno(r, "Failed to set sort column: %m");
+
+        r = table_set_reverse(table, COLUMN_MESSAGES, true);
+        if (r < 0)
+                return log_error_errno(r, "Failed to set sort order: %m");
+
+        HASHMAP_FOREACH(stats, s.members, i) {
+                uint64_t n;
+
+                r = table_add_many(table,
+                                   TABLE_STRING, bus_message_type_to_string(stats->type),
+                                   TABLE_STRING, stats->interface,
+                                   TABLE_STRING, stats->member,
+                                   TABLE_UINT64, stats->n_messages,
+                                   TABLE_SIZE, stats->n_bytes);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to add fields to table: %m");
+
+                if (stats->type != SD_BUS_MESSAGE_METHOD_CALL) {
+                        r = table_fill_empty(table, COLUMN_TYPE);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to fill line: %m");
+
+                        continue;
+                }
+
+                r = table_add_many(table,
+                                   TABLE_UINT64, stats->n_replies,
+                                   TABLE_UINT64, stats->n_errors);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to add fields to table: %m");
+
+                n = stats->n_replies + stats->n_errors;
+                if (n > 0)
+                        r = table_add_many(table,
+                                           TABLE_TIMESPAN, stats->latency_total / n,
+                                           TABLE_TIMESPAN, stats->latency_max);
+                else
+                        r = table_add_many(table, TABLE_EMPTY, TABLE_EMPTY);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to add fields to table: %m");
+        }
+
+        r = table_print(table, stdout);
+        if (r < 0)
+                return log_error_errno(r, "Failed to show table: %m");
+
+        return 0;
+}
+
 static int status(int argc, char **argv, void *userdata) {
         _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
         _cleanup_(sd_bus_creds_unrefp) sd_bus_creds *creds = NULL;
@@ -2261,11 +2701,14 @@ static int help(void) {
                "     --watch-bind=BOOL     Wait for bus AF_UNIX socket to be bound in the file\n"
                "                           system\n"
                "     --destination=SERVICE Destination service of a signal\n"
+               "     --client              Show the statistics a service collected about its\n"
+               "                           own bus connection, instead of monitoring the bus\n"
                "\nCommands:\n"
                "  list                     List bus names\n"
                "  status [SERVICE]         Show bus service, process or bus owner credentials\n"
                "  monitor [SERVICE...]     Show bus traffic\n"
                "  capture [SERVICE...]     Capture bus traffic as pcap\n"
+               "  stats [SERVICE...]       Show per-member statistics of bus traffic\n"
                "  tree [SERVICE...]        Show object tree of service\n"
                "  introspect SERVICE OBJECT [INTERFACE]\n"
                "  call SERVICE OBJECT INTERFACE METHOD [SIGNATURE [ARGUMENT...]]\n"
@@ -2315,6 +2758,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_WATCH_BIND,
                 ARG_JSON,
                 ARG_DESTINATION,
+                ARG_CLIENT,
         };
 
         static const struct option options[] = {
@@ -2345,6 +2789,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "watch-bind",                      required_argument, NULL, ARG_WATCH_BIND                      },
                 { "json",                            required_argument, NULL, ARG_JSON                            },
                 { "destination",                     required_argument, NULL, ARG_DESTINATION                     },
+                { "client",                          no_argument,       NULL, ARG_CLIENT                          },
                 {},
         };
 
@@ -2519,6 +2964,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_destination = optarg;
                         break;
 
+                case ARG_CLIENT:
+                        arg_client = true;
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -2536,6 +2985,7 @@ static int busctl_main(int argc, char *argv[]) {
                 { "status",       VERB_ANY, 2,        0,            status         },
                 { "monitor",      VERB_ANY, VERB_ANY, 0,            verb_monitor   },
                 { "capture",      VERB_ANY, VERB_ANY, 0,            verb_capture   },
+                { "stats",        VERB_ANY, VERB_ANY, 0,            verb_stats     },
                 { "tree",         VERB_ANY, VERB_ANY, 0,            tree           },
                 { "introspect",   3,        4,        0,            introspect     },
                 { "call",         5,        VERB_ANY, 0,            call           },
@@ -9,6 +9,7 @@
 #include "architecture.h"
 #include "build.h"
 #include "bus-common-errors.h"
+#include "bus-objects.h"
 #include "dbus-execute.h"
 #include "dbus-job.h"
 #include "dbus-manager.h"
@@ -20,6 +21,7 @@
 #include "fileio.h"
 #include "format-util.h"
 #include "fs-util.h"
+#include "glob-util.h"
 #include "install.h"
 #include "log.h"
 #include "os-util.h"
@@ -736,6 +738,156 @@ static int method_list_units_by_names(sd_bus_message *message, void *userdata, s
         return sd_bus_send(NULL, reply, NULL);
 }
 
+static int reply_unit_properties(sd_bus_message *reply, sd_bus_message *message, Unit *u, const char *name, char **properties, sd_bus_error *error) {
+        _cleanup_free_ char *path = NULL;
+        int r;
+
+        assert(reply);
+        assert(message);
+        assert(u);
+        assert(name);
+
+        path = unit_dbus_path(u);
+        if (!path)
+                return -ENOMEM;
+
+        r = sd_bus_message_open_container(reply, 'r', "sa{sv}");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "s", name);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "{sv}");
+        if (r < 0)
+                return r;
+
+        /* Serialize the properties through the very same vtables GetAll() on the unit object uses, so that
+         * the result is identical, just without a round trip per unit and interface. */
+        r = bus_append_object_properties(sd_bus_message_get_bus(message), reply, path, properties, error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_close_container(reply);
+}
+
+static int method_get_units_properties(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **units = NULL, **properties = NULL;
+        _cleanup_set_free_ Set *seen = NULL;
+        Manager *m = userdata;
+        char **unit;
+        const char *k;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &units);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &properties);
+        if (r < 0)
+                return r;
+
+        seen = set_new(NULL);
+        if (!seen)
+                return -ENOMEM;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(sa{sv})");
+        if (r < 0)
+                return r;
+
+        /* No names at all means all loaded units */
+        if (strv_isempty(units)) {
+                r = strv_extend(&units, "*");
+                if (r < 0)
+                        return r;
+        }
+
+        /* Each unit is returned at most once, under the name it was first asked for. Globs are matched
+         * against the loaded units only. Plain names are loaded if they aren't yet, as LoadUnit() does, and
+         * not as GetUnit(), which fails for them. Hence a name without a unit file is returned with
+         * LoadState "not-found", the same as GetAll() on the unit's object path would report, which is
+         * what "systemctl show" falls back to. */
+        STRV_FOREACH(unit, units) {
+
+                if (string_is_glob(*unit)) {
+                        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                                _cleanup_(sd_bus_error_free) sd_bus_error denied = SD_BUS_ERROR_NULL;
+
+                                if (k != u->id)
+                                        continue;
+
+                                if (fnmatch(*unit, u->id, FNM_NOESCAPE) != 0)
+                                        continue;
+
+                                /* Units we may not look at are skipped, as if they didn't match */
+                                if (mac_selinux_unit_access_check(u, message, "status", &denied) < 0)
+                                        continue;
+
+                                r = set_put(seen, u);
+                                if (r < 0)
+                                        return r;
+                                if (r == 0)
+                                        continue;
+
+                                r = reply_unit_properties(reply, message, u, u->id, properties, error);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        continue;
+                }
+
+                if (!unit_name_is_valid(*unit, UNIT_NAME_ANY))
+                        continue;
+
+                r = bus_load_unit_by_name(m, message, *unit, &u, error);
+                if (r < 0)
+                        return r;
+
+                /* Like LoadUnit(), fail if a unit we may not look at is asked for by name */
+                r = mac_selinux_unit_access_check(u, message, "status", error);
+                if (r < 0)
+                        return r;
+
+                r = set_put(seen, u);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        continue;
+
+                r = reply_unit_properties(reply, message, u, *unit, properties, error);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static int method_get_unit_processes(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         /* Don't load a unit (since it won't have any processes if it's not loaded), but don't insist on the
          * unit being loaded (because even improperly loaded units might still have processes around */
@@ -2465,6 +2617,7 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_PROPERTY("DefaultLimitRTTIMESoft", "t", bus_property_get_rlimit, offsetof(Manager, rlimit[RLIMIT_RTTIME]), SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("DefaultTasksMax", "t", NULL, offsetof(Manager, default_tasks_max), SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("TimerSlackNSec", "t", property_get_timer_slack_nsec, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("DBusSignalCoalesceUSec", "t", bus_property_get_usec, offsetof(Manager, dbus_signal_coalesce_usec), SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("DefaultOOMPolicy", "s", bus_property_get_oom_policy, offsetof(Manager, default_oom_policy), SD_BUS_VTABLE_PROPERTY_CONST),
 
         SD_BUS_METHOD("GetUnit", "s", "o", method_get_unit, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -2501,6 +2654,7 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_METHOD("ListUnitsFiltered", "as", "a(ssssssouso)", method_list_units_filtered, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnitsByPatterns", "asas", "a(ssssssouso)", method_list_units_by_patterns, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnitsByNames", "as", "a(ssssssouso)", method_list_units_by_names, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("GetUnitsProperties", "asas", "a(sa{sv})", method_get_units_properties, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListJobs", NULL, "a(usssoo)", method_list_jobs, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Subscribe", NULL, NULL, method_subscribe, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Unsubscribe", NULL, NULL, method_unsubscribe, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -5,6 +5,7 @@
 #include "alloc-util.h"
 #include "bpf-firewall.h"
 #include "bus-common-errors.h"
+#include "bus-objects.h"
 #include "cgroup-util.h"
 #include "condition.h"
 #include "dbus-job.h"
@@ -1365,6 +1366,16 @@ static int send_changed_signal(sd_bus *bus, void *userdata) {
          * type, then for the generic unit. The clients may rely on
          * this order to get atomic behavior if needed. */
 
+        /* When coalescing, the signals are about a number of changes at once, most properties are unaffected
+         * by them though, hence send only those that changed since the last signal. */
+        if (u->manager->dbus_signal_coalesce_usec > 0) {
+                r = bus_emit_properties_changed_diff(bus, p, unit_dbus_interface_from_type(u->type));
+                if (r < 0)
+                        return r;
+
+                return bus_emit_properties_changed_diff(bus, p, "org.freedesktop.systemd1.Unit");
+        }
+
         r = sd_bus_emit_properties_changed_strv(
                         bus, p,
                         unit_dbus_interface_from_type(u->type),
@@ -1395,6 +1406,7 @@ void bus_unit_send_change_signal(Unit *u) {
                 log_unit_debug_errno(u, r, "Failed to send unit change signal for %s: %m", u->id);
 
         u->sent_dbus_new_signal = true;
+        u->manager->n_dbus_unit_signals++;
 }
 
 void bus_unit_send_pending_change_signal(Unit *u, bool including_new) {
@@ -1415,6 +1427,10 @@ void bus_unit_send_pending_change_signal(Unit *u, bool including_new) {
                                                * when we are reloading. */
                 return;
 
+        if (!including_new && u->manager->dbus_signal_coalesce_usec > 0) /* When coalescing, intermediary states are
+                                                                          * merged into one signal on purpose */
+                return;
+
         bus_unit_send_change_signal(u);
 }
 
@@ -1447,6 +1463,27 @@ static int send_removed_signal(sd_bus *bus, void *userdata) {
         return sd_bus_send(bus, m, NULL);
 }
 
+static void bus_unit_forget(Unit *u) {
+        _cleanup_free_ char *p = NULL;
+        Iterator i;
+        char *n;
+
+        assert(u);
+
+        /* The unit may be looked up by any of its names, and by its invocation ID */
+        SET_FOREACH(n, u->names, i) {
+                _cleanup_free_ char *q = NULL;
+
+                q = unit_dbus_path_from_name(n);
+                if (q)
+                        bus_forget_object(u->manager, q);
+        }
+
+        p = unit_dbus_path_invocation_id(u);
+        if (p)
+                bus_forget_object(u->manager, p);
+}
+
 void bus_unit_send_removed_signal(Unit *u) {
         int r;
         assert(u);
@@ -1457,6 +1494,8 @@ void bus_unit_send_removed_signal(Unit *u) {
         if (!u->id)
                 return;
 
+        bus_unit_forget(u);
+
         r = bus_foreach_bus(u->manager, u->bus_track, send_removed_signal, u);
         if (r < 0)
                 log_unit_debug_errno(u, r, "Failed to send unit remove signal for %s: %m", u->id);
@@ -10,6 +10,7 @@
 #include "bus-common-errors.h"
 #include "bus-error.h"
 #include "bus-internal.h"
+#include "bus-objects.h"
 #include "bus-util.h"
 #include "dbus-automount.h"
 #include "dbus-cgroup.h"
@@ -1195,6 +1196,24 @@ int bus_foreach_bus(
         return ret;
 }
 
+void bus_forget_object(Manager *m, const char *path) {
+        Iterator i;
+        sd_bus *b;
+
+        assert(m);
+        assert(path);
+
+        /* Our objects are found through fallback vtables, hence sd-bus doesn't learn when one of them goes
+         * away, and would otherwise compare the properties of the next object at the same path against the
+         * digests of what it last sent for this one, see bus_emit_properties_changed_diff(). */
+
+        SET_FOREACH(b, m->private_buses, i)
+                bus_property_cache_invalidate(b, path);
+
+        if (m->api_bus)
+                bus_property_cache_invalidate(m->api_bus, path);
+}
+
 void bus_track_serialize(sd_bus_track *t, FILE *f, const char *prefix) {
         const char *n;
 
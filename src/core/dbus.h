@@ -24,6 +24,7 @@ int bus_track_coldplug(Manager *m, sd_bus_track **t, bool recursive, char **l);
 int manager_enqueue_sync_bus_names(Manager *m);
 
 int bus_foreach_bus(Manager *m, sd_bus_track *subscribed2, int (*send_message)(sd_bus *bus, void *userdata), void *userdata);
+void bus_forget_object(Manager *m, const char *path);
 
 int bus_verify_manage_units_async(Manager *m, sd_bus_message *call, sd_bus_error *error);
 int bus_verify_manage_unit_files_async(Manager *m, sd_bus_message *call, sd_bus_error *error);
@@ -132,6 +132,7 @@ static uint64_t arg_capability_bounding_set;
 static bool arg_no_new_privs;
 static nsec_t arg_timer_slack_nsec;
 static usec_t arg_default_timer_accuracy_usec;
+static usec_t arg_dbus_signal_coalesce_usec;
 static Set* arg_syscall_archs;
 static FILE* arg_serialization;
 static int arg_default_cpu_accounting;
@@ -568,6 +569,7 @@ static int parse_config_file(void) {
                 { "Manager", "SystemCallArchitectures",      config_parse_syscall_archs,      0, &arg_syscall_archs                     },
 #endif
                 { "Manager", "TimerSlackNSec",               config_parse_nsec,               0, &arg_timer_slack_nsec                  },
+                { "Manager", "DBusSignalCoalesceSec",        config_parse_sec,                0, &arg_dbus_signal_coalesce_usec         },
                 { "Manager", "DefaultTimerAccuracySec",      config_parse_sec,                0, &arg_default_timer_accuracy_usec       },
                 { "Manager", "DefaultStandardOutput",        config_parse_output_restricted,  0, &arg_default_std_output                },
                 { "Manager", "DefaultStandardError",         config_parse_output_restricted,  0, &arg_default_std_error                 },
@@ -682,6 +684,7 @@ static void set_manager_settings(Manager *m) {
         m->reboot_watchdog = arg_reboot_watchdog;
         m->kexec_watchdog = arg_kexec_watchdog;
         m->cad_burst_action = arg_cad_burst_action;
+        m->dbus_signal_coalesce_usec = arg_dbus_signal_coalesce_usec;
 
         manager_set_show_status(m, arg_show_status);
         m->status_unit_format = arg_status_unit_format;
@@ -2122,6 +2125,7 @@ static void reset_arguments(void) {
         arg_no_new_privs = false;
         arg_timer_slack_nsec = NSEC_INFINITY;
         arg_default_timer_accuracy_usec = 1 * USEC_PER_MINUTE;
+        arg_dbus_signal_coalesce_usec = 0;
 
         arg_syscall_archs = set_free(arg_syscall_archs);
 
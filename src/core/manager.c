@@ -849,6 +849,11 @@ int manager_new(UnitFileScope scope, ManagerTestRunFlags test_run_flags, Manager
         if (r < 0)
                 return r;
 
+        /* Keep per event source accounting, so that "systemd-analyze dump" can tell what we spend our time on */
+        r = sd_event_set_statistics(m->event, true);
+        if (r < 0)
+                return r;
+
         r = manager_setup_run_queue(m);
         if (r < 0)
                 return r;
@@ -1362,6 +1367,7 @@ Manager* manager_free(Manager *m) {
         sd_event_source_unref(m->time_change_event_source);
         sd_event_source_unref(m->timezone_change_event_source);
         sd_event_source_unref(m->jobs_in_progress_event_source);
+        sd_event_source_unref(m->dbus_coalesce_event_source);
         sd_event_source_unref(m->run_queue_event_source);
         sd_event_source_unref(m->user_lookup_event_source);
         sd_event_source_unref(m->sync_bus_names_event_source);
@@ -2064,6 +2070,47 @@ void manager_dump_units(Manager *s, FILE *f, const char *prefix) {
                         unit_dump(u, f, prefix);
 }
 
+static void manager_dump_statistics(FILE *f, const char *prefix, const char *title, const char *stats) {
+        _cleanup_strv_free_ char **lines = NULL;
+        char **l;
+
+        assert(f);
+        assert(title);
+        assert(stats);
+
+        lines = strv_split_newlines(stats);
+        if (!lines)
+                return;
+
+        fprintf(f, "%s%s:\n", strempty(prefix), title);
+        STRV_FOREACH(l, lines)
+                fprintf(f, "%s\t%s\n", strempty(prefix), *l);
+}
+
+static void manager_dump_event_statistics(Manager *m, FILE *f, const char *prefix) {
+        _cleanup_free_ char *stats = NULL;
+
+        assert(m);
+        assert(f);
+
+        if (sd_event_get_statistics(m->event, &stats) < 0)
+                return;
+
+        manager_dump_statistics(f, prefix, "Event loop statistics", stats);
+}
+
+static void manager_dump_bus_statistics(Manager *m, FILE *f, const char *prefix) {
+        _cleanup_free_ char *stats = NULL;
+
+        assert(m);
+        assert(f);
+
+        if (!m->api_bus || sd_bus_get_statistics(m->api_bus, &stats) < 0)
+                return;
+
+        manager_dump_statistics(f, prefix, "API bus statistics", stats);
+}
+
 void manager_dump(Manager *m, FILE *f, const char *prefix) {
         ManagerTimestamp q;
 
@@ -2082,6 +2129,8 @@ void manager_dump(Manager *m, FILE *f, const char *prefix) {
                                                                 format_timespan(buf, sizeof buf, t->monotonic, 1));
         }
 
+        manager_dump_event_statistics(m, f, prefix);
+        manager_dump_bus_statistics(m, f, prefix);
         manager_dump_units(m, f, prefix);
         manager_dump_jobs(m, f, prefix);
 }
@@ -2155,8 +2204,48 @@ static int manager_dispatch_run_queue(sd_event_source *source, void *userdata) {
         return 1;
 }
 
+static int manager_dispatch_dbus_coalesce(sd_event_source *source, usec_t usec, void *userdata) {
+        /* Nothing to do here, the held back signals are sent out as part of the regular queue dispatching
+         * once the event loop returns */
+        return 0;
+}
+
+static bool manager_hold_dbus_unit_queue(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (m->dbus_signal_coalesce_usec <= 0 || !m->dbus_unit_queue)
+                return false;
+
+        if (now(CLOCK_MONOTONIC) >= m->dbus_unit_queue_hold_until)
+                return false;
+
+        if (m->dbus_coalesce_event_source) {
+                r = sd_event_source_set_time(m->dbus_coalesce_event_source, m->dbus_unit_queue_hold_until);
+                if (r >= 0)
+                        r = sd_event_source_set_enabled(m->dbus_coalesce_event_source, SD_EVENT_ONESHOT);
+        } else {
+                r = sd_event_add_time(
+                                m->event,
+                                &m->dbus_coalesce_event_source,
+                                CLOCK_MONOTONIC,
+                                m->dbus_unit_queue_hold_until, 1,
+                                manager_dispatch_dbus_coalesce, m);
+                if (r >= 0)
+                        (void) sd_event_source_set_description(m->dbus_coalesce_event_source, "manager-dbus-coalesce");
+        }
+        if (r < 0) {
+                log_debug_errno(r, "Failed to arm D-Bus signal coalescing timer, sending signals right away: %m");
+                return false;
+        }
+
+        return true;
+}
+
 static unsigned manager_dispatch_dbus_queue(Manager *m) {
         unsigned n = 0, budget;
+        bool hold = false;
         Unit *u;
         Job *j;
 
@@ -2188,9 +2277,14 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
                  * i.e. space, while the "budget" should put a limit on time. Also note that the "threshold" is
                  * currently chosen much higher than the "budget". */
                 budget = MANAGER_BUS_MESSAGE_BUDGET;
+
+                /* If we shall coalesce change signals of units, and we sent some not long ago, let's wait
+                 * until the window is over, and merge whatever else happens to the queued units until then
+                 * into the same signal. */
+                hold = manager_hold_dbus_unit_queue(m);
         }
 
-        while (budget != 0 && (u = m->dbus_unit_queue)) {
+        while (budget != 0 && !hold && (u = m->dbus_unit_queue)) {
 
                 assert(u->in_dbus_queue);
 
@@ -2201,6 +2295,11 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
                         budget--;
         }
 
+        /* Once the queue is drained, start a new window. If we ran out of budget we don't, as what's left was
+         * held back long enough already. */
+        if (n > 0 && !m->dbus_unit_queue && m->dbus_signal_coalesce_usec > 0)
+                m->dbus_unit_queue_hold_until = usec_add(now(CLOCK_MONOTONIC), m->dbus_signal_coalesce_usec);
+
         while (budget != 0 && (j = m->dbus_job_queue)) {
                 assert(j->in_dbus_queue);
 
@@ -3694,6 +3793,7 @@ static void manager_notify_finished(Manager *m) {
         }
 
         bus_manager_send_finished(m, firmware_usec, loader_usec, kernel_usec, initrd_usec, userspace_usec, total_usec);
+        log_debug("Sent %u unit change signals during startup.", m->n_dbus_unit_signals);
 
         sd_notifyf(false,
                    m->ready_sent ? "STATUS=Startup finished in %s."
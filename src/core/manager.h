@@ -155,6 +155,14 @@ struct Manager {
         LIST_HEAD(Unit, dbus_unit_queue);
         LIST_HEAD(Job, dbus_job_queue);
 
+        /* If non-zero, change signals of units are held back until this much time passed since the last
+         * batch, so that bursts of state changes are merged into fewer signals. The timer wakes us up when
+         * the window is over. */
+        usec_t dbus_signal_coalesce_usec;
+        usec_t dbus_unit_queue_hold_until;
+        sd_event_source *dbus_coalesce_event_source;
+        unsigned n_dbus_unit_signals;
+
         /* Units to remove */
         LIST_HEAD(Unit, cleanup_queue);
 
@@ -14,6 +14,7 @@ void dummy_server_init(Server *s, const uint8_t *buffer, size_t size) {
                 .audit_fd = -1,
                 .hostname_fd = -1,
                 .notify_fd = -1,
+                .console_fd = -1,
                 .storage = STORAGE_NONE,
                 .line_max = 64,
         };
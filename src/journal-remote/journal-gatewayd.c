@@ -15,7 +15,6 @@
 
 #include "alloc-util.h"
 #include "bus-util.h"
-#include "errno-util.h"
 #include "fd-util.h"
 #include "fileio.h"
 #include "hostname-util.h"
@@ -27,7 +26,6 @@
 #include "parse-util.h"
 #include "pretty-print.h"
 #include "sigbus.h"
-#include "tmpfile-util.h"
 #include "util.h"
 
 #define JOURNAL_WAIT_TIMEOUT (10*USEC_PER_SEC)
@@ -51,7 +49,10 @@ typedef struct RequestMeta {
         uint64_t n_entries;
         bool n_entries_set;
 
+        /* The current entry is rendered into this in-memory stream, which is reused for all entries */
         FILE *tmp;
+        char *tmp_buf;
+        size_t tmp_size;
         uint64_t delta, size;
 
         int argument_parse_error;
@@ -100,6 +101,7 @@ static void request_meta_free(
         sd_journal_close(m->journal);
 
         safe_fclose(m->tmp);
+        free(m->tmp_buf);
 
         free(m->cursor);
         free(m);
@@ -123,19 +125,33 @@ static int request_meta_ensure_tmp(RequestMeta *m) {
         if (m->tmp)
                 rewind(m->tmp);
         else {
-                int fd;
+                m->tmp = open_memstream_unlocked(&m->tmp_buf, &m->tmp_size);
+                if (!m->tmp)
+                        return -ENOMEM;
+        }
 
-                fd = open_tmpfile_unlinkable("/tmp", O_RDWR|O_CLOEXEC);
-                if (fd < 0)
-                        return fd;
+        return 0;
+}
 
-                m->tmp = fdopen(fd, "w+");
-                if (!m->tmp) {
-                        safe_close(fd);
-                        return -errno;
-                }
-        }
+static int request_meta_finish_tmp(RequestMeta *m) {
+        off_t sz;
+        int r;
+
+        assert(m);
+        assert(m->tmp);
+
+        /* Make sure the buffer is updated, and remember how much of it belongs to the current item, as the
+         * buffer might still contain a longer, previous item after the current one. */
+        r = fflush_and_check(m->tmp);
+        if (r < 0)
+                return r;
 
+        sz = ftello(m->tmp);
+        if (sz == (off_t) -1)
+                return -errno;
+
+        assert((size_t) sz <= m->tmp_size);
+        m->size = (uint64_t) sz;
         return 0;
 }
 
@@ -147,7 +163,7 @@ static ssize_t request_reader_entries(
 
         RequestMeta *m = cls;
         int r;
-        size_t n, k;
+        size_t n;
 
         assert(m);
         assert(buf);
@@ -157,8 +173,6 @@ static ssize_t request_reader_entries(
         pos -= m->delta;
 
         while (pos >= m->size) {
-                off_t sz;
-
                 /* End of this entry, so let's serialize the next
                  * one */
 
@@ -227,37 +241,24 @@ static ssize_t request_reader_entries(
                         return MHD_CONTENT_READER_END_WITH_ERROR;
                 }
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error_errno(errno, "Failed to retrieve file position: %m");
+                r = request_meta_finish_tmp(m);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to serialize item: %m");
                         return MHD_CONTENT_READER_END_WITH_ERROR;
                 }
-
-                m->size = (uint64_t) sz;
         }
 
         if (m->tmp == NULL && m->follow)
                 return 0;
 
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error_errno(errno, "Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
-
         n = m->size - pos;
         if (n < 1)
                 return 0;
         if (n > max)
                 n = max;
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno != 0 ? strerror_safe(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
-
-        return (ssize_t) k;
+        memcpy(buf, m->tmp_buf + pos, n);
+        return (ssize_t) n;
 }
 
 static int request_parse_accept(
@@ -539,7 +540,7 @@ static ssize_t request_reader_fields(
 
         RequestMeta *m = cls;
         int r;
-        size_t n, k;
+        size_t n;
 
         assert(m);
         assert(buf);
@@ -549,7 +550,6 @@ static ssize_t request_reader_fields(
         pos -= m->delta;
 
         while (pos >= m->size) {
-                off_t sz;
                 const void *d;
                 size_t l;
 
@@ -585,32 +585,19 @@ static ssize_t request_reader_fields(
                         return MHD_CONTENT_READER_END_WITH_ERROR;
                 }
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error_errno(errno, "Failed to retrieve file position: %m");
+                r = request_meta_finish_tmp(m);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to serialize item: %m");
                         return MHD_CONTENT_READER_END_WITH_ERROR;
                 }
-
-                m->size = (uint64_t) sz;
-        }
-
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error_errno(errno, "Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
         }
 
         n = m->size - pos;
         if (n > max)
                 n = max;
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno != 0 ? strerror_safe(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
-
-        return (ssize_t) k;
+        memcpy(buf, m->tmp_buf + pos, n);
+        return (ssize_t) n;
 }
 
 static int request_handler_fields(
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <locale.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -607,38 +608,126 @@ static const char *find_id(void *p, sd_id128_t id) {
                 le64toh(f->offset);
 }
 
-int catalog_get(const char* database, sd_id128_t id, char **_text) {
+/* The catalog database is immutable once written (catalog_update() replaces it atomically via
+ * rename()), hence we keep the last mapping around and reuse it as long as the file on disk is the
+ * same. This way "journalctl -x" doesn't have to open and map the database once per entry. There's a
+ * single mapping for the whole process, so that threads coming and going don't leave theirs behind,
+ * which is why it's protected by a mutex. */
+typedef struct CatalogMap {
+        char *database;
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtim;
+        size_t size;
+        void *p;
+} CatalogMap;
+
+static CatalogMap catalog_map = {};
+static pthread_mutex_t catalog_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void catalog_map_done(CatalogMap *m) {
+        assert(m);
+
+        if (m->p)
+                (void) munmap(m->p, PAGE_ALIGN(m->size));
+
+        free(m->database);
+        *m = (CatalogMap) {};
+}
+
+static bool catalog_map_valid(const CatalogMap *m, const char *database, const struct stat *st) {
+        assert(m);
+        assert(st);
+
+        return m->p &&
+                path_equal(m->database, database) &&
+                m->dev == st->st_dev &&
+                m->ino == st->st_ino &&
+                m->size == (size_t) st->st_size &&
+                m->mtim.tv_sec == st->st_mtim.tv_sec &&
+                m->mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Must be called with catalog_map_mutex held, the returned mapping is only valid until it's released */
+static int catalog_map_get(const char *database, const void **ret) {
         _cleanup_close_ int fd = -1;
-        void *p = NULL;
-        struct stat st = {};
-        char *text = NULL;
+        _cleanup_free_ char *d = NULL;
+        struct stat st;
+        void *p;
         int r;
+
+        assert(database);
+        assert(ret);
+
+        if (stat(database, &st) < 0) {
+                r = -errno;
+                catalog_map_done(&catalog_map);
+                return r;
+        }
+
+        if (catalog_map_valid(&catalog_map, database, &st)) {
+                *ret = catalog_map.p;
+                return 0;
+        }
+
+        d = strdup(database);
+        if (!d)
+                return -ENOMEM;
+
+        r = open_mmap(database, &fd, &st, &p);
+        if (r < 0)
+                return r;
+
+        catalog_map_done(&catalog_map);
+        catalog_map = (CatalogMap) {
+                .database = TAKE_PTR(d),
+                .dev = st.st_dev,
+                .ino = st.st_ino,
+                .mtim = st.st_mtim,
+                .size = st.st_size,
+                .p = p,
+        };
+
+        *ret = p;
+        return 0;
+}
+
+void catalog_cache_flush(void) {
+        assert_se(pthread_mutex_lock(&catalog_map_mutex) == 0);
+        catalog_map_done(&catalog_map);
+        assert_se(pthread_mutex_unlock(&catalog_map_mutex) == 0);
+}
+
+static int catalog_get_locked(const char* database, sd_id128_t id, char **_text) {
+        const void *p;
         const char *s;
+        char *text;
+        int r;
 
         assert(_text);
 
-        r = open_mmap(database, &fd, &st, &p);
+        r = catalog_map_get(database, &p);
         if (r < 0)
                 return r;
 
-        s = find_id(p, id);
-        if (!s) {
-                r = -ENOENT;
-                goto finish;
-        }
+        s = find_id((void*) p, id);
+        if (!s)
+                return -ENOENT;
 
         text = strdup(s);
-        if (!text) {
-                r = -ENOMEM;
-                goto finish;
-        }
+        if (!text)
+                return -ENOMEM;
 
         *_text = text;
-        r = 0;
+        return 0;
+}
 
-finish:
-        if (p)
-                munmap(p, st.st_size);
+int catalog_get(const char* database, sd_id128_t id, char **_text) {
+        int r;
+
+        assert_se(pthread_mutex_lock(&catalog_map_mutex) == 0);
+        r = catalog_get_locked(database, id, _text);
+        assert_se(pthread_mutex_unlock(&catalog_map_mutex) == 0);
 
         return r;
 }
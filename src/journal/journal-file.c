@@ -1477,10 +1477,10 @@ static int journal_file_append_field(
 
 static int journal_file_append_data(
                 JournalFile *f,
-                const void *data, uint64_t size,
+                const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t hash, p;
+        uint64_t p;
         uint64_t osize;
         Object *o;
         int r, compression = 0;
@@ -1489,8 +1489,6 @@ static int journal_file_append_data(
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
-
         r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
                 return r;
@@ -1603,12 +1601,60 @@ uint64_t journal_file_hash_table_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
 }
 
+typedef struct ChainCacheItem {
+        uint64_t first; /* the array at the beginning of the chain */
+        uint64_t array; /* the cached array */
+        uint64_t begin; /* the first item in the cached array */
+        uint64_t total; /* the total number of items in all arrays before this one in the chain */
+        uint64_t last_index; /* the last index we looked at, to optimize locality when bisecting */
+} ChainCacheItem;
+
+static void chain_cache_put(
+                OrderedHashmap *h,
+                ChainCacheItem *ci,
+                uint64_t first,
+                uint64_t array,
+                uint64_t begin,
+                uint64_t total,
+                uint64_t last_index) {
+
+        if (!ci) {
+                /* If the chain item to cache for this chain is the
+                 * first one it's not worth caching anything */
+                if (array == first)
+                        return;
+
+                if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
+                        ci = ordered_hashmap_steal_first(h);
+                        assert(ci);
+                } else {
+                        ci = new(ChainCacheItem, 1);
+                        if (!ci)
+                                return;
+                }
+
+                ci->first = first;
+
+                if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
+                        free(ci);
+                        return;
+                }
+        } else
+                assert(ci->first == first);
+
+        ci->array = array;
+        ci->begin = begin;
+        ci->total = total;
+        ci->last_index = last_index;
+}
+
 static int link_entry_into_array(JournalFile *f,
                                  le64_t *first,
                                  le64_t *idx,
                                  uint64_t p) {
         int r;
-        uint64_t n = 0, ap = 0, q, i, a, hidx;
+        uint64_t n = 0, ap = 0, q, i, a, hidx, t = 0, fa;
+        ChainCacheItem *ci = NULL;
         Object *o;
 
         assert(f);
@@ -1617,8 +1663,20 @@ static int link_entry_into_array(JournalFile *f,
         assert(idx);
         assert(p > 0);
 
-        a = le64toh(*first);
+        a = fa = le64toh(*first);
         i = hidx = le64toh(*idx);
+
+        /* We always append to the end of the chain, hence let's skip ahead to the array we found last time
+         * instead of walking the whole chain again. */
+        if (a > 0) {
+                ci = ordered_hashmap_get(f->chain_cache, &fa);
+                if (ci && i >= ci->total) {
+                        a = ci->array;
+                        i -= ci->total;
+                        t = ci->total;
+                }
+        }
+
         while (a > 0) {
 
                 r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
@@ -1629,10 +1687,13 @@ static int link_entry_into_array(JournalFile *f,
                 if (i < n) {
                         o->entry_array.items[i] = htole64(p);
                         *idx = htole64(hidx + 1);
+
+                        chain_cache_put(f->chain_cache, ci, fa, a, le64toh(o->entry_array.items[0]), t, i);
                         return 0;
                 }
 
                 i -= n;
+                t += n;
                 ap = a;
                 a = le64toh(o->entry_array.next_entry_array_offset);
         }
@@ -1662,6 +1723,8 @@ static int link_entry_into_array(JournalFile *f,
         if (ap == 0)
                 *first = htole64(q);
         else {
+                chain_cache_put(f->chain_cache, ci, fa, q, le64toh(o->entry_array.items[0]), t, i);
+
                 r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, ap, &o);
                 if (r < 0)
                         return r;
@@ -1959,7 +2022,8 @@ int journal_file_append_entry(
                 uint64_t p;
                 Object *o;
 
-                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len, &o, &p);
+                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len,
+                                             hash64(iovec[i].iov_base, iovec[i].iov_len), &o, &p);
                 if (r < 0)
                         return r;
 
@@ -1990,53 +2054,6 @@ int journal_file_append_entry(
         return r;
 }
 
-typedef struct ChainCacheItem {
-        uint64_t first; /* the array at the beginning of the chain */
-        uint64_t array; /* the cached array */
-        uint64_t begin; /* the first item in the cached array */
-        uint64_t total; /* the total number of items in all arrays before this one in the chain */
-        uint64_t last_index; /* the last index we looked at, to optimize locality when bisecting */
-} ChainCacheItem;
-
-static void chain_cache_put(
-                OrderedHashmap *h,
-                ChainCacheItem *ci,
-                uint64_t first,
-                uint64_t array,
-                uint64_t begin,
-                uint64_t total,
-                uint64_t last_index) {
-
-        if (!ci) {
-                /* If the chain item to cache for this chain is the
-                 * first one it's not worth caching anything */
-                if (array == first)
-                        return;
-
-                if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
-                        ci = ordered_hashmap_steal_first(h);
-                        assert(ci);
-                } else {
-                        ci = new(ChainCacheItem, 1);
-                        if (!ci)
-                                return;
-                }
-
-                ci->first = first;
-
-                if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
-                        free(ci);
-                        return;
-                }
-        } else
-                assert(ci->first == first);
-
-        ci->array = array;
-        ci->begin = begin;
-        ci->total = total;
-        ci->last_index = last_index;
-}
-
 static int generic_array_get(
                 JournalFile *f,
                 uint64_t first,
@@ -3619,7 +3636,29 @@ int journal_file_open_reliably(
                                  deferred_closes, template, ret);
 }
 
-int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p) {
+static JournalCopyCacheItem *journal_copy_cache_lookup(JournalCopyCache *c, JournalFile *from, JournalFile *to, uint64_t q) {
+        assert(from);
+        assert(to);
+
+        if (!c)
+                return NULL;
+
+        /* Data objects never move, hence the destination offsets stay valid as long as we copy into the
+         * same file. Compare by file ID rather than pointer, the object might have been freed and
+         * reallocated in between, for example because the destination was rotated. That's rare, hence
+         * simply start over then. */
+        if (!sd_id128_equal(c->to_id, to->header->file_id)) {
+                zero(c->items);
+                c->to_id = to->header->file_id;
+        }
+
+        /* When flushing, the entries of several source files are interleaved. Hence each item records
+         * which file it belongs to, and the file ID is mixed into the slot, so that the source files share
+         * the table instead of evicting each other at the same offsets. */
+        return c->items + ((q / sizeof(uint64_t)) ^ from->header->file_id.qwords[0]) % ELEMENTSOF(c->items);
+}
+
+int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, JournalCopyCache *cache) {
         uint64_t i, n;
         uint64_t q, xor_hash = 0;
         int r;
@@ -3644,6 +3683,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         items = newa(EntryItem, MAX(1u, n));
 
         for (i = 0; i < n; i++) {
+                JournalCopyCacheItem *ci;
                 uint64_t l, h;
                 le64_t le_hash;
                 size_t t;
@@ -3653,6 +3693,28 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 q = le64toh(o->entry.items[i].object_offset);
                 le_hash = o->entry.items[i].hash;
 
+                /* Most entries share the bulk of their data objects with the entries before them, if we
+                 * already copied this one we know where it ended up, and can skip the lookup. */
+                ci = journal_copy_cache_lookup(cache, from, to, q);
+                if (ci &&
+                    ci->from_offset == q &&
+                    ci->hash == le_hash &&
+                    sd_id128_equal(ci->from_id, from->header->file_id)) {
+
+                        /* Don't take the cache's word for it, check that the data object is actually
+                         * there. This maps it in the data object context of the destination, hence the
+                         * entry object 'o' points to stays mapped. */
+                        r = journal_file_move_to_object(to, OBJECT_DATA, ci->to_offset, &u);
+                        if (r >= 0 && u->data.hash == le_hash) {
+                                xor_hash ^= le64toh(le_hash);
+                                items[i].object_offset = htole64(ci->to_offset);
+                                items[i].hash = le_hash;
+                                continue;
+                        }
+
+                        /* Stale, do the full lookup and replace it below */
+                }
+
                 r = journal_file_move_to_object(from, OBJECT_DATA, q, &o);
                 if (r < 0)
                         return r;
@@ -3684,7 +3746,10 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 } else
                         data = o->data.payload;
 
-                r = journal_file_append_data(to, data, l, &u, &h);
+                /* Don't trust the hash stored in the source file, we are usually copying from /run, which
+                 * might be corrupted, and a bad hash would end up in the destination's hash table for
+                 * good. Compared to the copy itself, calculating it again is cheap. */
+                r = journal_file_append_data(to, data, l, hash64(data, l), &u, &h);
                 if (r < 0)
                         return r;
 
@@ -3692,6 +3757,14 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 items[i].object_offset = htole64(h);
                 items[i].hash = u->data.hash;
 
+                if (ci)
+                        *ci = (JournalCopyCacheItem) {
+                                .from_id = from->header->file_id,
+                                .from_offset = q,
+                                .to_offset = h,
+                                .hash = u->data.hash,
+                        };
+
                 r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
                 if (r < 0)
                         return r;
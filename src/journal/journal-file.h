@@ -232,7 +232,21 @@ int journal_file_move_to_entry_by_seqnum_for_data(JournalFile *f, uint64_t data_
 int journal_file_move_to_entry_by_realtime_for_data(JournalFile *f, uint64_t data_offset, uint64_t realtime, direction_t direction, Object **ret, uint64_t *offset);
 int journal_file_move_to_entry_by_monotonic_for_data(JournalFile *f, uint64_t data_offset, sd_id128_t boot_id, uint64_t monotonic, direction_t direction, Object **ret, uint64_t *offset);
 
-int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p);
+/* Remembers where data objects of one file have been copied to in another file, so that copying many entries
+ * between the same two files doesn't have to look up the same data objects over and over again. */
+typedef struct JournalCopyCacheItem {
+        sd_id128_t from_id;
+        uint64_t from_offset;
+        uint64_t to_offset;
+        le64_t hash;
+} JournalCopyCacheItem;
+
+typedef struct JournalCopyCache {
+        sd_id128_t to_id;
+        JournalCopyCacheItem items[4093];
+} JournalCopyCache;
+
+int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, JournalCopyCache *cache);
 
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
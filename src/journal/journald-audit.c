@@ -539,6 +539,8 @@ int server_open_audit(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to add audit fd to event loop: %m");
 
+        (void) sd_event_source_set_description(s->audit_event_source, "journal-audit");
+
         /* We are listening now, try to enable audit */
         r = enable_audit(s->audit_fd, true);
         if (r < 0)
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <time.h>
 
@@ -16,6 +18,19 @@
 #include "stdio-util.h"
 #include "terminal-util.h"
 
+/* Maximum number of bytes we queue up for a slow console before dropping lines */
+#define CONSOLE_BUFFER_MAX (64U*1024U)
+
+/* Once this much is queued we write it out right away, instead of waiting for the flush defer event
+ * source, which won't get dispatched for as long as higher-priority events keep coming in */
+#define CONSOLE_BUFFER_HIGH (16U*1024U)
+
+/* How long we are willing to block on the console when writing out what's left on exit */
+#define CONSOLE_FLUSH_TIMEOUT_USEC (5 * USEC_PER_SEC)
+
+/* Warn once every 30s if we missed console messages */
+#define WARN_FORWARD_CONSOLE_MISSED_USEC (30 * USEC_PER_SEC)
+
 static bool prefix_timestamp(void) {
 
         static int cached_printk_time = -1;
@@ -31,6 +46,141 @@ static bool prefix_timestamp(void) {
         return cached_printk_time;
 }
 
+static void console_reset(Server *s) {
+        assert(s);
+
+        s->console_io_event_source = sd_event_source_unref(s->console_io_event_source);
+        s->console_fd = safe_close(s->console_fd);
+}
+
+static int dispatch_console_io(sd_event_source *es, int fd, uint32_t revents, void *userdata);
+
+/* Writes out as much of the queue as the console takes without blocking. Returns -EAGAIN if something is
+ * left, 0 if the queue is empty (either because everything was written, or because it was dropped). */
+static int console_write(Server *s) {
+        const char *tty;
+        ssize_t n;
+        int r;
+
+        assert(s);
+
+        if (s->console_buffer_size == 0)
+                return 0;
+
+        if (s->console_fd < 0) {
+                tty = s->tty_path ?: "/dev/console";
+
+                /* Before you ask: yes, on purpose we open/close the console for each batch of log lines we
+                 * write. This is a good strategy to avoid journald getting killed by the kernel's SAK concept
+                 * (it doesn't fix this entirely, but minimizes the time window the kernel might end up
+                 * killing journald due to SAK). It also makes things easier for us so that we don't have to
+                 * recover from hangups and suchlike triggered on the console. */
+
+                r = open_terminal(tty, O_WRONLY|O_NOCTTY|O_CLOEXEC|O_NONBLOCK);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to open %s for logging: %m", tty);
+                        s->console_buffer_size = 0;
+                        console_reset(s);
+                        return 0;
+                }
+
+                s->console_fd = r;
+        }
+
+        while (s->console_buffer_size > 0) {
+                n = write(s->console_fd, s->console_buffer, s->console_buffer_size);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        if (errno == EAGAIN)
+                                return -EAGAIN;
+
+                        log_debug_errno(errno, "Failed to write to console for logging: %m");
+                        s->console_buffer_size = 0;
+                        break;
+                }
+
+                memmove(s->console_buffer, s->console_buffer + n, s->console_buffer_size - n);
+                s->console_buffer_size -= n;
+        }
+
+        console_reset(s);
+        return 0;
+}
+
+static int console_flush(Server *s) {
+        int r;
+
+        assert(s);
+
+        if (console_write(s) != -EAGAIN)
+                return 0;
+
+        /* The console is slow (serial line, most likely), let's wait until it can take more instead of
+         * blocking the whole daemon on it. */
+        if (s->console_io_event_source)
+                return 0;
+
+        r = sd_event_add_io(s->event, &s->console_io_event_source, s->console_fd, EPOLLOUT, dispatch_console_io, s);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to watch console for writability: %m");
+                s->console_buffer_size = 0;
+                console_reset(s);
+                return 0;
+        }
+
+        (void) sd_event_source_set_description(s->console_io_event_source, "console-io");
+        return 0;
+}
+
+static int dispatch_console_io(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+        assert(fd == s->console_fd);
+
+        return console_flush(s);
+}
+
+static int dispatch_console_flush(sd_event_source *es, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        /* If a write is already pending the I/O event source will pick up the new data */
+        if (s->console_io_event_source)
+                return 0;
+
+        return console_flush(s);
+}
+
+static int console_schedule_flush(Server *s) {
+        int r;
+
+        assert(s);
+
+        if (s->console_flush_event_source)
+                return sd_event_source_set_enabled(s->console_flush_event_source, SD_EVENT_ONESHOT);
+
+        r = sd_event_add_defer(s->event, &s->console_flush_event_source, dispatch_console_flush, s);
+        if (r < 0)
+                return r;
+
+        r = sd_event_source_set_enabled(s->console_flush_event_source, SD_EVENT_ONESHOT);
+        if (r < 0)
+                return r;
+
+        /* Write out after everything else that is currently pending has been processed, so that lines
+         * arriving in a burst are written with a single syscall. */
+        r = sd_event_source_set_priority(s->console_flush_event_source, SD_EVENT_PRIORITY_NORMAL+10);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(s->console_flush_event_source, "console-flush");
+        return 0;
+}
+
 void server_forward_console(
                 Server *s,
                 int priority,
@@ -43,9 +193,9 @@ void server_forward_console(
         char tbuf[STRLEN("[] ") + DECIMAL_STR_MAX(ts.tv_sec) + DECIMAL_STR_MAX(ts.tv_nsec)-3 + 1];
         char header_pid[STRLEN("[]: ") + DECIMAL_STR_MAX(pid_t)];
         _cleanup_free_ char *ident_buf = NULL;
-        _cleanup_close_ int fd = -1;
-        const char *tty;
-        int n = 0;
+        size_t l;
+        char *p;
+        int n = 0, i, r;
 
         assert(s);
         assert(message);
@@ -85,19 +235,92 @@ void server_forward_console(
         iovec[n++] = IOVEC_MAKE_STRING(message);
         iovec[n++] = IOVEC_MAKE_STRING("\n");
 
-        tty = s->tty_path ?: "/dev/console";
+        /* Queue the line, and write it out from the event loop. If the console can't keep up we drop lines
+         * rather than stalling everything else. */
+        l = IOVEC_TOTAL_SIZE(iovec, n);
+        if (s->console_buffer_size + l > CONSOLE_BUFFER_MAX) {
+                s->n_forward_console_missed++;
+                return;
+        }
+
+        if (!GREEDY_REALLOC(s->console_buffer, s->console_buffer_allocated, s->console_buffer_size + l)) {
+                s->n_forward_console_missed++;
+                return;
+        }
 
-        /* Before you ask: yes, on purpose we open/close the console for each log line we write individually. This is a
-         * good strategy to avoid journald getting killed by the kernel's SAK concept (it doesn't fix this entirely,
-         * but minimizes the time window the kernel might end up killing journald due to SAK). It also makes things
-         * easier for us so that we don't have to recover from hangups and suchlike triggered on the console. */
+        p = s->console_buffer + s->console_buffer_size;
+        for (i = 0; i < n; i++)
+                p = mempcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+        s->console_buffer_size += l;
 
-        fd = open_terminal(tty, O_WRONLY|O_NOCTTY|O_CLOEXEC);
-        if (fd < 0) {
-                log_debug_errno(fd, "Failed to open %s for logging: %m", tty);
+        /* If a write is already pending the I/O event source will pick up the new data */
+        if (s->console_io_event_source)
+                return;
+
+        if (s->console_buffer_size >= CONSOLE_BUFFER_HIGH) {
+                (void) console_flush(s);
                 return;
         }
 
-        if (writev(fd, iovec, n) < 0)
-                log_debug_errno(errno, "Failed to write to %s for logging: %m", tty);
+        r = console_schedule_flush(s);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to schedule console flush, writing synchronously: %m");
+                (void) console_flush(s);
+        }
+}
+
+void server_flush_console(Server *s) {
+        usec_t end, n;
+        int r;
+
+        assert(s);
+
+        if (s->console_buffer_size == 0)
+                return;
+
+        /* We are going away, hence write out synchronously whatever is still queued, but don't hang
+         * indefinitely on a console that doesn't drain. */
+        end = usec_add(now(CLOCK_MONOTONIC), CONSOLE_FLUSH_TIMEOUT_USEC);
+
+        while (console_write(s) == -EAGAIN) {
+                n = now(CLOCK_MONOTONIC);
+                if (n >= end) {
+                        log_debug("Timed out writing to console, dropping %zu bytes.", s->console_buffer_size);
+                        break;
+                }
+
+                r = fd_wait_for_event(s->console_fd, POLLOUT, end - n);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to wait for console, dropping %zu bytes: %m", s->console_buffer_size);
+                        break;
+                }
+                if (r == 0) {
+                        log_debug("Timed out writing to console, dropping %zu bytes.", s->console_buffer_size);
+                        break;
+                }
+        }
+
+        s->console_buffer_size = 0;
+        console_reset(s);
+}
+
+void server_maybe_warn_forward_console_missed(Server *s) {
+        usec_t n;
+
+        assert(s);
+
+        if (s->n_forward_console_missed <= 0)
+                return;
+
+        n = now(CLOCK_MONOTONIC);
+        if (s->last_warn_forward_console_missed + WARN_FORWARD_CONSOLE_MISSED_USEC > n)
+                return;
+
+        server_driver_message(s, 0, NULL,
+                              LOG_MESSAGE("Forwarding to console missed %u messages.",
+                                          s->n_forward_console_missed),
+                              NULL);
+
+        s->n_forward_console_missed = 0;
+        s->last_warn_forward_console_missed = n;
 }
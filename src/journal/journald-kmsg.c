@@ -398,6 +398,8 @@ int server_open_dev_kmsg(Server *s) {
                 goto fail;
         }
 
+        (void) sd_event_source_set_description(s->dev_kmsg_event_source, "journal-dev-kmsg");
+
         r = sd_event_source_set_priority(s->dev_kmsg_event_source, SD_EVENT_PRIORITY_IMPORTANT+10);
         if (r < 0) {
                 log_error_errno(r, "Failed to adjust priority of kmsg event source: %m");
@@ -499,5 +499,7 @@ int server_open_native_socket(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to adjust native event source priority: %m");
 
+        (void) sd_event_source_set_description(s->native_event_source, "journal-native");
+
         return 0;
 }
@@ -33,6 +33,7 @@
 #include "journal-internal.h"
 #include "journal-vacuum.h"
 #include "journald-audit.h"
+#include "journald-console.h"
 #include "journald-context.h"
 #include "journald-kmsg.h"
 #include "journald-native.h"
@@ -1115,6 +1116,7 @@ void server_dispatch_message(
 }
 
 int server_flush_to_var(Server *s, bool require_flag_file) {
+        _cleanup_free_ JournalCopyCache *cache = NULL;
         sd_id128_t machine;
         sd_journal *j = NULL;
         char ts[FORMAT_TIMESPAN_MAX];
@@ -1152,6 +1154,9 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
 
         sd_journal_set_data_threshold(j, 0);
 
+        /* Not fatal, we just copy without it */
+        cache = new0(JournalCopyCache, 1);
+
         SD_JOURNAL_FOREACH(j) {
                 Object *o = NULL;
                 JournalFile *f;
@@ -1167,7 +1172,7 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
                         goto finish;
                 }
 
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset);
+                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, cache);
                 if (r >= 0)
                         continue;
 
@@ -1186,7 +1191,7 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
                 }
 
                 log_debug("Retrying write.");
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset);
+                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, cache);
                 if (r < 0) {
                         log_error_errno(r, "Can't write entry: %m");
                         goto finish;
@@ -1448,12 +1453,34 @@ static int dispatch_sigrtmin1(sd_event_source *es, const struct signalfd_siginfo
         return 0;
 }
 
+static int dispatch_sigrtmin2(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
+        _cleanup_free_ char *statistics = NULL;
+        Server *s = userdata;
+        int r;
+
+        assert(s);
+
+        log_debug("Received SIGRTMIN2 signal from PID " PID_FMT ", as request to dump event loop statistics.", si->ssi_pid);
+
+        r = sd_event_get_statistics(s->event, &statistics);
+        if (r < 0) {
+                log_warning_errno(r, "Failed to acquire event loop statistics, ignoring: %m");
+                return 0;
+        }
+
+        server_driver_message(s, 0, NULL,
+                              LOG_MESSAGE("Event loop statistics:\n%s", statistics),
+                              NULL);
+
+        return 0;
+}
+
 static int setup_signals(Server *s) {
         int r;
 
         assert(s);
 
-        assert_se(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, SIGRTMIN+1, -1) >= 0);
+        assert_se(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, SIGRTMIN+1, SIGRTMIN+2, -1) >= 0);
 
         r = sd_event_add_signal(s->event, &s->sigusr1_event_source, SIGUSR1, dispatch_sigusr1, s);
         if (r < 0)
@@ -1493,6 +1520,11 @@ static int setup_signals(Server *s) {
         if (r < 0)
                 return r;
 
+        /* SIGRTMIN+2 writes out which event sources we spent our time on */
+        r = sd_event_add_signal(s->event, &s->sigrtmin2_event_source, SIGRTMIN+2, dispatch_sigrtmin2, s);
+        if (r < 0)
+                return r;
+
         return 0;
 }
 
@@ -1648,6 +1680,8 @@ int server_schedule_sync(Server *s, int priority) {
                         if (r < 0)
                                 return r;
 
+                        (void) sd_event_source_set_description(s->sync_event_source, "journal-sync");
+
                         r = sd_event_source_set_priority(s->sync_event_source, SD_EVENT_PRIORITY_IMPORTANT);
                 } else {
                         r = sd_event_source_set_time(s->sync_event_source, when);
@@ -1697,6 +1731,8 @@ static int server_open_hostname(Server *s) {
                 return log_error_errno(r, "Failed to register hostname fd in event loop: %m");
         }
 
+        (void) sd_event_source_set_description(s->hostname_event_source, "journal-hostname");
+
         r = sd_event_source_set_priority(s->hostname_event_source, SD_EVENT_PRIORITY_IMPORTANT-10);
         if (r < 0)
                 return log_error_errno(r, "Failed to adjust priority of host name event source: %m");
@@ -1836,12 +1872,16 @@ static int server_connect_notify(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to watch notification socket: %m");
 
+        (void) sd_event_source_set_description(s->notify_event_source, "journal-notify");
+
         if (sd_watchdog_enabled(false, &s->watchdog_usec) > 0) {
                 s->send_watchdog = true;
 
                 r = sd_event_add_time(s->event, &s->watchdog_event_source, CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + s->watchdog_usec/2, s->watchdog_usec/4, dispatch_watchdog, s);
                 if (r < 0)
                         return log_error_errno(r, "Failed to add watchdog time event: %m");
+
+                (void) sd_event_source_set_description(s->watchdog_event_source, "journal-watchdog");
         }
 
         /* This should fire pretty soon, which we'll use to send the READY=1 event. */
@@ -2009,6 +2049,7 @@ int server_init(Server *s) {
                 .audit_fd = -1,
                 .hostname_fd = -1,
                 .notify_fd = -1,
+                .console_fd = -1,
 
                 .compress.enabled = true,
                 .compress.threshold_bytes = (uint64_t) -1,
@@ -2072,6 +2113,11 @@ int server_init(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to create event loop: %m");
 
+        /* Keep per event source accounting, so that SIGRTMIN+2 can tell which of our sources keeps us busy */
+        r = sd_event_set_statistics(s->event, true);
+        if (r < 0)
+                return log_error_errno(r, "Failed to enable event loop statistics: %m");
+
         n = sd_listen_fds(true);
         if (n < 0)
                 return log_error_errno(n, "Failed to read listening file descriptors from environment: %m");
@@ -2230,6 +2276,8 @@ void server_done(Server *s) {
 
         client_context_flush_all(s);
 
+        server_flush_console(s);
+
         (void) journal_file_close(s->system_journal);
         (void) journal_file_close(s->runtime_journal);
 
@@ -2248,9 +2296,12 @@ void server_done(Server *s) {
         sd_event_source_unref(s->sigterm_event_source);
         sd_event_source_unref(s->sigint_event_source);
         sd_event_source_unref(s->sigrtmin1_event_source);
+        sd_event_source_unref(s->sigrtmin2_event_source);
         sd_event_source_unref(s->hostname_event_source);
         sd_event_source_unref(s->notify_event_source);
         sd_event_source_unref(s->watchdog_event_source);
+        sd_event_source_unref(s->console_flush_event_source);
+        sd_event_source_unref(s->console_io_event_source);
         sd_event_unref(s->event);
 
         safe_close(s->syslog_fd);
@@ -2260,6 +2311,7 @@ void server_done(Server *s) {
         safe_close(s->audit_fd);
         safe_close(s->hostname_fd);
         safe_close(s->notify_fd);
+        safe_close(s->console_fd);
 
         if (s->rate_limit)
                 journal_rate_limit_free(s->rate_limit);
@@ -2268,6 +2320,7 @@ void server_done(Server *s) {
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
         free(s->buffer);
+        free(s->console_buffer);
         free(s->tty_path);
         free(s->cgroup_root);
         free(s->hostname_field);
@@ -81,6 +81,7 @@ struct Server {
         sd_event_source *sigterm_event_source;
         sd_event_source *sigint_event_source;
         sd_event_source *sigrtmin1_event_source;
+        sd_event_source *sigrtmin2_event_source;
         sd_event_source *hostname_event_source;
         sd_event_source *notify_event_source;
         sd_event_source *watchdog_event_source;
@@ -114,6 +115,15 @@ struct Server {
         unsigned n_forward_syslog_missed;
         usec_t last_warn_forward_syslog_missed;
 
+        /* Lines queued for the console, written out asynchronously */
+        int console_fd;
+        char *console_buffer;
+        size_t console_buffer_size, console_buffer_allocated;
+        sd_event_source *console_flush_event_source;
+        sd_event_source *console_io_event_source;
+        unsigned n_forward_console_missed;
+        usec_t last_warn_forward_console_missed;
+
         uint64_t var_available_timestamp;
 
         usec_t max_retention_usec;
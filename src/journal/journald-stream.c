@@ -38,6 +38,13 @@
 
 #define STDOUT_STREAMS_MAX 4096
 
+/* How often a single stream connection is served at most, so that one client flooding us through its stream
+ * cannot keep us from processing anything else, signals included. Each dispatch processes one read. The datagram
+ * sockets are shared by all clients, and limiting them would throttle everybody along with the flooding peer,
+ * hence they are not limited. */
+#define STDOUT_STREAM_RATELIMIT_INTERVAL_USEC (1*USEC_PER_SEC)
+#define STDOUT_STREAM_RATELIMIT_BURST 20000U
+
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
         STDOUT_STREAM_UNIT_ID,
@@ -578,6 +585,12 @@ int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
         if (r < 0)
                 return log_error_errno(r, "Failed to adjust stdout event source priority: %m");
 
+        (void) sd_event_source_set_description(stream->event_source, "journal-stdout-stream");
+
+        r = sd_event_source_set_ratelimit(stream->event_source, STDOUT_STREAM_RATELIMIT_INTERVAL_USEC, STDOUT_STREAM_RATELIMIT_BURST);
+        if (r < 0)
+                return log_error_errno(r, "Failed to set rate limit of stdout stream event source: %m");
+
         stream->fd = fd;
 
         stream->server = s;
@@ -826,6 +839,8 @@ int server_open_stdout_socket(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to adjust priority of stdout server event source: %m");
 
+        (void) sd_event_source_set_description(s->stdout_event_source, "journal-stdout");
+
         return 0;
 }
 
@@ -490,6 +490,8 @@ int server_open_syslog_socket(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to adjust syslog event source priority: %m");
 
+        (void) sd_event_source_set_description(s->syslog_event_source, "journal-syslog");
+
         return 0;
 }
 
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <locale.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "sd-messages.h"
@@ -171,6 +172,63 @@ static void test_catalog_update(const char *database) {
         assert_se(r == 0);
 }
 
+static void test_catalog_get_cached(const char *database, const char *expected) {
+        _cleanup_free_ char *a = NULL, *b = NULL, *c = NULL;
+
+        /* The second lookup is served from the cached mapping */
+        assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &a) >= 0);
+        assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &b) >= 0);
+        assert_se(streq(a, expected));
+        assert_se(streq(b, expected));
+
+        /* catalog_update() replaces the database file, which must invalidate the cached mapping */
+        assert_se(catalog_update(database, NULL, (const char * const *) catalog_dirs) == 0);
+        assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &c) >= 0);
+        assert_se(streq(c, expected));
+
+        catalog_cache_flush();
+}
+
+typedef struct CatalogLookup {
+        const char *database;
+        const char *expected;
+} CatalogLookup;
+
+static void *catalog_get_thread(void *userdata) {
+        const CatalogLookup *l = userdata;
+        unsigned i;
+
+        for (i = 0; i < 100; i++) {
+                _cleanup_free_ char *text = NULL;
+
+                assert_se(catalog_get(l->database, SD_MESSAGE_COREDUMP, &text) >= 0);
+                assert_se(streq(text, l->expected));
+        }
+
+        return NULL;
+}
+
+static void test_catalog_get_threads(const char *database, const char *expected) {
+        CatalogLookup l = {
+                .database = database,
+                .expected = expected,
+        };
+        pthread_t t[4];
+        unsigned i;
+
+        /* All threads share the one cached mapping */
+        for (i = 0; i < ELEMENTSOF(t); i++)
+                assert_se(pthread_create(t + i, NULL, catalog_get_thread, &l) == 0);
+
+        /* Replace the database underneath them, so that the mapping is swapped out while they use it */
+        assert_se(catalog_update(database, NULL, (const char * const *) catalog_dirs) == 0);
+
+        for (i = 0; i < ELEMENTSOF(t); i++)
+                assert_se(pthread_join(t[i], NULL) == 0);
+
+        catalog_cache_flush();
+}
+
 static void test_catalog_file_lang(void) {
         _cleanup_free_ char *lang = NULL, *lang2 = NULL, *lang3 = NULL, *lang4 = NULL;
 
@@ -236,5 +294,8 @@ int main(int argc, char *argv[]) {
         assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &text) >= 0);
         printf(">>>%s<<<\n", text);
 
+        test_catalog_get_cached(database, text);
+        test_catalog_get_threads(database, text);
+
         return 0;
 }
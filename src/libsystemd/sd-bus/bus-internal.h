@@ -9,6 +9,7 @@
 #include "bus-error.h"
 #include "bus-kernel.h"
 #include "bus-match.h"
+#include "bus-statistics.h"
 #include "def.h"
 #include "hashmap.h"
 #include "list.h"
@@ -103,6 +104,10 @@ struct node_vtable {
         const sd_bus_vtable *vtable;
         sd_bus_object_find_t find;
 
+        /* The introspection data of the vtable, generated on first use */
+        char *introspection;
+        bool introspection_trusted:1;
+
         LIST_FIELDS(struct node_vtable, vtables);
 };
 
@@ -115,6 +120,25 @@ struct vtable_member {
         const sd_bus_vtable *vtable;
 };
 
+/* A method call whose handler runs on a thread of the event loop's work pool, see
+ * SD_BUS_VTABLE_METHOD_PARALLEL. Everything in here is owned by the bus thread, except while the handler
+ * runs, when it belongs to the worker thread. */
+struct bus_parallel_call {
+        sd_bus_message *message;
+        sd_bus_slot *slot;
+        sd_bus_message_handler_t handler;
+        void *userdata;
+
+        sd_bus_error error;
+
+        /* The messages the handler sent, in order. They are sealed and sent from the bus thread once the
+         * handler returned, so that cookies are only ever assigned there. */
+        sd_bus_message **messages;
+        size_t n_messages, n_allocated;
+
+        sd_event_source *event_source;
+};
+
 typedef enum BusSlotType {
         BUS_REPLY_CALLBACK,
         BUS_FILTER_CALLBACK,
@@ -181,6 +205,14 @@ enum bus_auth {
         BUS_AUTH_ANONYMOUS
 };
 
+/* How many message objects and buffers each connection keeps around for reuse, and how large the latter are.
+ * Larger buffers are returned to malloc() right away. */
+#define BUS_MESSAGE_POOL_MAX 32U
+#define BUS_MESSAGE_POOL_BUFFER_SIZE 1024U
+
+/* How many bytes of const property values and digests of emitted ones we cache per connection at most */
+#define BUS_PROPERTY_CACHE_SIZE_MAX (4U*1024U*1024U)
+
 struct sd_bus {
         unsigned n_ref;
 
@@ -197,17 +229,12 @@ struct sd_bus {
         bool anonymous_auth:1;
         bool prefer_readv:1;
         bool prefer_writev:1;
-        bool match_callbacks_modified:1;
-        bool filter_callbacks_modified:1;
-        bool nodes_modified:1;
         bool trusted:1;
         bool manual_peer_interface:1;
         bool is_system:1;
         bool is_user:1;
         bool allow_interactive_authorization:1;
         bool exit_on_disconnect:1;
-        bool exited:1;
-        bool exit_triggered:1;
         bool is_local:1;
         bool watch_bind:1;
         bool is_monitor:1;
@@ -218,6 +245,14 @@ struct sd_bus {
 
         signed int use_memfd:2;
 
+        /* These are flipped while processing messages, hence they are kept out of the bit field above, which
+         * method handlers running on worker threads read from when creating messages */
+        bool match_callbacks_modified;
+        bool filter_callbacks_modified;
+        bool nodes_modified;
+        bool exited;
+        bool exit_triggered;
+
         void *rbuffer;
         size_t rbuffer_size;
 
@@ -245,6 +280,13 @@ struct sd_bus {
         Hashmap *vtable_methods;
         Hashmap *vtable_properties;
 
+        /* Serialized values of const properties and digests of the values last sent in PropertiesChanged
+         * signals, by object path, least recently used first */
+        OrderedHashmap *property_cache;
+        size_t property_cache_size;
+        uint8_t property_digest_key[16];
+        bool property_digest_key_set:1;
+
         union sockaddr_union sockaddr;
         socklen_t sockaddr_size;
 
@@ -274,6 +316,9 @@ struct sd_bus {
 
         int *fds;
         size_t n_fds;
+        /* For each of the fds above, where in rbuffer the read that brought it in ended. The message it
+         * belongs to starts before that. */
+        size_t *fds_rbuffer_end;
 
         char *exec_path;
         char **exec_argv;
@@ -288,6 +333,16 @@ struct sd_bus {
         struct memfd_cache memfd_cache[MEMFD_CACHE_MAX];
         unsigned n_memfd_cache;
 
+        /* Freed message objects and small buffers, which we recycle for new messages rather than going
+         * back to malloc() each time. Locked for the same reason as the memfd cache. */
+        pthread_mutex_t message_pool_mutex;
+        void *message_pool[BUS_MESSAGE_POOL_MAX];
+        unsigned n_message_pool;
+        void *buffer_pool[BUS_MESSAGE_POOL_MAX];
+        unsigned n_buffer_pool;
+        size_t message_pool_bytes;
+        uint64_t n_message_pool_hits, n_message_pool_misses;
+
         pid_t original_pid;
         pid_t busexec_pid;
 
@@ -323,6 +378,9 @@ struct sd_bus {
 
         /* zero means use value specified by $SYSTEMD_BUS_TIMEOUT= environment variable or built-in default */
         usec_t method_call_timeout;
+
+        /* Only allocated while statistics are enabled, see sd_bus_set_statistics() */
+        BusStatistics *statistics;
 };
 
 /* For method calls we timeout at 25s, like in the D-Bus reference implementation */
@@ -172,6 +172,35 @@ int introspect_write_interface(struct introspect *i, const sd_bus_vtable *v) {
         return 0;
 }
 
+int introspect_interface_to_string(const sd_bus_vtable *v, bool trusted, char **ret) {
+        _cleanup_(introspect_free) struct introspect intro = {
+                .trusted = trusted,
+        };
+        int r;
+
+        assert(v);
+        assert(ret);
+
+        /* Like introspect_write_interface(), but returns the result as a string of its own, for caching */
+
+        intro.f = open_memstream_unlocked(&intro.introspection, &intro.size);
+        if (!intro.f)
+                return -ENOMEM;
+
+        r = introspect_write_interface(&intro, v);
+        if (r < 0)
+                return r;
+
+        r = fflush_and_check(intro.f);
+        if (r < 0)
+                return r;
+
+        intro.f = safe_fclose(intro.f);
+        *ret = TAKE_PTR(intro.introspection);
+
+        return 0;
+}
+
 int introspect_finish(struct introspect *i, char **ret) {
         int r;
 
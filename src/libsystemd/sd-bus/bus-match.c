@@ -53,9 +53,17 @@ static bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
 }
 
 static bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
-        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
-                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST) ||
-                (t >= BUS_MATCH_ARG_HAS && t <= BUS_MATCH_ARG_HAS_LAST);
+        /* Everything but the sender, where well-known names match any unique name (see value_node_test()),
+         * hence a lookup by value wouldn't help much */
+        return t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_ARG_HAS_LAST;
+}
+
+static bool BUS_MATCH_IS_PREFIX(enum bus_match_node_type t) {
+        /* The values of these are prefixes of what they match, we look them up by all prefixes of the tested
+         * string, see bus_match_run_prefixes() */
+        return t == BUS_MATCH_PATH_NAMESPACE ||
+                (t >= BUS_MATCH_ARG_PATH && t <= BUS_MATCH_ARG_PATH_LAST) ||
+                (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST);
 }
 
 static void bus_match_node_free(struct bus_match_node *node) {
@@ -239,6 +247,106 @@ static bool value_node_same(
         }
 }
 
+static int bus_match_run_found(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *key,
+                sd_bus_message *m) {
+
+        struct bus_match_node *found;
+
+        found = hashmap_get(node->compare.children, key);
+        if (!found)
+                return 0;
+
+        return bus_match_run(bus, found, m);
+}
+
+static int bus_match_run_prefixes(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value,
+                sd_bus_message *m) {
+
+        _cleanup_free_ char *p = NULL;
+        bool simple;
+        char separator;
+        size_t i;
+        int r;
+
+        assert(node);
+        assert(BUS_MATCH_IS_PREFIX(node->type));
+        assert(value);
+
+        /* Rather than testing the value against every pattern, let's look up all patterns that could possibly
+         * match it: the value itself, and each of its prefixes that end right after a separator. For the
+         * simple patterns also each of its prefixes that end right before one. That's one lookup per label
+         * in the value, regardless of how many patterns there are. */
+
+        separator = node->type >= BUS_MATCH_ARG_NAMESPACE ? '.' : '/';
+        simple = node->type < BUS_MATCH_ARG_PATH || node->type >= BUS_MATCH_ARG_NAMESPACE;
+
+        p = strdup(value);
+        if (!p)
+                return -ENOMEM;
+
+        for (i = 0; p[i]; i++) {
+                char c;
+
+                if (p[i] != separator)
+                        continue;
+
+                if (simple) {
+                        p[i] = 0;
+                        r = bus_match_run_found(bus, node, p, m);
+                        p[i] = separator;
+                        if (r != 0)
+                                return r;
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+
+                /* The whole value is looked up below */
+                if (p[i+1] == 0)
+                        break;
+
+                c = p[i+1];
+                p[i+1] = 0;
+                r = bus_match_run_found(bus, node, p, m);
+                p[i+1] = c;
+                if (r != 0)
+                        return r;
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+        }
+
+        r = bus_match_run_found(bus, node, value, m);
+        if (r != 0)
+                return r;
+        if (bus && bus->match_callbacks_modified)
+                return 0;
+
+        /* argNpath also matches the other way round, i.e. if the value ends in a separator and is a prefix
+         * of the pattern. That's rare enough to not bother with anything better than iterating. */
+        if (!simple && endswith(value, "/")) {
+                struct bus_match_node *c;
+                Iterator j;
+
+                HASHMAP_FOREACH(c, node->compare.children, j) {
+                        if (streq(c->value.str, value) || !startswith(c->value.str, value))
+                                continue;
+
+                        r = bus_match_run(bus, c, m);
+                        if (r != 0)
+                                return r;
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+        }
+
+        return 0;
+}
+
 int bus_match_run(
                 sd_bus *bus,
                 struct bus_match_node *node,
@@ -384,7 +492,15 @@ int bus_match_run(
 
                 /* Lookup via hash table, nice! So let's jump directly. */
 
-                if (test_str)
+                if (BUS_MATCH_IS_PREFIX(node->type)) {
+                        if (test_str) {
+                                r = bus_match_run_prefixes(bus, node, test_str, m);
+                                if (r != 0)
+                                        return r;
+                        }
+
+                        found = NULL;
+                } else if (test_str)
                         found = hashmap_get(node->compare.children, test_str);
                 else if (test_strv) {
                         char **i;
@@ -24,6 +24,117 @@
 
 static int message_append_basic(sd_bus_message *m, char type, const void *p, const void **stored);
 
+/* Message objects with the header embedded, as allocated by sd_bus_message_new() */
+#define MESSAGE_ALLOCATION_SIZE (ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header))
+
+static void* message_pool_take(sd_bus *bus, void **pool, unsigned *n, size_t size) {
+        void *p = NULL;
+
+        assert(bus);
+        assert(pool);
+        assert(n);
+
+        assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+
+        if (*n > 0) {
+                p = pool[--*n];
+                bus->message_pool_bytes -= size;
+                bus->n_message_pool_hits++;
+        } else
+                bus->n_message_pool_misses++;
+
+        assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
+
+        return p;
+}
+
+static bool message_pool_put(sd_bus *bus, void **pool, unsigned *n, size_t size, void *p) {
+        bool b = false;
+
+        assert(bus);
+        assert(pool);
+        assert(n);
+        assert(p);
+
+        assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+
+        if (*n < BUS_MESSAGE_POOL_MAX) {
+                pool[(*n)++] = p;
+                bus->message_pool_bytes += size;
+                b = true;
+        }
+
+        assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
+
+        return b;
+}
+
+static sd_bus_message* message_alloc0(sd_bus *bus) {
+        sd_bus_message *m = NULL;
+
+        if (bus)
+                m = message_pool_take(bus, bus->message_pool, &bus->n_message_pool, MESSAGE_ALLOCATION_SIZE);
+        if (m)
+                memzero(m, MESSAGE_ALLOCATION_SIZE);
+        else {
+                m = malloc0(MESSAGE_ALLOCATION_SIZE);
+                if (!m)
+                        return NULL;
+        }
+
+        m->recyclable = true;
+        return m;
+}
+
+void* bus_message_buffer_alloc(sd_bus *bus, size_t size, size_t *ret_allocated) {
+        void *p = NULL;
+
+        assert(ret_allocated);
+
+        /* Small buffers are always allocated at the same size, so that they can be recycled for any other
+         * small buffer later on */
+        if (size <= BUS_MESSAGE_POOL_BUFFER_SIZE) {
+                if (bus)
+                        p = message_pool_take(bus, bus->buffer_pool, &bus->n_buffer_pool, BUS_MESSAGE_POOL_BUFFER_SIZE);
+                if (!p)
+                        p = malloc(BUS_MESSAGE_POOL_BUFFER_SIZE);
+                size = BUS_MESSAGE_POOL_BUFFER_SIZE;
+        } else
+                p = malloc(size);
+        if (!p)
+                return NULL;
+
+        *ret_allocated = size;
+        return p;
+}
+
+void bus_message_buffer_free(sd_bus *bus, void *p, size_t allocated) {
+        if (!p)
+                return;
+
+        if (bus &&
+            allocated == BUS_MESSAGE_POOL_BUFFER_SIZE &&
+            message_pool_put(bus, bus->buffer_pool, &bus->n_buffer_pool, BUS_MESSAGE_POOL_BUFFER_SIZE, p))
+                return;
+
+        free(p);
+}
+
+void bus_message_pool_flush(sd_bus *bus) {
+        assert(bus);
+
+        assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+
+        while (bus->n_message_pool > 0)
+                free(bus->message_pool[--bus->n_message_pool]);
+        while (bus->n_buffer_pool > 0)
+                free(bus->buffer_pool[--bus->n_buffer_pool]);
+
+        bus->message_pool_bytes = 0;
+
+        assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
+}
+
 static void *adjust_pointer(const void *p, void *old_base, size_t sz, void *new_base) {
 
         if (!p)
@@ -50,7 +161,7 @@ static void message_free_part(sd_bus_message *m, struct bus_body_part *part) {
         else if (part->munmap_this)
                 munmap(part->mmap_begin, part->mapped);
         else if (part->free_this)
-                free(part->data);
+                bus_message_buffer_free(m->bus, part->data, part->allocated);
 
         if (part != &m->body)
                 free(part);
@@ -113,14 +224,16 @@ static void message_reset_containers(sd_bus_message *m) {
 static sd_bus_message* message_free(sd_bus_message *m) {
         assert(m);
 
+        /* Note that we don't unref m->bus here. That's already done by sd_bus_message_unref() as each user
+         * reference to the bus message also is considered a reference to the bus connection itself. If
+         * m->bus is still set, the caller makes sure it stays alive until we are done, and we may hand our
+         * memory back to it for reuse. */
+
         if (m->free_header)
-                free(m->header);
+                bus_message_buffer_free(m->bus, m->header, m->header_allocated);
 
         message_reset_parts(m);
 
-        /* Note that we don't unref m->bus here. That's already done by sd_bus_message_unref() as each user
-         * reference to the bus message also is considered a reference to the bus connection itself. */
-
         if (m->free_fds) {
                 close_many(m->fds, m->n_fds);
                 free(m->fds);
@@ -134,6 +247,11 @@ static sd_bus_message* message_free(sd_bus_message *m) {
         message_free_last_container(m);
 
         bus_creds_done(&m->creds);
+
+        if (m->recyclable && m->bus &&
+            message_pool_put(m->bus, m->bus->message_pool, &m->bus->n_message_pool, MESSAGE_ALLOCATION_SIZE, m))
+                return NULL;
+
         return mfree(m);
 }
 
@@ -158,15 +276,21 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
                 return (uint8_t*) m->header + old_size;
 
         if (m->free_header) {
-                np = realloc(m->header, ALIGN8(new_size));
-                if (!np)
-                        goto poison;
+                if (ALIGN8(new_size) <= m->header_allocated)
+                        np = m->header;
+                else {
+                        np = realloc(m->header, ALIGN8(new_size));
+                        if (!np)
+                                goto poison;
+
+                        m->header_allocated = ALIGN8(new_size);
+                }
         } else {
                 /* Initially, the header is allocated as part of
                  * the sd_bus_message itself, let's replace it by
                  * dynamic data */
 
-                np = malloc(ALIGN8(new_size));
+                np = bus_message_buffer_alloc(m->bus, ALIGN8(new_size), &m->header_allocated);
                 if (!np)
                         goto poison;
 
@@ -454,7 +578,12 @@ int bus_message_from_header(
                 a += label_sz + 1;
         }
 
-        m = malloc0(a);
+        /* Without anything tacked on, the message object is no different from the ones we create ourselves,
+         * hence may be recycled just like those */
+        if (a <= MESSAGE_ALLOCATION_SIZE)
+                m = message_alloc0(bus);
+        else
+                m = malloc0(a);
         if (!m)
                 return -ENOMEM;
 
@@ -519,6 +648,27 @@ int bus_message_from_header(
         return 0;
 }
 
+static int message_take_fds(sd_bus_message *m) {
+        int *fds;
+
+        assert(m);
+
+        /* The fds array passed in is the caller's, and might have more entries than the message declared,
+         * see bus_message_parse_fields(). Take possession of the first m->n_fds fds, but not of the array. */
+
+        if (m->n_fds > 0) {
+                fds = newdup(int, m->fds, m->n_fds);
+                if (!fds)
+                        return -ENOMEM;
+        } else
+                fds = NULL;
+
+        m->fds = fds;
+        m->free_fds = true;
+
+        return 0;
+}
+
 int bus_message_from_malloc(
                 sd_bus *bus,
                 void *buffer,
@@ -560,9 +710,12 @@ int bus_message_from_malloc(
         if (r < 0)
                 return r;
 
+        r = message_take_fds(m);
+        if (r < 0)
+                return r;
+
         /* We take possession of the memory and fds now */
         m->free_header = true;
-        m->free_fds = true;
 
         *ret = TAKE_PTR(m);
         return 0;
@@ -580,7 +733,7 @@ _public_ int sd_bus_message_new(
         assert_return(m, -EINVAL);
         assert_return(type < _SD_BUS_MESSAGE_TYPE_MAX, -EINVAL);
 
-        t = malloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
+        t = message_alloc0(bus);
         if (!t)
                 return -ENOMEM;
 
@@ -898,7 +1051,9 @@ _public_ sd_bus_message* sd_bus_message_ref(sd_bus_message *m) {
          * least one bus connection object. */
         assert(m->n_ref > 0 || m->n_queued > 0);
 
-        m->n_ref++;
+        /* Atomically, since method handlers running on worker threads might take references to the message
+         * of the call they are processing, while the bus thread drops its own */
+        __sync_add_and_fetch(&m->n_ref, 1);
 
         /* Each user reference to a bus message shall also be considered a ref on the bus */
         sd_bus_ref(m->bus);
@@ -911,14 +1066,25 @@ _public_ sd_bus_message* sd_bus_message_unref(sd_bus_message *m) {
 
         assert(m->n_ref > 0);
 
+        if (m->n_ref == 1 && m->n_queued == 0) {
+                sd_bus *bus = m->bus;
+
+                /* This is the last reference and the message isn't queued anywhere either. Free it while we
+                 * still hold the reference on the bus it comes with, so that its memory can be recycled for
+                 * the next message on that bus. */
+                m->n_ref = 0;
+                message_free(m);
+
+                sd_bus_unref(bus);
+                return NULL;
+        }
+
         sd_bus_unref(m->bus); /* Each regular ref is also a ref on the bus connection. Let's hence drop it
                                * here. Note we have to do this before decrementing our own n_ref here, since
                                * otherwise, if this message is currently queued sd_bus_unref() might call
                                * bus_message_unref_queued() for this which might then destroy the message
                                * while we are still processing it. */
-        m->n_ref--;
-
-        if (m->n_ref > 0 || m->n_queued > 0)
+        if (__sync_sub_and_fetch(&m->n_ref, 1) > 0 || m->n_queued > 0)
                 return NULL;
 
         /* Unset the bus field if neither the user has a reference nor this message is queued. We are careful
@@ -959,9 +1125,9 @@ sd_bus_message* bus_message_unref_queued(sd_bus_message *m, sd_bus *bus) {
         if (m->n_ref > 0 || m->n_queued > 0)
                 return NULL;
 
-        m->bus = NULL;
-
-        return message_free(m);
+        /* The bus is still alive, our caller holds on to it, hence let the message recycle its memory */
+        message_free(m);
+        return NULL;
 }
 
 _public_ int sd_bus_message_get_type(sd_bus_message *m, uint8_t *type) {
@@ -1239,7 +1405,10 @@ static int part_make_space(
                 size_t new_allocated;
 
                 new_allocated = sz > 0 ? 2 * sz : 64;
-                n = realloc(part->data, new_allocated);
+                if (part->data)
+                        n = realloc(part->data, new_allocated);
+                else
+                        n = bus_message_buffer_alloc(m->bus, new_allocated, &new_allocated);
                 if (!n) {
                         m->poisoned = true;
                         return -ENOMEM;
@@ -1713,6 +1882,7 @@ static int bus_message_open_array(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                bool validated,
                 uint32_t **array_size,
                 size_t *begin,
                 bool *need_offsets) {
@@ -1727,7 +1897,7 @@ static int bus_message_open_array(
         assert(begin);
         assert(need_offsets);
 
-        if (!signature_is_single(contents, true))
+        if (!validated && !signature_is_single(contents, true))
                 return -EINVAL;
 
         if (c->signature && c->signature[c->index]) {
@@ -1870,6 +2040,7 @@ static int bus_message_open_struct(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                bool validated,
                 size_t *begin,
                 bool *need_offsets) {
 
@@ -1882,7 +2053,7 @@ static int bus_message_open_struct(
         assert(begin);
         assert(need_offsets);
 
-        if (!signature_is_valid(contents, false))
+        if (!validated && !signature_is_valid(contents, false))
                 return -EINVAL;
 
         if (c->signature && c->signature[c->index]) {
@@ -1943,6 +2114,7 @@ static int bus_message_open_dict_entry(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                bool validated,
                 size_t *begin,
                 bool *need_offsets) {
 
@@ -1954,7 +2126,7 @@ static int bus_message_open_dict_entry(
         assert(begin);
         assert(need_offsets);
 
-        if (!signature_is_pair(contents))
+        if (!validated && !signature_is_pair(contents))
                 return -EINVAL;
 
         if (c->enclosing != SD_BUS_TYPE_ARRAY)
@@ -1997,10 +2169,11 @@ static int bus_message_open_dict_entry(
         return 0;
 }
 
-_public_ int sd_bus_message_open_container(
+static int message_open_container(
                 sd_bus_message *m,
                 char type,
-                const char *contents) {
+                const char *contents,
+                bool validated) {
 
         struct bus_container *c;
         uint32_t *array_size = NULL;
@@ -2034,13 +2207,13 @@ _public_ int sd_bus_message_open_container(
         before = m->body_size;
 
         if (type == SD_BUS_TYPE_ARRAY)
-                r = bus_message_open_array(m, c, contents, &array_size, &begin, &need_offsets);
+                r = bus_message_open_array(m, c, contents, validated, &array_size, &begin, &need_offsets);
         else if (type == SD_BUS_TYPE_VARIANT)
                 r = bus_message_open_variant(m, c, contents);
         else if (type == SD_BUS_TYPE_STRUCT)
-                r = bus_message_open_struct(m, c, contents, &begin, &need_offsets);
+                r = bus_message_open_struct(m, c, contents, validated, &begin, &need_offsets);
         else if (type == SD_BUS_TYPE_DICT_ENTRY)
-                r = bus_message_open_dict_entry(m, c, contents, &begin, &need_offsets);
+                r = bus_message_open_dict_entry(m, c, contents, validated, &begin, &need_offsets);
         else
                 r = -EINVAL;
         if (r < 0)
@@ -2059,6 +2232,14 @@ _public_ int sd_bus_message_open_container(
         return 0;
 }
 
+_public_ int sd_bus_message_open_container(
+                sd_bus_message *m,
+                char type,
+                const char *contents) {
+
+        return message_open_container(m, type, contents, false);
+}
+
 static int bus_message_close_array(sd_bus_message *m, struct bus_container *c) {
 
         assert(m);
@@ -2307,9 +2488,10 @@ static int type_stack_pop(TypeStack *stack, unsigned max, unsigned *i, const cha
         return 1;
 }
 
-_public_ int sd_bus_message_appendv(
+static int message_appendv(
                 sd_bus_message *m,
                 const char *types,
+                const BusSignaturePlan *plan,
                 va_list ap) {
 
         unsigned n_array, n_struct;
@@ -2317,10 +2499,8 @@ _public_ int sd_bus_message_appendv(
         unsigned stack_ptr = 0;
         int r;
 
-        assert_return(m, -EINVAL);
-        assert_return(types, -EINVAL);
-        assert_return(!m->sealed, -EPERM);
-        assert_return(!m->poisoned, -ESTALE);
+        assert(m);
+        assert(types);
 
         n_array = (unsigned) -1;
         n_struct = strlen(types);
@@ -2411,18 +2591,24 @@ _public_ int sd_bus_message_appendv(
                 }
 
                 case SD_BUS_TYPE_ARRAY: {
+                        bool validated;
                         size_t k;
 
-                        r = signature_element_length(t + 1, &k);
-                        if (r < 0)
-                                return r;
+                        /* If the signature is planned, the contents are known to be valid already */
+                        k = bus_signature_plan_element_length(plan, t + 1);
+                        validated = k > 0;
+                        if (!validated) {
+                                r = signature_element_length(t + 1, &k);
+                                if (r < 0)
+                                        return r;
+                        }
 
                         {
                                 char s[k + 1];
                                 memcpy(s, t + 1, k);
                                 s[k] = 0;
 
-                                r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, s);
+                                r = message_open_container(m, SD_BUS_TYPE_ARRAY, s, validated);
                                 if (r < 0)
                                         return r;
                         }
@@ -2467,11 +2653,16 @@ _public_ int sd_bus_message_appendv(
 
                 case SD_BUS_TYPE_STRUCT_BEGIN:
                 case SD_BUS_TYPE_DICT_ENTRY_BEGIN: {
+                        bool validated;
                         size_t k;
 
-                        r = signature_element_length(t, &k);
-                        if (r < 0)
-                                return r;
+                        k = bus_signature_plan_element_length(plan, t);
+                        validated = k > 0;
+                        if (!validated) {
+                                r = signature_element_length(t, &k);
+                                if (r < 0)
+                                        return r;
+                        }
 
                         {
                                 char s[k - 1];
@@ -2479,7 +2670,7 @@ _public_ int sd_bus_message_appendv(
                                 memcpy(s, t + 1, k - 2);
                                 s[k - 2] = 0;
 
-                                r = sd_bus_message_open_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s);
+                                r = message_open_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s, validated);
                                 if (r < 0)
                                         return r;
                         }
@@ -2511,6 +2702,45 @@ _public_ int sd_bus_message_appendv(
         return 1;
 }
 
+_public_ int sd_bus_message_appendv(
+                sd_bus_message *m,
+                const char *types,
+                va_list ap) {
+
+        const BusSignaturePlan *plan;
+        struct bus_container *c;
+        bool extended = false;
+        int r;
+
+        assert_return(m, -EINVAL);
+        assert_return(types, -EINVAL);
+        assert_return(!m->sealed, -EPERM);
+        assert_return(!m->poisoned, -ESTALE);
+
+        plan = bus_signature_plan_get(types);
+
+        /* Appending to the top-level container extends its signature with each element. If we know the
+         * string is made of valid complete types, extend it once for all of them instead, and cut it back
+         * to what was actually appended if that fails half-way. */
+        c = message_get_last_container(m);
+        if (plan && plan->valid && plan->length > 0 &&
+            m->n_containers == 0 && !(c->signature && c->signature[c->index])) {
+
+                if (!strextend(&c->signature, types, NULL)) {
+                        m->poisoned = true;
+                        return -ENOMEM;
+                }
+
+                extended = true;
+        }
+
+        r = message_appendv(m, types, plan, ap);
+        if (r < 0 && extended)
+                m->root_container.signature[m->root_container.index] = 0;
+
+        return r;
+}
+
 _public_ int sd_bus_message_append(sd_bus_message *m, const char *types, ...) {
         va_list ap;
         int r;
@@ -3249,6 +3479,7 @@ static int message_peek_body(
 
         size_t k, start, end, padding;
         struct bus_body_part *part;
+        bool same_part;
         uint8_t *q;
 
         assert(m);
@@ -3262,9 +3493,14 @@ static int message_peek_body(
         if (end > m->user_body_size)
                 return -EBADMSG;
 
-        part = find_part(m, *rindex, padding, (void**) &q);
-        if (!part)
-                return -EBADMSG;
+        /* Usually the padding and the data are in the same part, hence try to find both at once first */
+        part = find_part(m, *rindex, padding + nbytes, (void**) &q);
+        same_part = part;
+        if (!same_part) {
+                part = find_part(m, *rindex, padding, (void**) &q);
+                if (!part)
+                        return -EBADMSG;
+        }
 
         if (q) {
                 /* Verify padding */
@@ -3273,9 +3509,16 @@ static int message_peek_body(
                                 return -EBADMSG;
         }
 
-        part = find_part(m, start, nbytes, (void**) &q);
-        if (!part || (nbytes > 0 && !q))
-                return -EBADMSG;
+        if (same_part) {
+                if (q)
+                        q += padding;
+                else if (nbytes > 0)
+                        return -EBADMSG;
+        } else {
+                part = find_part(m, start, nbytes, (void**) &q);
+                if (!part || (nbytes > 0 && !q))
+                        return -EBADMSG;
+        }
 
         *rindex = end;
 
@@ -3574,6 +3817,7 @@ static int bus_message_enter_array(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                bool validated,
                 uint32_t **array_size,
                 size_t *item_size,
                 size_t **offsets,
@@ -3591,7 +3835,7 @@ static int bus_message_enter_array(
         assert(offsets);
         assert(n_offsets);
 
-        if (!signature_is_single(contents, true))
+        if (!validated && !signature_is_single(contents, true))
                 return -EINVAL;
 
         if (!c->signature || c->signature[c->index] == 0)
@@ -3961,6 +4205,7 @@ static int bus_message_enter_struct(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                bool validated,
                 size_t *item_size,
                 size_t **offsets,
                 size_t *n_offsets) {
@@ -3975,7 +4220,7 @@ static int bus_message_enter_struct(
         assert(offsets);
         assert(n_offsets);
 
-        if (!signature_is_valid(contents, false))
+        if (!validated && !signature_is_valid(contents, false))
                 return -EINVAL;
 
         if (!c->signature || c->signature[c->index] == 0)
@@ -4002,6 +4247,7 @@ static int bus_message_enter_dict_entry(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                bool validated,
                 size_t *item_size,
                 size_t **offsets,
                 size_t *n_offsets) {
@@ -4013,7 +4259,7 @@ static int bus_message_enter_dict_entry(
         assert(c);
         assert(contents);
 
-        if (!signature_is_pair(contents))
+        if (!validated && !signature_is_pair(contents))
                 return -EINVAL;
 
         if (c->enclosing != SD_BUS_TYPE_ARRAY)
@@ -4039,9 +4285,12 @@ static int bus_message_enter_dict_entry(
         return 1;
 }
 
-_public_ int sd_bus_message_enter_container(sd_bus_message *m,
-                                            char type,
-                                            const char *contents) {
+static int message_enter_container(
+                sd_bus_message *m,
+                char type,
+                const char *contents,
+                bool validated) {
+
         struct bus_container *c;
         uint32_t *array_size = NULL;
         _cleanup_free_ char *signature = NULL;
@@ -4111,13 +4360,13 @@ _public_ int sd_bus_message_enter_container(sd_bus_message *m,
         before = m->rindex;
 
         if (type == SD_BUS_TYPE_ARRAY)
-                r = bus_message_enter_array(m, c, contents, &array_size, &item_size, &offsets, &n_offsets);
+                r = bus_message_enter_array(m, c, contents, validated, &array_size, &item_size, &offsets, &n_offsets);
         else if (type == SD_BUS_TYPE_VARIANT)
                 r = bus_message_enter_variant(m, c, contents, &item_size);
         else if (type == SD_BUS_TYPE_STRUCT)
-                r = bus_message_enter_struct(m, c, contents, &item_size, &offsets, &n_offsets);
+                r = bus_message_enter_struct(m, c, contents, validated, &item_size, &offsets, &n_offsets);
         else if (type == SD_BUS_TYPE_DICT_ENTRY)
-                r = bus_message_enter_dict_entry(m, c, contents, &item_size, &offsets, &n_offsets);
+                r = bus_message_enter_dict_entry(m, c, contents, validated, &item_size, &offsets, &n_offsets);
         else
                 r = -EINVAL;
         if (r <= 0)
@@ -4148,6 +4397,14 @@ _public_ int sd_bus_message_enter_container(sd_bus_message *m,
         return 1;
 }
 
+_public_ int sd_bus_message_enter_container(
+                sd_bus_message *m,
+                char type,
+                const char *contents) {
+
+        return message_enter_container(m, type, contents, false);
+}
+
 _public_ int sd_bus_message_exit_container(sd_bus_message *m) {
         struct bus_container *c;
         unsigned saved;
@@ -4389,6 +4646,7 @@ _public_ int sd_bus_message_readv(
                 const char *types,
                 va_list ap) {
 
+        const BusSignaturePlan *plan;
         unsigned n_array, n_struct;
         TypeStack stack[BUS_CONTAINER_DEPTH];
         unsigned stack_ptr = 0;
@@ -4402,6 +4660,8 @@ _public_ int sd_bus_message_readv(
         if (isempty(types))
                 return 0;
 
+        plan = bus_signature_plan_get(types);
+
         /* Ideally, we'd just call ourselves recursively on every
          * complex type. However, the state of a va_list that is
          * passed to a function is undefined after that function
@@ -4471,18 +4731,23 @@ _public_ int sd_bus_message_readv(
                 }
 
                 case SD_BUS_TYPE_ARRAY: {
+                        bool validated;
                         size_t k;
 
-                        r = signature_element_length(t + 1, &k);
-                        if (r < 0)
-                                return r;
+                        k = bus_signature_plan_element_length(plan, t + 1);
+                        validated = k > 0;
+                        if (!validated) {
+                                r = signature_element_length(t + 1, &k);
+                                if (r < 0)
+                                        return r;
+                        }
 
                         {
                                 char s[k + 1];
                                 memcpy(s, t + 1, k);
                                 s[k] = 0;
 
-                                r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, s);
+                                r = message_enter_container(m, SD_BUS_TYPE_ARRAY, s, validated);
                                 if (r < 0)
                                         return r;
                                 if (r == 0) {
@@ -4539,18 +4804,23 @@ _public_ int sd_bus_message_readv(
 
                 case SD_BUS_TYPE_STRUCT_BEGIN:
                 case SD_BUS_TYPE_DICT_ENTRY_BEGIN: {
+                        bool validated;
                         size_t k;
 
-                        r = signature_element_length(t, &k);
-                        if (r < 0)
-                                return r;
+                        k = bus_signature_plan_element_length(plan, t);
+                        validated = k > 0;
+                        if (!validated) {
+                                r = signature_element_length(t, &k);
+                                if (r < 0)
+                                        return r;
+                        }
 
                         {
                                 char s[k - 1];
                                 memcpy(s, t + 1, k - 2);
                                 s[k - 2] = 0;
 
-                                r = sd_bus_message_enter_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s);
+                                r = message_enter_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s, validated);
                                 if (r < 0)
                                         return r;
                                 if (r == 0) {
@@ -5425,6 +5695,15 @@ int bus_message_parse_fields(sd_bus_message *m) {
                         if (r < 0)
                                 return -EBADMSG;
 
+                        /* We might have been passed more fds than the message declares, if the transport
+                         * read the ones of subsequent messages already, see bus_socket_make_message(). It
+                         * also rejects messages that came with more fds than they declare. We trim right
+                         * away, so that the transport knows how many fds are ours even if we fail further
+                         * down. */
+                        if (m->n_fds < unix_fds)
+                                return -EBADMSG;
+                        m->n_fds = unix_fds;
+
                         unix_fds_set = true;
                         break;
 
@@ -5439,8 +5718,10 @@ int bus_message_parse_fields(sd_bus_message *m) {
                 i++;
         }
 
-        if (m->n_fds != unix_fds)
-                return -EBADMSG;
+        /* No UNIX_FDS field means the message carries no fds. Any we were passed are checked for by the
+         * transport, see above. */
+        if (!unix_fds_set)
+                m->n_fds = 0;
 
         switch (m->header->type) {
 
@@ -5904,6 +6185,62 @@ int bus_message_remarshal(sd_bus *bus, sd_bus_message **m) {
         return 0;
 }
 
+int bus_message_append_serialized(sd_bus_message *m, size_t align, const void *p, size_t size) {
+        struct bus_container *c;
+        void *a;
+
+        assert(m);
+        assert(p || size == 0);
+
+        /* Appends an element to the array we are currently in, that was serialized before, possibly in a
+         * different message. This works only for dbus1 marshalling, where the serialization of an element
+         * doesn't depend on its position, as long as it starts at the same alignment. It's up to the caller to
+         * make sure the data matches the element type of the array, and contains no fd indexes. */
+
+        if (m->sealed)
+                return -EPERM;
+        if (m->poisoned)
+                return -ESTALE;
+        if (BUS_MESSAGE_IS_GVARIANT(m))
+                return -EOPNOTSUPP;
+
+        c = message_get_last_container(m);
+        if (c->enclosing != SD_BUS_TYPE_ARRAY)
+                return -ENXIO;
+
+        a = message_extend_body(m, align, size, false, false);
+        if (!a)
+                return -ENOMEM;
+
+        memcpy_safe(a, p, size);
+        return 0;
+}
+
+int bus_message_peek_body(sd_bus_message *m, size_t offset, size_t size, const void **ret) {
+        struct bus_body_part *part;
+        size_t begin = 0;
+        unsigned i;
+
+        assert(m);
+        assert(ret);
+
+        /* Returns a pointer to the specified range of the body, if it is in memory in one piece */
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (offset >= begin && offset + size <= begin + part->size) {
+                        if (part->memfd >= 0 || part->is_zero || !part->data)
+                                return -EOPNOTSUPP;
+
+                        *ret = (const uint8_t*) part->data + offset - begin;
+                        return 0;
+                }
+
+                begin += part->size;
+        }
+
+        return -EOPNOTSUPP;
+}
+
 _public_ int sd_bus_message_get_priority(sd_bus_message *m, int64_t *priority) {
         assert_return(m, -EINVAL);
         assert_return(priority, -EINVAL);
@@ -85,6 +85,7 @@ struct sd_bus_message {
         bool free_header:1;
         bool free_fds:1;
         bool poisoned:1;
+        bool recyclable:1;
 
         /* The first and last bytes of the message */
         struct bus_header *header;
@@ -94,6 +95,9 @@ struct sd_bus_message {
         size_t header_accessible;
         size_t footer_accessible;
 
+        /* How large the header allocation is, if we know it, 0 otherwise */
+        size_t header_allocated;
+
         size_t fields_size;
         size_t body_size;
         size_t user_body_size;
@@ -220,6 +224,13 @@ int bus_message_new_synthetic_error(sd_bus *bus, uint64_t serial, const sd_bus_e
 
 int bus_message_remarshal(sd_bus *bus, sd_bus_message **m);
 
+int bus_message_append_serialized(sd_bus_message *m, size_t align, const void *p, size_t size);
+int bus_message_peek_body(sd_bus_message *m, size_t offset, size_t size, const void **ret);
+
+void* bus_message_buffer_alloc(sd_bus *bus, size_t size, size_t *ret_allocated);
+void bus_message_buffer_free(sd_bus *bus, void *p, size_t allocated);
+void bus_message_pool_flush(sd_bus *bus);
+
 void bus_message_set_sender_driver(sd_bus *bus, sd_bus_message *m);
 void bus_message_set_sender_local(sd_bus *bus, sd_bus_message *m);
 
@@ -10,7 +10,9 @@
 #include "bus-type.h"
 #include "bus-util.h"
 #include "missing_capability.h"
+#include "random-util.h"
 #include "set.h"
+#include "siphash24.h"
 #include "string-util.h"
 #include "strv.h"
 
@@ -333,6 +335,140 @@ static int check_access(sd_bus *bus, sd_bus_message *m, struct vtable_member *c,
         return sd_bus_error_setf(error, SD_BUS_ERROR_ACCESS_DENIED, "Access to %s.%s() not permitted.", c->interface, c->member);
 }
 
+static thread_local struct bus_parallel_call *current_parallel_call = NULL;
+
+static struct bus_parallel_call *bus_parallel_call_free(struct bus_parallel_call *c) {
+        size_t i;
+
+        if (!c)
+                return NULL;
+
+        for (i = 0; i < c->n_messages; i++)
+                sd_bus_message_unref(c->messages[i]);
+        free(c->messages);
+
+        sd_bus_error_free(&c->error);
+        sd_event_source_unref(c->event_source);
+        sd_bus_slot_unref(c->slot);
+        sd_bus_message_unref(c->message);
+
+        return mfree(c);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(struct bus_parallel_call*, bus_parallel_call_free);
+
+struct bus_parallel_call *bus_parallel_call_current(sd_bus *bus) {
+        assert(bus);
+
+        /* Returns the method call the calling thread is running the handler of, if it is a worker thread
+         * and the call came in on this bus connection */
+
+        if (!current_parallel_call || current_parallel_call->message->bus != bus)
+                return NULL;
+
+        return current_parallel_call;
+}
+
+int bus_parallel_call_capture(sd_bus *bus, sd_bus_message *m, uint64_t *cookie) {
+        struct bus_parallel_call *c;
+
+        assert(bus);
+        assert(m);
+
+        c = bus_parallel_call_current(bus);
+        if (!c)
+                return 0;
+
+        /* The cookie is only assigned when the message is actually sent, hence this only works for messages
+         * no reply is expected to, i.e. replies and signals. */
+        if (cookie)
+                return -EOPNOTSUPP;
+
+        if (!GREEDY_REALLOC(c->messages, c->n_allocated, c->n_messages + 1))
+                return -ENOMEM;
+
+        c->messages[c->n_messages++] = sd_bus_message_ref(m);
+        return 1;
+}
+
+static int parallel_call_work(void *userdata) {
+        struct bus_parallel_call *c = userdata;
+        int r;
+
+        /* Runs on a worker thread */
+
+        current_parallel_call = c;
+        r = c->handler(c->message, c->userdata, &c->error);
+        current_parallel_call = NULL;
+
+        return r;
+}
+
+static int parallel_call_done(sd_event_source *s, int result, void *userdata) {
+        _cleanup_(bus_parallel_call_freep) struct bus_parallel_call *c = userdata;
+        size_t i;
+        int r;
+
+        /* Back on the bus thread. Send what the handler queued, and then an error reply if it failed, exactly
+         * like method_callbacks_run() would have. If the connection got closed in the meantime this all
+         * fails, which is fine, nobody is waiting for it anymore. */
+
+        for (i = 0; i < c->n_messages; i++) {
+                r = sd_bus_send(c->message->bus, c->messages[i], NULL);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to send message queued by method %s.%s(), ignoring: %m",
+                                        strna(c->message->interface), strna(c->message->member));
+        }
+
+        r = bus_maybe_reply_error(c->message, result, &c->error);
+        if (r < 0)
+                log_debug_errno(r, "Failed to send error reply to method %s.%s(), ignoring: %m",
+                                strna(c->message->interface), strna(c->message->member));
+
+        return 0;
+}
+
+static int parallel_call_start(
+                sd_bus *bus,
+                sd_bus_message *m,
+                sd_bus_slot *slot,
+                sd_bus_message_handler_t handler,
+                void *userdata) {
+
+        _cleanup_(bus_parallel_call_freep) struct bus_parallel_call *c = NULL;
+        int r;
+
+        assert(bus);
+        assert(bus->event);
+        assert(m);
+        assert(slot);
+        assert(handler);
+
+        c = new(struct bus_parallel_call, 1);
+        if (!c)
+                return -ENOMEM;
+
+        *c = (struct bus_parallel_call) {
+                .message = sd_bus_message_ref(m),
+                .slot = sd_bus_slot_ref(slot),
+                .handler = handler,
+                .userdata = userdata,
+                .error = SD_BUS_ERROR_NULL,
+        };
+
+        /* The worker thread might pick this up right away, hence everything it looks at has to be set up
+         * before. The event source itself is only ever touched from our thread. */
+        r = sd_event_add_work(bus->event, &c->event_source, parallel_call_work, parallel_call_done, c);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_priority(c->event_source, bus->event_priority);
+        (void) sd_event_source_set_description(c->event_source, "bus-parallel-call");
+
+        TAKE_PTR(c);
+        return 0;
+}
+
 static int method_callbacks_run(
                 sd_bus *bus,
                 sd_bus_message *m,
@@ -397,6 +533,17 @@ static int method_callbacks_run(
 
                 slot = container_of(c->parent, sd_bus_slot, node_vtable);
 
+                /* Methods that may run in parallel are handed to the work pool of the event loop. If the bus
+                 * is not attached to one, or no worker can be had, they are simply run right away. */
+                if ((c->vtable->flags & SD_BUS_VTABLE_METHOD_PARALLEL) && bus->event) {
+                        r = parallel_call_start(bus, m, slot, c->vtable->x.method.handler, u);
+                        if (r >= 0)
+                                return 1;
+
+                        log_debug_errno(r, "Failed to dispatch method %s.%s() to worker thread, running it synchronously: %m",
+                                        c->interface, c->member);
+                }
+
                 bus->current_slot = sd_bus_slot_ref(slot);
                 bus->current_handler = c->vtable->x.method.handler;
                 bus->current_userdata = u;
@@ -723,15 +870,251 @@ static int vtable_append_one_property(
         return 0;
 }
 
+struct property_cache_vtable {
+        struct node_vtable *node_vtable;
+        void *userdata;
+
+        /* The serialized dict entries of the const properties, by position in the vtable */
+        struct iovec *values;
+        size_t n_values;
+
+        /* Digests of the values last sent in a PropertiesChanged signal, by position in the vtable, zero if
+         * unknown. Only allocated if needed. */
+        uint64_t *digests;
+
+        LIST_FIELDS(struct property_cache_vtable, vtables);
+};
+
+struct property_cache {
+        char *path;
+        LIST_HEAD(struct property_cache_vtable, vtables);
+};
+
+static void property_cache_vtable_reset(sd_bus *bus, struct property_cache_vtable *v) {
+        size_t i;
+
+        assert(bus);
+        assert(v);
+
+        for (i = 0; i < v->n_values; i++) {
+                bus->property_cache_size -= v->values[i].iov_len;
+                v->values[i].iov_base = mfree(v->values[i].iov_base);
+                v->values[i].iov_len = 0;
+        }
+}
+
+static void property_cache_vtable_forget_digests(sd_bus *bus, struct property_cache_vtable *v) {
+        assert(bus);
+        assert(v);
+
+        if (!v->digests)
+                return;
+
+        bus->property_cache_size -= v->n_values * sizeof(uint64_t);
+        v->digests = mfree(v->digests);
+}
+
+static void property_cache_vtable_free(sd_bus *bus, struct property_cache *pc, struct property_cache_vtable *v) {
+        assert(bus);
+        assert(pc);
+        assert(v);
+
+        LIST_REMOVE(vtables, pc->vtables, v);
+
+        property_cache_vtable_reset(bus, v);
+        property_cache_vtable_forget_digests(bus, v);
+        free(v->values);
+        free(v);
+}
+
+static struct property_cache* property_cache_free(sd_bus *bus, struct property_cache *pc) {
+        assert(bus);
+
+        if (!pc)
+                return NULL;
+
+        while (pc->vtables)
+                property_cache_vtable_free(bus, pc, pc->vtables);
+
+        free(pc->path);
+        return mfree(pc);
+}
+
+void bus_property_cache_invalidate(sd_bus *bus, const char *path) {
+        struct property_cache *pc;
+
+        assert(bus);
+
+        /* Forgets what we know about the properties of the object at the specified path, or of all objects,
+         * if NULL */
+
+        if (path)
+                property_cache_free(bus, ordered_hashmap_remove(bus->property_cache, path));
+        else
+                while ((pc = ordered_hashmap_steal_first(bus->property_cache)))
+                        property_cache_free(bus, pc);
+}
+
+static void property_cache_invalidate_interfaces(sd_bus *bus, const char *path, char **interfaces) {
+        struct property_cache_vtable *v, *n;
+        struct property_cache *pc;
+
+        assert(bus);
+        assert(path);
+
+        pc = ordered_hashmap_get(bus->property_cache, path);
+        if (!pc)
+                return;
+
+        LIST_FOREACH_SAFE(vtables, v, n, pc->vtables)
+                if (strv_contains(interfaces, v->node_vtable->interface))
+                        property_cache_vtable_free(bus, pc, v);
+}
+
+static bool property_is_cacheable(const sd_bus_vtable *v) {
+        assert(v);
+
+        /* Const properties never change during the lifetime of the object, hence we can serialize them
+         * once and reuse that. Except for fds, which are passed along with each message separately. */
+
+        return (v->flags & SD_BUS_VTABLE_PROPERTY_CONST) &&
+                !strchr(v->x.property.signature, SD_BUS_TYPE_UNIX_FD);
+}
+
+static struct property_cache_vtable* property_cache_get(
+                sd_bus *bus,
+                const char *path,
+                struct node_vtable *c,
+                void *userdata) {
+
+        struct property_cache_vtable *v;
+        struct property_cache *pc;
+        const sd_bus_vtable *i;
+        size_t n = 0;
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(c);
+
+        /* Returns the cache for the const properties of the specified vtable on the specified object. Failing
+         * to allocate it is not fatal, we'll just go without. */
+
+        pc = ordered_hashmap_remove(bus->property_cache, path);
+        if (!pc) {
+                pc = new0(struct property_cache, 1);
+                if (!pc)
+                        return NULL;
+
+                pc->path = strdup(path);
+                if (!pc->path)
+                        return mfree(pc);
+        }
+
+        /* (Re-)add it at the end, it's the most recently used one now */
+        r = ordered_hashmap_ensure_allocated(&bus->property_cache, &string_hash_ops);
+        if (r >= 0)
+                r = ordered_hashmap_put(bus->property_cache, pc->path, pc);
+        if (r < 0) {
+                property_cache_free(bus, pc);
+                return NULL;
+        }
+
+        /* Make room for whatever we'll add, by dropping the objects we haven't been asked about longest */
+        while (bus->property_cache_size > BUS_PROPERTY_CACHE_SIZE_MAX &&
+               ordered_hashmap_first(bus->property_cache) != pc)
+                property_cache_free(bus, ordered_hashmap_steal_first(bus->property_cache));
+
+        LIST_FOREACH(vtables, v, pc->vtables)
+                if (v->node_vtable == c) {
+                        /* There's a different object at this path now */
+                        if (v->userdata != userdata) {
+                                property_cache_vtable_reset(bus, v);
+                                property_cache_vtable_forget_digests(bus, v);
+                                v->userdata = userdata;
+                        }
+
+                        return v;
+                }
+
+        for (i = c->vtable; i->type != _SD_BUS_VTABLE_END; i = bus_vtable_next(c->vtable, i))
+                n++;
+
+        v = new0(struct property_cache_vtable, 1);
+        if (!v)
+                return NULL;
+
+        v->values = new0(struct iovec, n);
+        if (!v->values)
+                return mfree(v);
+
+        v->node_vtable = c;
+        v->userdata = userdata;
+        v->n_values = n;
+
+        LIST_PREPEND(vtables, pc->vtables, v);
+        return v;
+}
+
+static int vtable_append_one_property_cached(
+                sd_bus *bus,
+                sd_bus_message *reply,
+                const char *path,
+                struct node_vtable *c,
+                const sd_bus_vtable *v,
+                void *userdata,
+                struct property_cache_vtable *cache,
+                size_t k,
+                sd_bus_error *error) {
+
+        struct iovec *value;
+        size_t begin;
+        const void *p;
+        int r;
+
+        assert(bus);
+        assert(reply);
+        assert(cache);
+        assert(k < cache->n_values);
+
+        value = cache->values + k;
+        if (value->iov_base)
+                return bus_message_append_serialized(reply, 8, value->iov_base, value->iov_len);
+
+        /* Dict entries are aligned to 8 bytes, that's where the serialization of this one will begin */
+        begin = ALIGN8(reply->body_size);
+
+        r = vtable_append_one_property(bus, reply, path, c, v, userdata, error);
+        if (r < 0)
+                return r;
+        if (bus->nodes_modified)
+                return 0;
+
+        if (bus_message_peek_body(reply, begin, reply->body_size - begin, &p) < 0)
+                return 0;
+
+        value->iov_base = memdup(p, reply->body_size - begin);
+        if (!value->iov_base)
+                return 0;
+
+        value->iov_len = reply->body_size - begin;
+        bus->property_cache_size += value->iov_len;
+
+        return 0;
+}
+
 static int vtable_append_all_properties(
                 sd_bus *bus,
                 sd_bus_message *reply,
                 const char *path,
                 struct node_vtable *c,
                 void *userdata,
+                char **names,
                 sd_bus_error *error) {
 
+        struct property_cache_vtable *cache = NULL;
         const sd_bus_vtable *v;
+        size_t k;
         int r;
 
         assert(bus);
@@ -742,8 +1125,12 @@ static int vtable_append_all_properties(
         if (c->vtable[0].flags & SD_BUS_VTABLE_HIDDEN)
                 return 1;
 
+        /* Serialized values can be reused only with dbus1 marshalling, and only if the vtable asked for it */
+        if ((c->vtable[0].flags & SD_BUS_VTABLE_CACHE_CONST) && !BUS_MESSAGE_IS_GVARIANT(reply))
+                cache = property_cache_get(bus, path, c, userdata);
+
         v = c->vtable;
-        for (v = bus_vtable_next(c->vtable, v); v->type != _SD_BUS_VTABLE_END; v = bus_vtable_next(c->vtable, v)) {
+        for (k = 1, v = bus_vtable_next(c->vtable, v); v->type != _SD_BUS_VTABLE_END; k++, v = bus_vtable_next(c->vtable, v)) {
                 if (!IN_SET(v->type, _SD_BUS_VTABLE_PROPERTY, _SD_BUS_VTABLE_WRITABLE_PROPERTY))
                         continue;
 
@@ -753,7 +1140,13 @@ static int vtable_append_all_properties(
                 if (v->flags & SD_BUS_VTABLE_PROPERTY_EXPLICIT)
                         continue;
 
-                r = vtable_append_one_property(bus, reply, path, c, v, userdata, error);
+                if (!strv_isempty(names) && !strv_contains(names, v->x.property.member))
+                        continue;
+
+                if (cache && property_is_cacheable(v))
+                        r = vtable_append_one_property_cached(bus, reply, path, c, v, userdata, cache, k, error);
+                else
+                        r = vtable_append_one_property(bus, reply, path, c, v, userdata, error);
                 if (r < 0)
                         return r;
                 if (bus->nodes_modified)
@@ -814,7 +1207,7 @@ static int property_get_all_callbacks_run(
                         continue;
                 found_interface = true;
 
-                r = vtable_append_all_properties(bus, reply, m->path, c, u, &error);
+                r = vtable_append_all_properties(bus, reply, m->path, c, u, NULL, &error);
                 if (r < 0)
                         return bus_maybe_reply_error(m, r, &error);
                 if (bus->nodes_modified)
@@ -945,6 +1338,17 @@ int introspect_path(
                 if (c->vtable[0].flags & SD_BUS_VTABLE_HIDDEN)
                         continue;
 
+                /* The vtable never changes, hence generate its part of the XML only once */
+                if (!c->introspection || c->introspection_trusted != bus->trusted) {
+                        c->introspection = mfree(c->introspection);
+
+                        r = introspect_interface_to_string(c->vtable, bus->trusted, &c->introspection);
+                        if (r < 0)
+                                return r;
+
+                        c->introspection_trusted = bus->trusted;
+                }
+
                 if (!streq_ptr(previous_interface, c->interface)) {
                         if (previous_interface)
                                 fputs(" </interface>\n", intro.f);
@@ -952,9 +1356,7 @@ int introspect_path(
                         fprintf(intro.f, " <interface name=\"%s\">\n", c->interface);
                 }
 
-                r = introspect_write_interface(&intro, c->vtable);
-                if (r < 0)
-                        return r;
+                fputs(c->introspection, intro.f);
 
                 previous_interface = c->interface;
         }
@@ -1127,7 +1529,7 @@ static int object_manager_serialize_path(
                                 return r;
                 }
 
-                r = vtable_append_all_properties(bus, reply, path, i, u, error);
+                r = vtable_append_all_properties(bus, reply, path, i, u, NULL, error);
                 if (r < 0)
                         return r;
                 if (bus->nodes_modified)
@@ -1460,6 +1862,117 @@ int bus_process_object(sd_bus *bus, sd_bus_message *m) {
         return 1;
 }
 
+static int object_append_properties(
+                sd_bus *bus,
+                sd_bus_message *m,
+                const char *p,
+                const char *path,
+                bool require_fallback,
+                char **names,
+                bool *found_object,
+                sd_bus_error *error) {
+
+        struct node_vtable *c;
+        struct node *n;
+        int r;
+
+        assert(bus);
+        assert(m);
+        assert(p);
+        assert(path);
+        assert(found_object);
+
+        n = hashmap_get(bus->nodes, p);
+        if (!n)
+                return 0;
+
+        LIST_FOREACH(vtables, c, n->vtables) {
+                void *u;
+
+                if (require_fallback && !c->is_fallback)
+                        continue;
+
+                r = node_vtable_get_userdata(bus, path, c, &u, error);
+                if (r < 0)
+                        return r;
+                if (bus->nodes_modified)
+                        return -EAGAIN;
+                if (r == 0)
+                        continue;
+
+                *found_object = true;
+
+                r = vtable_append_all_properties(bus, m, path, c, u, names, error);
+                if (r < 0)
+                        return r;
+                if (bus->nodes_modified)
+                        return -EAGAIN;
+        }
+
+        return 0;
+}
+
+int bus_append_object_properties(
+                sd_bus *bus,
+                sd_bus_message *m,
+                const char *path,
+                char **names,
+                sd_bus_error *error) {
+
+        _cleanup_free_ char *prefix = NULL;
+        sd_bus_message_handler_t saved_handler;
+        sd_bus_slot *saved_slot;
+        void *saved_userdata;
+        bool found_object = false, saved_nodes_modified;
+        size_t pl;
+        int r;
+
+        assert(bus);
+        assert(m);
+        assert(path);
+
+        /* Appends the properties of the object at the specified path to the "a{sv}" array currently open in
+         * the message, merged across all interfaces, exactly like GetAll() with an empty interface name would
+         * return them. If a list of names is specified only those properties are appended. This is useful for
+         * services that want to return the properties of many objects in a single reply, and is supposed to
+         * be called from a method handler, hence we need to restore the current slot and friends afterwards.
+         *
+         * Returns > 0 if the object was found, 0 if not, and -EAGAIN if the object tree was modified while we
+         * were at it, in which case the message contains a partial result and should be discarded. */
+
+        pl = strlen(path);
+        assert(pl <= BUS_PATH_SIZE_MAX);
+        prefix = new(char, pl + 1);
+        if (!prefix)
+                return -ENOMEM;
+
+        saved_slot = bus->current_slot;
+        saved_handler = bus->current_handler;
+        saved_userdata = bus->current_userdata;
+        saved_nodes_modified = bus->nodes_modified;
+        bus->nodes_modified = false;
+
+        r = object_append_properties(bus, m, path, path, false, names, &found_object, error);
+        if (r >= 0 && !found_object) {
+                /* Look for fallback prefixes */
+                OBJECT_PATH_FOREACH_PREFIX(prefix, path) {
+                        r = object_append_properties(bus, m, prefix, path, true, names, &found_object, error);
+                        if (r < 0 || found_object)
+                                break;
+                }
+        }
+
+        bus->current_slot = saved_slot;
+        bus->current_handler = saved_handler;
+        bus->current_userdata = saved_userdata;
+        bus->nodes_modified = bus->nodes_modified || saved_nodes_modified;
+
+        if (r < 0)
+                return r;
+
+        return found_object;
+}
+
 static struct node *bus_node_allocate(sd_bus *bus, const char *path) {
         struct node *n, *parent;
         const char *e;
@@ -1851,7 +2364,7 @@ static int add_object_vtable_internal(
                             !names_are_valid(strempty(v->x.method.signature), &names, &nf) ||
                             !names_are_valid(strempty(v->x.method.result), &names, &nf) ||
                             !(v->x.method.handler || (isempty(v->x.method.signature) && isempty(v->x.method.result))) ||
-                            v->flags & (SD_BUS_VTABLE_PROPERTY_CONST|SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE|SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION)) {
+                            v->flags & (SD_BUS_VTABLE_PROPERTY_CONST|SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE|SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION|SD_BUS_VTABLE_CACHE_CONST)) {
                                 r = -EINVAL;
                                 goto fail;
                         }
@@ -1896,7 +2409,7 @@ static int add_object_vtable_internal(
                         if (!member_name_is_valid(v->x.property.member) ||
                             !signature_is_single(v->x.property.signature, false) ||
                             !(v->x.property.get || bus_type_is_basic(v->x.property.signature[0]) || streq(v->x.property.signature, "as")) ||
-                            (v->flags & SD_BUS_VTABLE_METHOD_NO_REPLY) ||
+                            (v->flags & (SD_BUS_VTABLE_METHOD_NO_REPLY|SD_BUS_VTABLE_METHOD_PARALLEL|SD_BUS_VTABLE_CACHE_CONST)) ||
                             (!!(v->flags & SD_BUS_VTABLE_PROPERTY_CONST) + !!(v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE) + !!(v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION)) > 1 ||
                             ((v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE) && (v->flags & SD_BUS_VTABLE_PROPERTY_EXPLICIT)) ||
                             (v->flags & SD_BUS_VTABLE_UNPRIVILEGED && v->type == _SD_BUS_VTABLE_PROPERTY)) {
@@ -1934,7 +2447,7 @@ static int add_object_vtable_internal(
                         if (!member_name_is_valid(v->x.signal.member) ||
                             !signature_is_valid(strempty(v->x.signal.signature), false) ||
                             !names_are_valid(strempty(v->x.signal.signature), &names, &nf) ||
-                            v->flags & SD_BUS_VTABLE_UNPRIVILEGED) {
+                            v->flags & (SD_BUS_VTABLE_UNPRIVILEGED|SD_BUS_VTABLE_METHOD_PARALLEL|SD_BUS_VTABLE_CACHE_CONST)) {
                                 r = -EINVAL;
                                 goto fail;
                         }
@@ -1951,6 +2464,10 @@ static int add_object_vtable_internal(
         LIST_INSERT_AFTER(vtables, n->vtables, existing, &s->node_vtable);
         bus->nodes_modified = true;
 
+        /* Cached property values are per vtable, but let's not make assumptions about how find() callbacks of
+         * different vtables relate to each other */
+        bus_property_cache_invalidate(bus, NULL);
+
         if (slot)
                 *slot = s;
 
@@ -2034,17 +2551,167 @@ fail:
         return r;
 }
 
+static bool property_is_digestible(const sd_bus_vtable *v) {
+        assert(v);
+
+        /* Explicit properties are not supposed to be read unless asked for by name. And fds are passed along
+         * with each message separately, their serialization is just an index. */
+        return !(v->flags & SD_BUS_VTABLE_PROPERTY_EXPLICIT) &&
+                !strchr(v->x.property.signature, SD_BUS_TYPE_UNIX_FD);
+}
+
+static struct property_cache_vtable* property_cache_get_digests(
+                sd_bus *bus,
+                const char *path,
+                struct node_vtable *c,
+                void *userdata) {
+
+        struct property_cache_vtable *v;
+
+        assert(bus);
+
+        /* Returns the digests of the values we last sent for the specified vtable on the specified object.
+         * Failing to allocate them is not fatal, we'll just send all properties then. */
+
+        v = property_cache_get(bus, path, c, userdata);
+        if (!v)
+                return NULL;
+
+        if (!v->digests) {
+                v->digests = new0(uint64_t, v->n_values);
+                if (!v->digests)
+                        return NULL;
+
+                bus->property_cache_size += v->n_values * sizeof(uint64_t);
+        }
+
+        /* Property values might be controlled by others, hence use a secret key, so that nobody can make us
+         * suppress a change by picking a colliding value */
+        if (!bus->property_digest_key_set) {
+                random_bytes(bus->property_digest_key, sizeof(bus->property_digest_key));
+                bus->property_digest_key_set = true;
+        }
+
+        return v;
+}
+
+static void property_cache_forget_digests(sd_bus *bus, const char *path, const char *interface) {
+        struct property_cache_vtable *v;
+        struct property_cache *pc;
+
+        assert(bus);
+        assert(path);
+        assert(interface);
+
+        pc = ordered_hashmap_get(bus->property_cache, path);
+        if (!pc)
+                return;
+
+        LIST_FOREACH(vtables, v, pc->vtables)
+                if (streq(v->node_vtable->interface, interface))
+                        property_cache_vtable_forget_digests(bus, v);
+}
+
+static void property_cache_reset_values(sd_bus *bus, const char *path) {
+        struct property_cache_vtable *v;
+        struct property_cache *pc;
+
+        assert(bus);
+        assert(path);
+
+        pc = ordered_hashmap_get(bus->property_cache, path);
+        if (!pc)
+                return;
+
+        LIST_FOREACH(vtables, v, pc->vtables)
+                property_cache_vtable_reset(bus, v);
+}
+
+static int vtable_append_one_property_if_changed(
+                sd_bus *bus,
+                sd_bus_message *m,
+                sd_bus_message **scratch,
+                const char *path,
+                struct node_vtable *c,
+                const sd_bus_vtable *v,
+                void *userdata,
+                struct property_cache_vtable *cache,
+                size_t k,
+                sd_bus_error *error) {
+
+        uint64_t digest;
+        size_t begin;
+        const void *p;
+        int r;
+
+        assert(bus);
+        assert(m);
+        assert(scratch);
+        assert(cache);
+        assert(k < cache->n_values);
+
+        /* Serializes the property into a scratch message first, and copies it over into the signal only if
+         * it differs from what we sent the last time. Returns > 0 if the property changed. */
+
+        assert(v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE);
+
+        if (!*scratch) {
+                r = sd_bus_message_new(bus, scratch, SD_BUS_MESSAGE_SIGNAL);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_open_container(*scratch, 'a', "{sv}");
+                if (r < 0)
+                        return r;
+        }
+
+        /* Dict entries are aligned to 8 bytes, that's where the serialization of this one will begin */
+        begin = ALIGN8((*scratch)->body_size);
+
+        r = vtable_append_one_property(bus, *scratch, path, c, v, userdata, error);
+        if (r < 0)
+                return r;
+        if (bus->nodes_modified)
+                return 0;
+
+        if (bus_message_peek_body(*scratch, begin, (*scratch)->body_size - begin, &p) < 0) {
+                /* Can't look at it, hence assume it changed */
+                cache->digests[k] = 0;
+
+                r = vtable_append_one_property(bus, m, path, c, v, userdata, error);
+                if (r < 0)
+                        return r;
+
+                return 1;
+        }
+
+        digest = siphash24(p, (*scratch)->body_size - begin, bus->property_digest_key);
+        if (digest == cache->digests[k])
+                return 0;
+
+        cache->digests[k] = digest;
+
+        r = bus_message_append_serialized(m, 8, p, (*scratch)->body_size - begin);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
 static int emit_properties_changed_on_interface(
                 sd_bus *bus,
                 const char *prefix,
                 const char *path,
                 const char *interface,
                 bool require_fallback,
+                bool only_changed,
                 bool *found_interface,
                 char **names) {
 
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
-        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *scratch = NULL;
+        _cleanup_free_ const char **invalidated = NULL;
+        size_t n_invalidated = 0, n_allocated = 0;
         bool has_invalidating = false, has_changing = false;
         struct vtable_member key = {};
         struct node_vtable *c;
@@ -2135,22 +2802,57 @@ static int emit_properties_changed_on_interface(
                                         return 0;
                         }
                 } else {
+                        struct property_cache_vtable *cache = NULL;
                         const sd_bus_vtable *v;
+                        size_t k;
 
                         /* If the caller specified no properties list
                          * we include all properties that are marked
-                         * as changing in the message. */
+                         * as changing in the message. Or only those
+                         * of them whose value changed since the last
+                         * time, if so requested. */
+
+                        if (only_changed && !BUS_MESSAGE_IS_GVARIANT(m))
+                                cache = property_cache_get_digests(bus, path, c, u);
 
                         v = c->vtable;
-                        for (v = bus_vtable_next(c->vtable, v); v->type != _SD_BUS_VTABLE_END; v = bus_vtable_next(c->vtable, v)) {
+                        for (k = 1, v = bus_vtable_next(c->vtable, v); v->type != _SD_BUS_VTABLE_END; k++, v = bus_vtable_next(c->vtable, v)) {
                                 if (!IN_SET(v->type, _SD_BUS_VTABLE_PROPERTY, _SD_BUS_VTABLE_WRITABLE_PROPERTY))
                                         continue;
 
                                 if (v->flags & SD_BUS_VTABLE_HIDDEN)
                                         continue;
 
+                                /* Properties marked for invalidation are usually expensive to get, that's
+                                 * why they are marked like that. Hence we don't call their getters to find
+                                 * out whether they changed, but always list them. */
+                                if (cache &&
+                                    (v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE) &&
+                                    property_is_digestible(v)) {
+
+                                        r = vtable_append_one_property_if_changed(bus, m, &scratch, m->path, c, v, u, cache, k, &error);
+                                        if (r < 0)
+                                                return r;
+                                        if (bus->nodes_modified)
+                                                return 0;
+                                        if (r > 0)
+                                                has_changing = true;
+
+                                        continue;
+                                }
+
                                 if (v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION) {
                                         has_invalidating = true;
+
+                                        /* Remember that we have to list this one, if we aren't going to
+                                         * list all of them anyway */
+                                        if (only_changed) {
+                                                if (!GREEDY_REALLOC(invalidated, n_allocated, n_invalidated + 1))
+                                                        return -ENOMEM;
+
+                                                invalidated[n_invalidated++] = v->x.property.member;
+                                        }
+
                                         continue;
                                 }
 
@@ -2179,7 +2881,16 @@ static int emit_properties_changed_on_interface(
         if (r < 0)
                 return r;
 
-        if (has_invalidating) {
+        if (only_changed && !names) {
+                size_t i;
+
+                for (i = 0; i < n_invalidated; i++) {
+                        r = sd_bus_message_append(m, "s", invalidated[i]);
+                        if (r < 0)
+                                return r;
+                }
+
+        } else if (has_invalidating) {
                 LIST_FOREACH(vtables, c, n->vtables) {
                         if (require_fallback && !c->is_fallback)
                                 continue;
@@ -2243,10 +2954,11 @@ static int emit_properties_changed_on_interface(
         return 1;
 }
 
-_public_ int sd_bus_emit_properties_changed_strv(
+static int emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
                 const char *interface,
+                bool only_changed,
                 char **names) {
 
         _cleanup_free_ char *prefix = NULL;
@@ -2254,14 +2966,16 @@ _public_ int sd_bus_emit_properties_changed_strv(
         size_t pl;
         int r;
 
-        assert_return(bus, -EINVAL);
-        assert_return(bus = bus_resolve(bus), -ENOPKG);
-        assert_return(object_path_is_valid(path), -EINVAL);
-        assert_return(interface_name_is_valid(interface), -EINVAL);
-        assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert(bus);
+        assert(path);
+        assert(interface);
 
-        if (!BUS_IS_OPEN(bus->state))
-                return -ENOTCONN;
+        /* Whatever changed, let's not rely on anything we know about the object anymore. Except for what we
+         * sent last, if we'll only send what changed since then. */
+        if (only_changed)
+                property_cache_reset_values(bus, path);
+        else
+                bus_property_cache_invalidate(bus, path);
 
         /* A non-NULL but empty names list means nothing needs to be
            generated. A NULL list OTOH indicates that all properties
@@ -2281,14 +2995,14 @@ _public_ int sd_bus_emit_properties_changed_strv(
         do {
                 bus->nodes_modified = false;
 
-                r = emit_properties_changed_on_interface(bus, path, path, interface, false, &found_interface, names);
+                r = emit_properties_changed_on_interface(bus, path, path, interface, false, only_changed, &found_interface, names);
                 if (r != 0)
                         return r;
                 if (bus->nodes_modified)
                         continue;
 
                 OBJECT_PATH_FOREACH_PREFIX(prefix, path) {
-                        r = emit_properties_changed_on_interface(bus, prefix, path, interface, true, &found_interface, names);
+                        r = emit_properties_changed_on_interface(bus, prefix, path, interface, true, only_changed, &found_interface, names);
                         if (r != 0)
                                 return r;
                         if (bus->nodes_modified)
@@ -2300,6 +3014,48 @@ _public_ int sd_bus_emit_properties_changed_strv(
         return found_interface ? 0 : -ENOENT;
 }
 
+_public_ int sd_bus_emit_properties_changed_strv(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names) {
+
+        assert_return(bus, -EINVAL);
+        assert_return(bus = bus_resolve(bus), -ENOPKG);
+        assert_return(object_path_is_valid(path), -EINVAL);
+        assert_return(interface_name_is_valid(interface), -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        return emit_properties_changed(bus, path, interface, false, names);
+}
+
+int bus_emit_properties_changed_diff(sd_bus *bus, const char *path, const char *interface) {
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(interface);
+
+        /* Like sd_bus_emit_properties_changed_strv() with a NULL list, but includes only the properties whose
+         * value changed since the last signal sent this way, and sends nothing if there are none. Properties
+         * are compared by a digest of their serialization, and those we have no digest of yet are included.
+         * Properties marked for invalidation are always listed, their getters are not called. */
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        r = emit_properties_changed(bus, path, interface, true, NULL);
+        if (r < 0)
+                /* We don't know what made it out, hence start over next time */
+                property_cache_forget_digests(bus, path, interface);
+
+        return r;
+}
+
 _public_ int sd_bus_emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
@@ -2313,6 +3069,7 @@ _public_ int sd_bus_emit_properties_changed(
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(interface_name_is_valid(interface), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
@@ -2397,7 +3154,7 @@ static int object_added_append_all_prefix(
                         previous_interface = c->interface;
                 }
 
-                r = vtable_append_all_properties(bus, m, path, c, u, &error);
+                r = vtable_append_all_properties(bus, m, path, c, u, NULL, &error);
                 if (r < 0)
                         return r;
                 if (bus->nodes_modified)
@@ -2501,10 +3258,14 @@ _public_ int sd_bus_emit_object_added(sd_bus *bus, const char *path) {
         assert_return(bus = bus_resolve(bus), -ENOPKG);
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        /* A new object appeared at this path, don't serve anything cached for a previous one */
+        bus_property_cache_invalidate(bus, path);
+
         r = bus_find_parent_object_manager(bus, &object_manager, path);
         if (r < 0)
                 return r;
@@ -2678,10 +3439,14 @@ _public_ int sd_bus_emit_object_removed(sd_bus *bus, const char *path) {
         assert_return(bus = bus_resolve(bus), -ENOPKG);
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        /* The object is gone, there's no point in keeping anything cached for it */
+        bus_property_cache_invalidate(bus, path);
+
         r = bus_find_parent_object_manager(bus, &object_manager, path);
         if (r < 0)
                 return r;
@@ -2774,7 +3539,7 @@ static int interfaces_added_append_one_prefix(
                         found_interface = true;
                 }
 
-                r = vtable_append_all_properties(bus, m, path, c, u, &error);
+                r = vtable_append_all_properties(bus, m, path, c, u, NULL, &error);
                 if (r < 0)
                         return r;
                 if (bus->nodes_modified)
@@ -2838,10 +3603,15 @@ _public_ int sd_bus_emit_interfaces_added_strv(sd_bus *bus, const char *path, ch
         assert_return(bus = bus_resolve(bus), -ENOPKG);
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        /* The object stays the same, but what implements these interfaces on it may not be what did the
+         * last time they were around */
+        property_cache_invalidate_interfaces(bus, path, interfaces);
+
         if (strv_isempty(interfaces))
                 return 0;
 
@@ -2907,6 +3677,7 @@ _public_ int sd_bus_emit_interfaces_added(sd_bus *bus, const char *path, const c
         assert_return(bus = bus_resolve(bus), -ENOPKG);
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
@@ -2925,10 +3696,14 @@ _public_ int sd_bus_emit_interfaces_removed_strv(sd_bus *bus, const char *path,
         assert_return(bus = bus_resolve(bus), -ENOPKG);
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        /* These interfaces are gone from the object, forget what we cached for them */
+        property_cache_invalidate_interfaces(bus, path, interfaces);
+
         if (strv_isempty(interfaces))
                 return 0;
 
@@ -2960,6 +3735,7 @@ _public_ int sd_bus_emit_interfaces_removed(sd_bus *bus, const char *path, const
         assert_return(bus = bus_resolve(bus), -ENOPKG);
         assert_return(object_path_is_valid(path), -EINVAL);
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_parallel_call_current(bus), -EPERM);
 
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
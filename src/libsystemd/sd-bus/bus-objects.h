@@ -9,6 +9,14 @@ bool bus_vtable_has_names(const sd_bus_vtable *vtable);
 int bus_process_object(sd_bus *bus, sd_bus_message *m);
 void bus_node_gc(sd_bus *b, struct node *n);
 
+void bus_property_cache_invalidate(sd_bus *bus, const char *path);
+int bus_emit_properties_changed_diff(sd_bus *bus, const char *path, const char *interface);
+
+struct bus_parallel_call *bus_parallel_call_current(sd_bus *bus);
+int bus_parallel_call_capture(sd_bus *bus, sd_bus_message *m, uint64_t *cookie);
+
+int bus_append_object_properties(sd_bus *bus, sd_bus_message *m, const char *path, char **names, sd_bus_error *error);
+
 int introspect_path(
                 sd_bus *bus,
                 const char *path,
@@ -146,3 +146,54 @@ bool signature_is_valid(const char *s, bool allow_dict_entry) {
 
         return p - s <= SD_BUS_MAXIMUM_SIGNATURE_LENGTH;
 }
+
+#define BUS_SIGNATURE_PLAN_CACHE_SIZE 16U
+
+/* Format strings are almost always literals, hence we look them up by their address, in a small cache per
+ * thread, as method handlers might be run on worker threads. The string is compared too, in case it got
+ * reused for something else. */
+static thread_local BusSignaturePlan plan_cache[BUS_SIGNATURE_PLAN_CACHE_SIZE] = {};
+
+const BusSignaturePlan *bus_signature_plan_get(const char *s) {
+        BusSignaturePlan *plan;
+        size_t l, i;
+
+        if (!s)
+                return NULL;
+
+        plan = plan_cache + (((uintptr_t) s >> 3) ^ ((uintptr_t) s >> 9)) % BUS_SIGNATURE_PLAN_CACHE_SIZE;
+        if (plan->key == s && strncmp(plan->signature, s, plan->length + 1) == 0)
+                return plan;
+
+        l = strnlen(s, BUS_SIGNATURE_PLAN_MAX + 1);
+        if (l > BUS_SIGNATURE_PLAN_MAX)
+                return NULL;
+
+        plan->key = s;
+        plan->length = l;
+        memcpy(plan->signature, s, l + 1);
+
+        for (i = 0; i < l; i++) {
+                size_t k;
+
+                if (signature_element_length(s + i, &k) < 0 || i + k > l)
+                        k = 0;
+
+                plan->element_length[i] = k;
+        }
+
+        plan->valid = signature_is_valid(s, false);
+
+        return plan;
+}
+
+size_t bus_signature_plan_element_length(const BusSignaturePlan *plan, const char *s) {
+
+        /* Returns the length of the complete type at s, if it is part of the planned string, or 0 if it is
+         * not known */
+
+        if (!plan || s < plan->key || s >= plan->key + plan->length)
+                return 0;
+
+        return plan->element_length[s - plan->key];
+}
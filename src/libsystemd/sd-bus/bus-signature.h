@@ -2,9 +2,30 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 bool signature_is_single(const char *s, bool allow_dict_entry);
 bool signature_is_pair(const char *s);
 bool signature_is_valid(const char *s, bool allow_dict_entry);
 
 int signature_element_length(const char *s, size_t *l);
+
+#define BUS_SIGNATURE_PLAN_MAX 63U
+
+/* The element lengths of a signature string passed to sd_bus_message_append() or sd_bus_message_read(),
+ * precomputed once for every position, so that these calls don't have to parse the signature again and again
+ * for each container they open, and the contents of the containers don't have to be validated either. */
+typedef struct BusSignaturePlan {
+        const char *key;
+        size_t length;
+        char signature[BUS_SIGNATURE_PLAN_MAX + 1];
+
+        /* The length of the complete type starting at each position, or 0 if there is none */
+        uint8_t element_length[BUS_SIGNATURE_PLAN_MAX];
+
+        /* Whether the whole string is a valid sequence of complete types outside of arrays */
+        bool valid;
+} BusSignaturePlan;
+
+const BusSignaturePlan *bus_signature_plan_get(const char *s);
+size_t bus_signature_plan_element_length(const BusSignaturePlan *plan, const char *s);
@@ -150,6 +150,10 @@ void bus_slot_disconnect(sd_bus_slot *slot, bool unref) {
                 }
 
                 slot->node_vtable.interface = mfree(slot->node_vtable.interface);
+                slot->node_vtable.introspection = mfree(slot->node_vtable.introspection);
+
+                /* The cache refers to the vtable, drop it */
+                bus_property_cache_invalidate(slot->bus, NULL);
 
                 if (slot->node_vtable.node) {
                         LIST_REMOVE(vtables, slot->node_vtable.node->vtables, &slot->node_vtable);
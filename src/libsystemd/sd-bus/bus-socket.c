@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <endian.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -27,11 +28,19 @@
 #include "signal-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
+#include "unaligned.h"
 #include "user-util.h"
 #include "utf8.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* How many bytes of queued messages we gather at most for a single write. The socket buffer won't take more
+ * anyway. */
+#define WRITE_BATCH_MAX SNDBUF_SIZE
+
+/* How much we read at most beyond what the message at hand needs */
+#define READ_AHEAD_SIZE (64U*1024U)
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -994,54 +1003,78 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **m, size_t n, size_t *idx) {
         struct iovec *iov;
+        size_t n_iov = 0, n_batch, sz = 0, i;
         ssize_t k;
-        size_t n;
         unsigned j;
         int r;
 
         assert(bus);
         assert(m);
+        assert(n > 0);
         assert(idx);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        if (*idx >= BUS_MESSAGE_SIZE(m))
+        if (*idx >= BUS_MESSAGE_SIZE(m[0]))
                 return 0;
 
-        r = bus_message_setup_iovec(m);
-        if (r < 0)
-                return r;
+        /* Gather as many of the queued messages into a single write as we can. The kernel attaches the fds
+         * we pass along to the first byte written, hence a message carrying any may only ever go first,
+         * right where the receiver will look for them. */
+        for (n_batch = 0; n_batch < n; n_batch++) {
+                sd_bus_message *q = m[n_batch];
+
+                r = bus_message_setup_iovec(q);
+                if (r < 0) {
+                        /* Let's deal with that once it's this message's turn */
+                        if (n_batch > 0)
+                                break;
+
+                        return r;
+                }
+
+                if (n_batch > 0 &&
+                    (q->n_fds > 0 ||
+                     n_iov + q->n_iovec > IOV_MAX ||
+                     sz >= WRITE_BATCH_MAX))
+                        break;
+
+                n_iov += q->n_iovec;
+                sz += BUS_MESSAGE_SIZE(q);
+        }
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = newa(struct iovec, n);
-        memcpy_safe(iov, m->iovec, n);
+        iov = newa(struct iovec, n_iov);
+        for (i = 0, n_iov = 0; i < n_batch; i++) {
+                memcpy(iov + n_iov, m[i]->iovec, sizeof(struct iovec) * m[i]->n_iovec);
+                n_iov += m[i]->n_iovec;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov + j, n_iov - j);
         else {
                 struct msghdr mh = {
-                        .msg_iov = iov,
-                        .msg_iovlen = m->n_iovec,
+                        .msg_iov = iov + j,
+                        .msg_iovlen = n_iov - j,
                 };
 
-                if (m->n_fds > 0 && *idx == 0) {
+                if (m[0]->n_fds > 0 && *idx == 0) {
                         struct cmsghdr *control;
 
-                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * m->n_fds));
-                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m->n_fds);
+                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * m[0]->n_fds));
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m[0]->n_fds);
                         control->cmsg_level = SOL_SOCKET;
                         control->cmsg_type = SCM_RIGHTS;
-                        memcpy(CMSG_DATA(control), m->fds, sizeof(int) * m->n_fds);
+                        memcpy(CMSG_DATA(control), m[0]->fds, sizeof(int) * m[0]->n_fds);
                 }
 
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov + j, n_iov - j);
                 }
         }
 
@@ -1052,16 +1085,17 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
-static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+static int bus_socket_read_message_need(sd_bus *bus, const void *p, size_t size, size_t *need) {
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
 
         assert(bus);
+        assert(p || size == 0);
         assert(need);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (size < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -1083,16 +1117,14 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
-
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        /* Messages following the first one in the buffer are not necessarily aligned */
+        e = ((const uint8_t*) p)[0];
         if (e == BUS_LITTLE_ENDIAN) {
-                a = le32toh(a);
-                b = le32toh(b);
+                a = unaligned_read_le32((const uint8_t*) p + 4);
+                b = unaligned_read_le32((const uint8_t*) p + 12);
         } else if (e == BUS_BIG_ENDIAN) {
-                a = be32toh(a);
-                b = be32toh(b);
+                a = unaligned_read_be32((const uint8_t*) p + 4);
+                b = unaligned_read_be32((const uint8_t*) p + 12);
         } else
                 return -EBADMSG;
 
@@ -1104,61 +1136,203 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
-static int bus_socket_make_message(sd_bus *bus, size_t size) {
+static size_t bus_socket_invalid_message_n_fds(sd_bus *bus, void *buffer, size_t size) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+
+        assert(bus);
+
+        /* Figures out how many of the fds we got belong to a message we failed to turn into an object. If
+         * parsing got as far as the UNIX_FDS field, that's how many the message declared. Otherwise there's
+         * no telling which fds belong to what, and we consider them all the message's. */
+
+        if (bus_message_from_header(bus,
+                                    buffer, size,
+                                    buffer, size,
+                                    size,
+                                    bus->fds, bus->n_fds,
+                                    NULL,
+                                    0, &m) < 0)
+                return bus->n_fds;
+
+        (void) bus_message_parse_fields(m);
+
+        return m->n_fds;
+}
+
+static void bus_socket_forget_fds(sd_bus *bus, size_t n) {
+        assert(bus);
+        assert(n <= bus->n_fds);
+
+        /* Removes the first n fds from the queue, without closing them */
+
+        bus->n_fds -= n;
+        memmove(bus->fds, bus->fds + n, sizeof(int) * bus->n_fds);
+        memmove(bus->fds_rbuffer_end, bus->fds_rbuffer_end + n, sizeof(size_t) * bus->n_fds);
+
+        if (bus->n_fds == 0) {
+                bus->fds = mfree(bus->fds);
+                bus->fds_rbuffer_end = mfree(bus->fds_rbuffer_end);
+        }
+}
+
+static int bus_socket_make_message(sd_bus *bus, size_t *offset, size_t size) {
         sd_bus_message *t = NULL;
+        size_t allocated = 0, n_extra = 0;
+        bool whole;
         void *b;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
+        assert(offset);
+        assert(bus->rbuffer_size >= *offset + size);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
         r = bus_rqueue_make_room(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
+        /* If the message is all there is in the buffer, it gets the buffer itself, which is the common case
+         * for large messages, since we read those exactly to size. Otherwise it gets a copy, which for
+         * small messages comes from the connection's buffer pool. */
+        whole = *offset == 0 && size == bus->rbuffer_size && size > BUS_MESSAGE_POOL_BUFFER_SIZE;
+        if (whole) {
+                /* We might have allocated more than we got to read, don't keep that around with the
+                 * message. Shrinking can hardly fail, but if it does, it's just a bit of waste. */
+                b = realloc(bus->rbuffer, size) ?: bus->rbuffer;
+                bus->rbuffer = NULL;
+        } else {
+                b = bus_message_buffer_alloc(bus, size, &allocated);
                 if (!b)
                         return -ENOMEM;
-        } else
-                b = NULL;
+
+                memcpy(b, (const uint8_t*) bus->rbuffer + *offset, size);
+        }
 
         r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
+                                    b, size,
                                     bus->fds, bus->n_fds,
                                     NULL,
                                     &t);
         if (r == -EBADMSG) {
+                size_t n_fds;
+
                 log_debug_errno(r, "Received invalid message from connection %s, dropping.", strna(bus->description));
-                free(bus->rbuffer); /* We want to drop current rbuffer and proceed with whatever remains in b */
+
+                /* Drop the fds that came with the invalid message, but keep those of subsequent messages */
+                n_fds = bus_socket_invalid_message_n_fds(bus, b, size);
+                close_many(bus->fds, n_fds);
+                bus_socket_forget_fds(bus, n_fds);
+
+                bus_message_buffer_free(bus, b, allocated);
         } else if (r < 0) {
-                free(b);
+                if (whole)
+                        bus->rbuffer = b;
+                else
+                        bus_message_buffer_free(bus, b, allocated);
                 return r;
+        } else {
+                t->header_allocated = allocated;
+
+                /* The message took the fds it declared, the remaining ones belong to subsequent messages */
+                bus_socket_forget_fds(bus, t->n_fds);
         }
 
-        /* rbuffer ownership was either transferred to t, or we got EBADMSG and dropped it. */
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        /* fds arrive with the first byte of the message they belong to. Those that came in with a read that
+         * ended within this message hence can't belong to any later one, and if there are any left, the
+         * message carried fds it didn't declare. */
+        while (n_extra < bus->n_fds && bus->fds_rbuffer_end[n_extra] <= *offset + size)
+                n_extra++;
+        if (n_extra > 0) {
+                log_debug("Received message with %zu undeclared file descriptors from connection %s, dropping.",
+                          n_extra, strna(bus->description));
 
-        bus->fds = NULL;
-        bus->n_fds = 0;
+                close_many(bus->fds, n_extra);
+                bus_socket_forget_fds(bus, n_extra);
+
+                t = sd_bus_message_unref(t);
+        }
+
+        if (whole)
+                bus->rbuffer_size = 0;
+        else
+                *offset += size;
 
         if (t) {
                 t->read_counter = ++bus->read_counter;
                 bus->rqueue[bus->rqueue_size++] = bus_message_ref_queued(t, bus);
+
+                bus_statistics_reply_received(bus, t);
+                bus_statistics_queues(bus);
+
                 sd_bus_message_unref(t);
         }
 
         return 1;
 }
 
+static int bus_socket_make_messages(sd_bus *bus) {
+        size_t offset = 0, need;
+        int r, ret = 0;
+
+        assert(bus);
+
+        /* Turns all complete messages in the read buffer into message objects, and leaves the rest for the
+         * next read */
+
+        for (;;) {
+                r = bus_socket_read_message_need(bus,
+                                                 (const uint8_t*) bus->rbuffer + offset,
+                                                 bus->rbuffer_size - offset,
+                                                 &need);
+                if (r < 0)
+                        break;
+
+                if (bus->rbuffer_size - offset < need)
+                        break;
+
+                /* Leave the rest for later if the queue is full, rather than failing */
+                if (ret > 0 && bus->rqueue_size >= BUS_RQUEUE_MAX)
+                        break;
+
+                r = bus_socket_make_message(bus, &offset, need);
+                if (r < 0)
+                        break;
+
+                ret = 1;
+        }
+
+        if (offset > 0) {
+                size_t i;
+
+                bus->rbuffer_size -= offset;
+                memmove(bus->rbuffer, (const uint8_t*) bus->rbuffer + offset, bus->rbuffer_size);
+
+                for (i = 0; i < bus->n_fds; i++)
+                        bus->fds_rbuffer_end[i] -= offset;
+        }
+
+        if (bus->rbuffer_size == 0) {
+                bus->rbuffer = mfree(bus->rbuffer);
+
+                /* fds arrive with the first byte of the message they belong to. If there's nothing left in
+                 * the buffer, nobody is going to claim the ones we still have. */
+                if (bus->n_fds > 0) {
+                        log_debug("Received %zu file descriptors not belonging to any message on connection %s, closing.",
+                                  bus->n_fds, strna(bus->description));
+
+                        close_many(bus->fds, bus->n_fds);
+                        bus_socket_forget_fds(bus, bus->n_fds);
+                }
+        }
+
+        return r < 0 ? r : ret;
+}
+
 int bus_socket_read_message(sd_bus *bus) {
         struct msghdr mh;
         struct iovec iov = {};
         ssize_t k;
-        size_t need;
+        size_t need, n;
         int r;
         void *b;
         union {
@@ -1170,20 +1344,24 @@ int bus_socket_read_message(sd_bus *bus) {
         assert(bus);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_read_message_need(bus, bus->rbuffer, bus->rbuffer_size, &need);
         if (r < 0)
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
+
+        /* Read what the message at hand still lacks, but also whatever else is already waiting for us, up
+         * to a limit, so that a burst of small messages doesn't cost a syscall each. */
+        n = MAX(need, bus->rbuffer_size + READ_AHEAD_SIZE);
 
-        b = realloc(bus->rbuffer, need);
+        b = realloc(bus->rbuffer, n);
         if (!b)
                 return -ENOMEM;
 
         bus->rbuffer = b;
 
-        iov = IOVEC_MAKE((uint8_t *)bus->rbuffer + bus->rbuffer_size, need - bus->rbuffer_size);
+        iov = IOVEC_MAKE((uint8_t *)bus->rbuffer + bus->rbuffer_size, n - bus->rbuffer_size);
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -1214,40 +1392,47 @@ int bus_socket_read_message(sd_bus *bus) {
                 CMSG_FOREACH(cmsg, &mh)
                         if (cmsg->cmsg_level == SOL_SOCKET &&
                             cmsg->cmsg_type == SCM_RIGHTS) {
-                                int n, *f, i;
+                                int n_fds, *f, i;
+                                size_t *e;
 
-                                n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                                n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
 
                                 if (!bus->can_fds) {
                                         /* Whut? We received fds but this
                                          * isn't actually enabled? Close them,
                                          * and fail */
 
-                                        close_many((int*) CMSG_DATA(cmsg), n);
+                                        close_many((int*) CMSG_DATA(cmsg), n_fds);
                                         return -EIO;
                                 }
 
-                                f = reallocarray(bus->fds, bus->n_fds + n, sizeof(int));
+                                f = reallocarray(bus->fds, bus->n_fds + n_fds, sizeof(int));
                                 if (!f) {
-                                        close_many((int*) CMSG_DATA(cmsg), n);
+                                        close_many((int*) CMSG_DATA(cmsg), n_fds);
                                         return -ENOMEM;
                                 }
-
-                                for (i = 0; i < n; i++)
-                                        f[bus->n_fds++] = fd_move_above_stdio(((int*) CMSG_DATA(cmsg))[i]);
                                 bus->fds = f;
+
+                                e = reallocarray(bus->fds_rbuffer_end, bus->n_fds + n_fds, sizeof(size_t));
+                                if (!e) {
+                                        close_many((int*) CMSG_DATA(cmsg), n_fds);
+                                        return -ENOMEM;
+                                }
+                                bus->fds_rbuffer_end = e;
+
+                                for (i = 0; i < n_fds; i++) {
+                                        f[bus->n_fds] = fd_move_above_stdio(((int*) CMSG_DATA(cmsg))[i]);
+                                        e[bus->n_fds++] = bus->rbuffer_size;
+                                }
                         } else
                                 log_debug("Got unexpected auxiliary data with level=%d and type=%d",
                                           cmsg->cmsg_level, cmsg->cmsg_type);
         }
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_make_messages(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
-
         return 1;
 }
 
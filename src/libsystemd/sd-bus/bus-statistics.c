@@ -0,0 +1,410 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include "alloc-util.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "bus-statistics.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "sort-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "util.h"
+
+typedef struct BusPendingCall {
+        BusCallStatistics *call;
+        char *key;
+        usec_t timestamp;
+        usec_t deadline;
+        unsigned prioq_idx;
+} BusPendingCall;
+
+static BusCallStatistics *bus_call_statistics_free(BusCallStatistics *c) {
+        if (!c)
+                return NULL;
+
+        free(c->key);
+        free(c->interface);
+        free(c->member);
+        return mfree(c);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(BusCallStatistics*, bus_call_statistics_free);
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(bus_call_statistics_hash_ops, char, string_hash_func, string_compare_func,
+                                              BusCallStatistics, bus_call_statistics_free);
+
+BusStatistics *bus_statistics_free(BusStatistics *s) {
+        if (!s)
+                return NULL;
+
+        hashmap_free(s->calls);
+        prioq_free(s->pending_prioq);
+        hashmap_free(s->pending);
+        return mfree(s);
+}
+
+static BusCallStatistics *bus_statistics_get_call(BusStatistics *s, bool incoming, sd_bus_message *m) {
+        _cleanup_(bus_call_statistics_freep) BusCallStatistics *c = NULL;
+        BusCallStatistics *existing;
+        const char *k;
+
+        assert(s);
+        assert(m);
+
+        k = strjoina(incoming ? "in " : "out ", strempty(m->interface), " ", strempty(m->member));
+
+        existing = hashmap_get(s->calls, k);
+        if (existing)
+                return existing;
+
+        c = new(BusCallStatistics, 1);
+        if (!c)
+                return NULL;
+
+        *c = (BusCallStatistics) {
+                .incoming = incoming,
+        };
+
+        c->key = strdup(k);
+        if (!c->key)
+                return NULL;
+
+        if (m->interface) {
+                c->interface = strdup(m->interface);
+                if (!c->interface)
+                        return NULL;
+        }
+
+        if (m->member) {
+                c->member = strdup(m->member);
+                if (!c->member)
+                        return NULL;
+        }
+
+        if (hashmap_ensure_allocated(&s->calls, &bus_call_statistics_hash_ops) < 0)
+                return NULL;
+
+        if (hashmap_put(s->calls, c->key, c) < 0)
+                return NULL;
+
+        return TAKE_PTR(c);
+}
+
+static char *pending_key(bool incoming, const char *sender, uint64_t cookie) {
+        char c[DECIMAL_STR_MAX(uint64_t)];
+
+        xsprintf(c, "%" PRIu64, cookie);
+
+        /* Our own cookies are unique on the connection, those of our peers only per sender */
+        if (incoming)
+                return strjoin("in ", strempty(sender), " ", c);
+
+        return strjoin("out ", c);
+}
+
+static int pending_call_compare(const void *a, const void *b) {
+        const BusPendingCall *x = a, *y = b;
+
+        return CMP(x->deadline, y->deadline);
+}
+
+static void bus_statistics_forget_pending(BusStatistics *s, BusPendingCall *p) {
+        assert(s);
+        assert(p);
+
+        assert_se(hashmap_remove(s->pending, p->key) == p);
+        prioq_remove(s->pending_prioq, p, &p->prioq_idx);
+
+        free(p->key);
+        free(p);
+}
+
+static void bus_statistics_evict_pending(BusStatistics *s, usec_t n) {
+        BusPendingCall *p;
+
+        /* Forget about the calls we won't see a reply for anymore, because their timeout passed, and the
+         * one closest to its timeout in any case if we remember too many already */
+        while ((p = prioq_peek(s->pending_prioq)) &&
+               (p->deadline < n || hashmap_size(s->pending) >= BUS_STATISTICS_PENDING_MAX))
+                bus_statistics_forget_pending(s, p);
+}
+
+static void bus_statistics_add_pending(sd_bus *bus, BusCallStatistics *c, char *key, uint64_t timeout) {
+        _cleanup_free_ BusPendingCall *p = NULL;
+        _cleanup_free_ char *k = key;
+        BusStatistics *s;
+        usec_t n;
+
+        assert(bus);
+        assert(c);
+
+        if (!k)
+                return;
+
+        s = bus->statistics;
+        n = now(CLOCK_MONOTONIC);
+
+        bus_statistics_evict_pending(s, n);
+
+        if (hashmap_ensure_allocated(&s->pending, &string_hash_ops_free_free) < 0)
+                return;
+
+        if (prioq_ensure_allocated(&s->pending_prioq, pending_call_compare) < 0)
+                return;
+
+        p = new(BusPendingCall, 1);
+        if (!p)
+                return;
+
+        *p = (BusPendingCall) {
+                .call = c,
+                .key = k,
+                .timestamp = n,
+                .deadline = usec_add(n, timeout),
+                .prioq_idx = PRIOQ_IDX_NULL,
+        };
+
+        if (hashmap_put(s->pending, k, p) < 0)
+                return;
+
+        if (prioq_put(s->pending_prioq, p, &p->prioq_idx) < 0) {
+                assert_se(hashmap_remove(s->pending, k) == p);
+                return;
+        }
+
+        TAKE_PTR(k);
+        TAKE_PTR(p);
+}
+
+static void bus_statistics_complete(BusStatistics *s, char *key, bool error) {
+        _cleanup_free_ char *k = key;
+        BusCallStatistics *c;
+        BusPendingCall *p;
+        usec_t t;
+        unsigned i;
+
+        assert(s);
+
+        if (!k)
+                return;
+
+        p = hashmap_get(s->pending, k);
+        if (!p)
+                return;
+
+        c = p->call;
+        t = usec_sub_unsigned(now(CLOCK_MONOTONIC), p->timestamp);
+        bus_statistics_forget_pending(s, p);
+
+        if (error)
+                c->n_errors++;
+
+        i = t == 0 ? 0 : MIN(u64log2(t) + 1, BUS_STATISTICS_BUCKETS - 1);
+        c->histogram[i]++;
+
+        c->n_latencies++;
+        c->latency_total += t;
+        c->latency_max = MAX(c->latency_max, t);
+}
+
+void bus_statistics_call_received(sd_bus *bus, sd_bus_message *m) {
+        BusCallStatistics *c;
+        uint64_t timeout;
+
+        assert(bus);
+        assert(m);
+
+        /* In monitor mode we see the calls of others, we'll never reply to them */
+        if (!bus->statistics || bus->is_monitor || m->header->type != SD_BUS_MESSAGE_METHOD_CALL)
+                return;
+
+        c = bus_statistics_get_call(bus->statistics, true, m);
+        if (!c)
+                return;
+
+        c->n_calls++;
+
+        if (m->header->flags & BUS_MESSAGE_NO_REPLY_EXPECTED)
+                return;
+
+        /* We don't know how long the caller is willing to wait, let's assume the usual */
+        if (sd_bus_get_method_call_timeout(bus, &timeout) < 0)
+                timeout = BUS_DEFAULT_TIMEOUT;
+
+        bus_statistics_add_pending(bus, c, pending_key(true, m->sender, BUS_MESSAGE_COOKIE(m)), timeout);
+}
+
+void bus_statistics_call_sent(sd_bus *bus, sd_bus_message *m) {
+        BusCallStatistics *c;
+        uint64_t timeout;
+
+        assert(bus);
+        assert(m);
+
+        if (!bus->statistics || m->header->type != SD_BUS_MESSAGE_METHOD_CALL)
+                return;
+
+        c = bus_statistics_get_call(bus->statistics, false, m);
+        if (!c)
+                return;
+
+        c->n_calls++;
+
+        if (m->header->flags & BUS_MESSAGE_NO_REPLY_EXPECTED)
+                return;
+
+        /* The timeout the call was sealed with, which is (uint64_t) -1 for none */
+        timeout = m->timeout;
+        if (timeout == 0 && sd_bus_get_method_call_timeout(bus, &timeout) < 0)
+                timeout = BUS_DEFAULT_TIMEOUT;
+
+        bus_statistics_add_pending(bus, c, pending_key(false, NULL, BUS_MESSAGE_COOKIE(m)), timeout);
+}
+
+void bus_statistics_reply_received(sd_bus *bus, sd_bus_message *m) {
+        assert(bus);
+        assert(m);
+
+        if (!bus->statistics || bus->is_monitor ||
+            !IN_SET(m->header->type, SD_BUS_MESSAGE_METHOD_RETURN, SD_BUS_MESSAGE_METHOD_ERROR))
+                return;
+
+        bus_statistics_complete(bus->statistics,
+                                pending_key(false, NULL, m->reply_cookie),
+                                m->header->type == SD_BUS_MESSAGE_METHOD_ERROR);
+}
+
+void bus_statistics_reply_sent(sd_bus *bus, sd_bus_message *m) {
+        assert(bus);
+        assert(m);
+
+        if (!bus->statistics || !IN_SET(m->header->type, SD_BUS_MESSAGE_METHOD_RETURN, SD_BUS_MESSAGE_METHOD_ERROR))
+                return;
+
+        bus_statistics_complete(bus->statistics,
+                                pending_key(true, m->destination, m->reply_cookie),
+                                m->header->type == SD_BUS_MESSAGE_METHOD_ERROR);
+}
+
+void bus_statistics_call_timed_out(sd_bus *bus, uint64_t cookie) {
+        assert(bus);
+
+        if (!bus->statistics)
+                return;
+
+        bus_statistics_complete(bus->statistics, pending_key(false, NULL, cookie), true);
+}
+
+void bus_statistics_queues(sd_bus *bus) {
+        assert(bus);
+
+        if (!bus->statistics)
+                return;
+
+        bus->statistics->rqueue_max = MAX(bus->statistics->rqueue_max, bus->rqueue_size);
+        bus->statistics->wqueue_max = MAX(bus->statistics->wqueue_max, bus->wqueue_size);
+}
+
+static usec_t bus_call_statistics_percentile(const BusCallStatistics *c, unsigned percent) {
+        uint64_t n = 0, limit;
+        unsigned i;
+
+        assert(c);
+        assert(c->n_latencies > 0);
+
+        /* Returns the upper bound of the bucket the percentile falls into, hence is off by at most a factor
+         * of two */
+
+        limit = DIV_ROUND_UP(c->n_latencies * percent, 100U);
+
+        for (i = 0; i < BUS_STATISTICS_BUCKETS - 1; i++) {
+                n += c->histogram[i];
+                if (n >= limit)
+                        break;
+        }
+
+        return MIN(UINT64_C(1) << i, c->latency_max);
+}
+
+static int bus_call_statistics_compare(BusCallStatistics * const *a, BusCallStatistics * const *b) {
+        int r;
+
+        /* Calls we spent most time waiting for first */
+        r = -CMP((*a)->latency_total, (*b)->latency_total);
+        if (r != 0)
+                return r;
+
+        return -CMP((*a)->n_calls, (*b)->n_calls);
+}
+
+int bus_statistics_format(sd_bus *bus, char **ret) {
+        _cleanup_free_ BusCallStatistics **calls = NULL;
+        _cleanup_free_ char *dump = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        BusCallStatistics *c;
+        size_t n = 0, size, i;
+        Iterator iterator;
+        int r;
+
+        assert(bus);
+        assert(bus->statistics);
+        assert(ret);
+
+        calls = new(BusCallStatistics*, MAX(hashmap_size(bus->statistics->calls), 1u));
+        if (!calls)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(c, bus->statistics->calls, iterator)
+                calls[n++] = c;
+
+        typesafe_qsort(calls, n, bus_call_statistics_compare);
+
+        f = open_memstream_unlocked(&dump, &size);
+        if (!f)
+                return -ENOMEM;
+
+        fprintf(f,
+                "Read queue: %zu (max %zu)\n"
+                "Write queue: %zu (max %zu)\n"
+                "Calls waiting for a reply: %u\n\n",
+                bus->rqueue_size, MAX(bus->statistics->rqueue_max, bus->rqueue_size),
+                bus->wqueue_size, MAX(bus->statistics->wqueue_max, bus->wqueue_size),
+                hashmap_size(bus->statistics->pending));
+
+        fprintf(f, "%-3s %-40s %-32s %10s %8s %10s %10s %10s %10s %10s\n",
+                "DIR", "INTERFACE", "MEMBER", "CALLS", "ERRORS", "AVG", "MAX", "P50", "P90", "P99");
+
+        for (i = 0; i < n; i++) {
+                char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c50[FORMAT_TIMESPAN_MAX],
+                        c90[FORMAT_TIMESPAN_MAX], c99[FORMAT_TIMESPAN_MAX];
+                const char *avg = "-", *max = "-", *p50 = "-", *p90 = "-", *p99 = "-";
+
+                c = calls[i];
+
+                if (c->n_latencies > 0) {
+                        avg = format_timespan(a, sizeof(a), c->latency_total / c->n_latencies, 1);
+                        max = format_timespan(b, sizeof(b), c->latency_max, 1);
+                        p50 = format_timespan(c50, sizeof(c50), bus_call_statistics_percentile(c, 50), 1);
+                        p90 = format_timespan(c90, sizeof(c90), bus_call_statistics_percentile(c, 90), 1);
+                        p99 = format_timespan(c99, sizeof(c99), bus_call_statistics_percentile(c, 99), 1);
+                }
+
+                fprintf(f, "%-3s %-40s %-32s %10" PRIu64 " %8" PRIu64 " %10s %10s %10s %10s %10s\n",
+                        c->incoming ? "in" : "out",
+                        strna(c->interface),
+                        strna(c->member),
+                        c->n_calls,
+                        c->n_errors,
+                        avg, max, p50, p90, p99);
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return r;
+
+        f = safe_fclose(f);
+
+        *ret = TAKE_PTR(dump);
+        return 0;
+}
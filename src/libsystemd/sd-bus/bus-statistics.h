@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include "sd-bus.h"
+
+#include "hashmap.h"
+#include "prioq.h"
+#include "time-util.h"
+
+/* Latencies are counted in buckets of powers of two microseconds, the last one takes everything longer */
+#define BUS_STATISTICS_BUCKETS 32U
+
+/* Answered by every connection with statistics enabled, on any object path */
+#define BUS_STATISTICS_INTERFACE "org.freedesktop.sd_bus.Statistics"
+
+/* Upper bound on calls we remember while waiting for their replies. Beyond that, those closest to their
+ * timeout are forgotten. */
+#define BUS_STATISTICS_PENDING_MAX 4096U
+
+typedef struct BusCallStatistics {
+        char *key;
+        bool incoming;
+        char *interface;
+        char *member;
+        uint64_t n_calls;
+        uint64_t n_errors;
+        uint64_t n_latencies;
+        usec_t latency_total;
+        usec_t latency_max;
+        uint64_t histogram[BUS_STATISTICS_BUCKETS];
+} BusCallStatistics;
+
+typedef struct BusStatistics {
+        Hashmap *calls;          /* "in|out interface member" → BusCallStatistics */
+        Hashmap *pending;        /* "in sender cookie" or "out cookie" → BusPendingCall */
+        Prioq *pending_prioq;    /* BusPendingCall, ordered by the time we stop waiting for the reply */
+        size_t rqueue_max;
+        size_t wqueue_max;
+} BusStatistics;
+
+BusStatistics *bus_statistics_free(BusStatistics *s);
+
+void bus_statistics_call_received(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_call_sent(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_reply_received(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_reply_sent(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_call_timed_out(sd_bus *bus, uint64_t cookie);
+void bus_statistics_queues(sd_bus *bus);
+
+int bus_statistics_format(sd_bus *bus, char **ret);
@@ -28,6 +28,7 @@
 #include "bus-util.h"
 #include "cgroup-util.h"
 #include "def.h"
+#include "env-util.h"
 #include "errno-util.h"
 #include "fd-util.h"
 #include "hexdecoct.h"
@@ -204,6 +205,7 @@ static sd_bus* bus_free(sd_bus *b) {
 
         close_many(b->fds, b->n_fds);
         free(b->fds);
+        free(b->fds_rbuffer_end);
 
         bus_reset_queues(b);
 
@@ -216,12 +218,19 @@ static sd_bus* bus_free(sd_bus *b) {
         hashmap_free_free(b->vtable_methods);
         hashmap_free_free(b->vtable_properties);
 
+        bus_property_cache_invalidate(b, NULL);
+        ordered_hashmap_free(b->property_cache);
+
         assert(hashmap_isempty(b->nodes));
         hashmap_free(b->nodes);
 
+        bus_statistics_free(b->statistics);
+
         bus_flush_memfd(b);
+        bus_message_pool_flush(b);
 
         assert_se(pthread_mutex_destroy(&b->memfd_cache_mutex) == 0);
+        assert_se(pthread_mutex_destroy(&b->message_pool_mutex) == 0);
 
         return mfree(b);
 }
@@ -255,6 +264,11 @@ _public_ int sd_bus_new(sd_bus **ret) {
                 return -ENOMEM;
 
         assert_se(pthread_mutex_init(&b->memfd_cache_mutex, NULL) == 0);
+        assert_se(pthread_mutex_init(&b->message_pool_mutex, NULL) == 0);
+
+        /* Allow turning on accounting for programs which don't do so themselves, e.g. PID 1 or logind */
+        if (getenv_bool_secure("SD_BUS_STATISTICS") > 0)
+                (void) sd_bus_set_statistics(b, true);
 
         *ret = TAKE_PTR(b);
         return 0;
@@ -1587,7 +1601,34 @@ void bus_enter_closing(sd_bus *bus) {
         bus_set_state(bus, BUS_CLOSING);
 }
 
-DEFINE_PUBLIC_TRIVIAL_REF_UNREF_FUNC(sd_bus, sd_bus, bus_free);
+/* The reference counter is updated atomically, as messages created by method handlers running on worker
+ * threads take references too, see SD_BUS_VTABLE_METHOD_PARALLEL. Everything else about the object is still
+ * only ever touched from a single thread. */
+_public_ sd_bus* sd_bus_ref(sd_bus *bus) {
+        unsigned n;
+
+        if (!bus)
+                return NULL;
+
+        n = __sync_fetch_and_add(&bus->n_ref, 1);
+        assert(n > 0);
+
+        return bus;
+}
+
+_public_ sd_bus* sd_bus_unref(sd_bus *bus) {
+        unsigned n;
+
+        if (!bus)
+                return NULL;
+
+        n = __sync_fetch_and_sub(&bus->n_ref, 1);
+        assert(n > 0);
+        if (n > 1)
+                return NULL;
+
+        return bus_free(bus);
+}
 
 _public_ int sd_bus_is_open(sd_bus *bus) {
         assert_return(bus, -EINVAL);
@@ -1760,29 +1801,35 @@ int bus_seal_synthetic_message(sd_bus *b, sd_bus_message *m) {
         return sd_bus_message_seal(m, 0xFFFFFFFFULL, 0);
 }
 
+static void bus_log_sent_message(sd_bus_message *m) {
+        assert(m);
+
+        log_debug("Sent message type=%s sender=%s destination=%s path=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " signature=%s error-name=%s error-message=%s",
+                  bus_message_type_to_string(m->header->type),
+                  strna(sd_bus_message_get_sender(m)),
+                  strna(sd_bus_message_get_destination(m)),
+                  strna(sd_bus_message_get_path(m)),
+                  strna(sd_bus_message_get_interface(m)),
+                  strna(sd_bus_message_get_member(m)),
+                  BUS_MESSAGE_COOKIE(m),
+                  m->reply_cookie,
+                  strna(m->root_container.signature),
+                  strna(m->error.name),
+                  strna(m->error.message));
+}
+
 static int bus_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         int r;
 
         assert(bus);
         assert(m);
 
-        r = bus_socket_write_message(bus, m, idx);
+        r = bus_socket_write_messages(bus, &m, 1, idx);
         if (r <= 0)
                 return r;
 
         if (*idx >= BUS_MESSAGE_SIZE(m))
-                log_debug("Sent message type=%s sender=%s destination=%s path=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " signature=%s error-name=%s error-message=%s",
-                          bus_message_type_to_string(m->header->type),
-                          strna(sd_bus_message_get_sender(m)),
-                          strna(sd_bus_message_get_destination(m)),
-                          strna(sd_bus_message_get_path(m)),
-                          strna(sd_bus_message_get_interface(m)),
-                          strna(sd_bus_message_get_member(m)),
-                          BUS_MESSAGE_COOKIE(m),
-                          m->reply_cookie,
-                          strna(m->root_container.signature),
-                          strna(m->error.name),
-                          strna(m->error.message));
+                bus_log_sent_message(m);
 
         return r;
 }
@@ -1794,28 +1841,28 @@ static int dispatch_wqueue(sd_bus *bus) {
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
         while (bus->wqueue_size > 0) {
+                size_t n;
 
-                r = bus_write_message(bus, bus->wqueue[0], &bus->windex);
+                /* This writes out as much of the queue as we can in one go, windex is relative to the
+                 * beginning of the first entry, and thus might now point well beyond it */
+                r = bus_socket_write_messages(bus, bus->wqueue, bus->wqueue_size, &bus->windex);
                 if (r < 0)
                         return r;
-                else if (r == 0)
+                if (r == 0)
                         /* Didn't do anything this time */
                         return ret;
-                else if (bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[0])) {
-                        /* Fully written. Let's drop the entry from
-                         * the queue.
-                         *
-                         * This isn't particularly optimized, but
-                         * well, this is supposed to be our worst-case
-                         * buffer only, and the socket buffer is
-                         * supposed to be our primary buffer, and if
-                         * it got full, then all bets are off
-                         * anyway. */
-
-                        bus->wqueue_size--;
-                        bus_message_unref_queued(bus->wqueue[0], bus);
-                        memmove(bus->wqueue, bus->wqueue + 1, sizeof(sd_bus_message*) * bus->wqueue_size);
-                        bus->windex = 0;
+
+                /* Drop everything that got fully written from the queue */
+                for (n = 0; n < bus->wqueue_size && bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[n]); n++) {
+                        bus->windex -= BUS_MESSAGE_SIZE(bus->wqueue[n]);
+
+                        bus_log_sent_message(bus->wqueue[n]);
+                        bus_message_unref_queued(bus->wqueue[n], bus);
+                }
+
+                if (n > 0) {
+                        bus->wqueue_size -= n;
+                        memmove(bus->wqueue, bus->wqueue + n, sizeof(sd_bus_message*) * bus->wqueue_size);
 
                         ret = 1;
                 }
@@ -1894,6 +1941,12 @@ _public_ int sd_bus_send(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie) {
 
         assert_return(!bus_pid_changed(bus), -ECHILD);
 
+        /* Messages sent from a method handler running on a worker thread are queued, and are only sent by the
+         * bus thread once the handler returned */
+        r = bus_parallel_call_capture(bus, m, cookie);
+        if (r != 0)
+                return r;
+
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
@@ -1920,6 +1973,9 @@ _public_ int sd_bus_send(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie) {
         if (r < 0)
                 return r;
 
+        bus_statistics_call_sent(bus, m);
+        bus_statistics_reply_sent(bus, m);
+
         /* If this is a reply and no reply was requested, then let's
          * suppress this, if we can */
         if (m->dont_send)
@@ -1959,6 +2015,7 @@ _public_ int sd_bus_send(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie) {
                         return -ENOMEM;
 
                 bus->wqueue[bus->wqueue_size++] = bus_message_ref_queued(m, bus);
+                bus_statistics_queues(bus);
         }
 
 finish:
@@ -2043,6 +2100,10 @@ _public_ int sd_bus_call_async(
 
         assert_return(!bus_pid_changed(bus), -ECHILD);
 
+        /* Replies can only be waited for on the bus thread */
+        if (bus_parallel_call_current(bus))
+                return -EOPNOTSUPP;
+
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
@@ -2134,8 +2195,8 @@ _public_ int sd_bus_call(
                 sd_bus_message **reply) {
 
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = sd_bus_message_ref(_m);
+        uint64_t cookie = 0;
         usec_t timeout;
-        uint64_t cookie;
         size_t i;
         int r;
 
@@ -2149,6 +2210,11 @@ _public_ int sd_bus_call(
 
         bus_assert_return(!bus_pid_changed(bus), -ECHILD, error);
 
+        if (bus_parallel_call_current(bus)) {
+                r = -EOPNOTSUPP;
+                goto fail;
+        }
+
         if (!BUS_IS_OPEN(bus->state)) {
                 r = -ENOTCONN;
                 goto fail;
@@ -2269,6 +2335,9 @@ _public_ int sd_bus_call(
         }
 
 fail:
+        if (r == -ETIMEDOUT && cookie != 0)
+                bus_statistics_call_timed_out(bus, cookie);
+
         return sd_bus_error_set_errno(error, r);
 }
 
@@ -2431,6 +2500,8 @@ static int process_timeout(sd_bus *bus) {
         assert_se(prioq_pop(bus->reply_callbacks_prioq) == c);
         c->timeout_usec = 0;
 
+        bus_statistics_call_timed_out(bus, c->cookie);
+
         ordered_hashmap_remove(bus->reply_callbacks, &c->cookie);
         c->cookie = 0;
 
@@ -2686,6 +2757,46 @@ static int process_builtin(sd_bus *bus, sd_bus_message *m) {
         return 1;
 }
 
+static int process_statistics(sd_bus *bus, sd_bus_message *m) {
+        _cleanup_free_ char *text = NULL;
+        int r;
+
+        assert(bus);
+        assert(m);
+
+        if (!bus->statistics)
+                return 0;
+
+        if (m->header->type != SD_BUS_MESSAGE_METHOD_CALL)
+                return 0;
+
+        if (!streq_ptr(m->interface, BUS_STATISTICS_INTERFACE))
+                return 0;
+
+        if (m->header->flags & BUS_MESSAGE_NO_REPLY_EXPECTED)
+                return 1;
+
+        if (!streq_ptr(m->member, "GetStatistics"))
+                return sd_bus_reply_method_errorf(
+                                m,
+                                SD_BUS_ERROR_UNKNOWN_METHOD,
+                                "Unknown method '%s' on interface '%s'.", m->member, m->interface);
+
+        /* Method names and call patterns are nobody else's business, only tell privileged peers or peers
+         * running under our own UID */
+        r = sd_bus_query_sender_privilege(m, -1);
+        if (r < 0)
+                return sd_bus_reply_method_errno(m, r, NULL);
+        if (r == 0)
+                return sd_bus_reply_method_errorf(m, SD_BUS_ERROR_ACCESS_DENIED, "Access denied.");
+
+        r = bus_statistics_format(bus, &text);
+        if (r < 0)
+                return sd_bus_reply_method_errno(m, r, NULL);
+
+        return sd_bus_reply_method_return(m, "s", text);
+}
+
 static int process_fd_check(sd_bus *bus, sd_bus_message *m) {
         assert(bus);
         assert(m);
@@ -2723,6 +2834,8 @@ static int process_message(sd_bus *bus, sd_bus_message *m) {
 
         log_debug_bus_message(m);
 
+        bus_statistics_call_received(bus, m);
+
         r = process_hello(bus, m);
         if (r != 0)
                 goto finish;
@@ -2747,6 +2860,10 @@ static int process_message(sd_bus *bus, sd_bus_message *m) {
         if (r != 0)
                 goto finish;
 
+        r = process_statistics(bus, m);
+        if (r != 0)
+                goto finish;
+
         r = bus_process_object(bus, m);
 
 finish:
@@ -3670,26 +3787,50 @@ _public_ sd_event* sd_bus_get_event(sd_bus *bus) {
 }
 
 _public_ sd_bus_message* sd_bus_get_current_message(sd_bus *bus) {
+        struct bus_parallel_call *c;
+
         assert_return(bus, NULL);
 
+        c = bus_parallel_call_current(bus);
+        if (c)
+                return c->message;
+
         return bus->current_message;
 }
 
 _public_ sd_bus_slot* sd_bus_get_current_slot(sd_bus *bus) {
+        struct bus_parallel_call *c;
+
         assert_return(bus, NULL);
 
+        c = bus_parallel_call_current(bus);
+        if (c)
+                return c->slot;
+
         return bus->current_slot;
 }
 
 _public_ sd_bus_message_handler_t sd_bus_get_current_handler(sd_bus *bus) {
+        struct bus_parallel_call *c;
+
         assert_return(bus, NULL);
 
+        c = bus_parallel_call_current(bus);
+        if (c)
+                return c->handler;
+
         return bus->current_handler;
 }
 
 _public_ void* sd_bus_get_current_userdata(sd_bus *bus) {
+        struct bus_parallel_call *c;
+
         assert_return(bus, NULL);
 
+        c = bus_parallel_call_current(bus);
+        if (c)
+                return c->userdata;
+
         return bus->current_userdata;
 }
 
@@ -4194,3 +4335,35 @@ _public_ int sd_bus_get_close_on_exit(sd_bus *bus) {
 
         return bus->close_on_exit;
 }
+
+_public_ int sd_bus_set_statistics(sd_bus *bus, int b) {
+        assert_return(bus, -EINVAL);
+        assert_return(bus = bus_resolve(bus), -ENOPKG);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        if (!b) {
+                bus->statistics = bus_statistics_free(bus->statistics);
+                return 0;
+        }
+
+        if (bus->statistics)
+                return 0;
+
+        bus->statistics = new0(BusStatistics, 1);
+        if (!bus->statistics)
+                return -ENOMEM;
+
+        return 0;
+}
+
+_public_ int sd_bus_get_statistics(sd_bus *bus, char **ret) {
+        assert_return(bus, -EINVAL);
+        assert_return(bus = bus_resolve(bus), -ENOPKG);
+        assert_return(ret, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        if (!bus->statistics)
+                return -ENODATA;
+
+        return bus_statistics_format(bus, ret);
+}
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -175,19 +176,23 @@ static void client_chart(Type type, const char *address, const char *server_name
 
         switch (type) {
         case TYPE_LEGACY:
-                printf("SIZE\tLEGACY\n");
+                printf("SIZE\tLEGACY\tMALLOC\tPOOLED\n");
                 break;
         case TYPE_DIRECT:
-                printf("SIZE\tDIRECT\n");
+                printf("SIZE\tDIRECT\tMALLOC\tPOOLED\n");
                 break;
         }
 
         for (csize = 1; csize <= MAX_SIZE; csize *= 2) {
+                uint64_t hits, misses;
                 usec_t t;
                 unsigned n_memfd;
 
                 printf("%zu\t", csize);
 
+                hits = b->n_message_pool_hits;
+                misses = b->n_message_pool_misses;
+
                 t = now(CLOCK_MONOTONIC);
                 for (n_memfd = 0;; n_memfd++) {
                         transaction(b, csize, server_name);
@@ -195,7 +200,12 @@ static void client_chart(Type type, const char *address, const char *server_name
                                 break;
                 }
 
-                printf("%u\n", (unsigned) ((n_memfd * USEC_PER_SEC) / arg_loop_usec));
+                /* How many message objects and small buffers each round trip had to get from malloc(),
+                 * and how many it got from the connection's pool instead */
+                printf("%u\t%.2f\t%.2f\n",
+                       (unsigned) ((n_memfd * USEC_PER_SEC) / arg_loop_usec),
+                       (double) (b->n_message_pool_misses - misses) / (n_memfd + 1),
+                       (double) (b->n_message_pool_hits - hits) / (n_memfd + 1));
         }
 
         b->use_memfd = 1;
@@ -206,10 +216,79 @@ static void client_chart(Type type, const char *address, const char *server_name
         sd_bus_unref(b);
 }
 
+static void marshal_basic(sd_bus *b) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        const char *id, *load, *active;
+        uint32_t x, y;
+        uint64_t z;
+        int k;
+
+        assert_se(sd_bus_message_new_method_call(b, &m, "benchmark.server", "/", "benchmark.server", "Work") >= 0);
+        assert_se(sd_bus_message_append(m, "sssuutb", "foo.service", "loaded", "active", 4711U, 815U, UINT64_C(1234), true) >= 0);
+        assert_se(sd_bus_message_seal(m, 1, 0) >= 0);
+        assert_se(sd_bus_message_read(m, "sssuutb", &id, &load, &active, &x, &y, &z, &k) > 0);
+}
+
+static void marshal_structs(sd_bus *b) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        const char *id, *description, *load, *active, *sub, *following, *path, *type, *job_path;
+        uint32_t job;
+        unsigned i;
+        int r;
+
+        /* Modelled after the reply to ListUnits() */
+        assert_se(sd_bus_message_new_method_call(b, &m, "benchmark.server", "/", "benchmark.server", "Work") >= 0);
+        assert_se(sd_bus_message_open_container(m, 'a', "(ssssssouso)") >= 0);
+        for (i = 0; i < 20; i++)
+                assert_se(sd_bus_message_append(m, "(ssssssouso)",
+                                                "foo.service", "Foo Service", "loaded", "active", "running", "",
+                                                "/org/freedesktop/systemd1/unit/foo_2eservice",
+                                                0U, "", "/") >= 0);
+        assert_se(sd_bus_message_close_container(m) >= 0);
+        assert_se(sd_bus_message_seal(m, 1, 0) >= 0);
+
+        assert_se(sd_bus_message_enter_container(m, 'a', "(ssssssouso)") >= 0);
+        while ((r = sd_bus_message_read(m, "(ssssssouso)", &id, &description, &load, &active, &sub, &following, &path, &job, &type, &job_path)) > 0)
+                ;
+        assert_se(r == 0);
+        assert_se(sd_bus_message_exit_container(m) >= 0);
+}
+
+static void marshal_one(sd_bus *b, const char *name, void (*func)(sd_bus *b)) {
+        unsigned n = 0;
+        usec_t t, d;
+
+        t = now(CLOCK_MONOTONIC);
+        do {
+                func(b);
+                n++;
+                d = now(CLOCK_MONOTONIC) - t;
+        } while (d < arg_loop_usec);
+
+        printf("%s: %u messages, %.0f ns per message\n", name, n, (double) d * NSEC_PER_USEC / n);
+}
+
+static void marshal(void) {
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        _cleanup_(sd_bus_unrefp) sd_bus *b = NULL;
+
+        /* Builds messages and reads them back, without sending them anywhere */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(sd_bus_new(&b) >= 0);
+        assert_se(sd_bus_set_fd(b, pair[0], pair[0]) >= 0);
+        pair[0] = -1;
+        assert_se(sd_bus_start(b) >= 0);
+
+        marshal_one(b, "basic", marshal_basic);
+        marshal_one(b, "structs", marshal_structs);
+}
+
 int main(int argc, char *argv[]) {
         enum {
                 MODE_BISECT,
                 MODE_CHART,
+                MODE_MARSHAL,
         } mode = MODE_BISECT;
         Type type = TYPE_LEGACY;
         int i, pair[2] = { -1, -1 };
@@ -226,6 +305,9 @@ int main(int argc, char *argv[]) {
                 if (streq(argv[i], "chart")) {
                         mode = MODE_CHART;
                         continue;
+                } else if (streq(argv[i], "marshal")) {
+                        mode = MODE_MARSHAL;
+                        continue;
                 } else if (streq(argv[i], "legacy")) {
                         type = TYPE_LEGACY;
                         continue;
@@ -239,6 +321,11 @@ int main(int argc, char *argv[]) {
 
         assert_se(arg_loop_usec > 0);
 
+        if (mode == MODE_MARSHAL) {
+                marshal();
+                return 0;
+        }
+
         if (type == TYPE_LEGACY) {
                 const char *e;
 
@@ -301,6 +388,9 @@ int main(int argc, char *argv[]) {
                 case MODE_CHART:
                         client_chart(type, address, server_name, pair[1]);
                         break;
+
+                default:
+                        assert_not_reached("Unexpected mode");
                 }
 
                 _exit(EXIT_SUCCESS);
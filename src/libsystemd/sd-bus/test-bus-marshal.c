@@ -105,6 +105,25 @@ static void test_bus_label_escape(void) {
         test_bus_label_escape_one(":1", "_3a1");
 }
 
+static void test_append_partial(sd_bus *bus) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        const char *x, *y;
+        uint32_t u;
+
+        /* A failing append keeps what it appended before the failure, and nothing else */
+
+        assert_se(sd_bus_message_new_method_call(bus, &m, "foobar.waldo", "/", "foobar.waldo", "Piep") >= 0);
+        assert_se(sd_bus_message_append(m, "sv", "foo", NULL) == -EINVAL);
+        assert_se(sd_bus_message_append(m, "us", 4711U, "bar") >= 0);
+        assert_se(sd_bus_message_seal(m, 4712, 0) >= 0);
+
+        assert_se(streq(sd_bus_message_get_signature(m, true), "sus"));
+        assert_se(sd_bus_message_read(m, "sus", &x, &u, &y) > 0);
+        assert_se(streq(x, "foo"));
+        assert_se(u == 4711);
+        assert_se(streq(y, "bar"));
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *copy = NULL;
         int r, boolean;
@@ -413,6 +432,8 @@ int main(int argc, char *argv[]) {
         assert_se(streq(c, "ccc"));
         assert_se(streq(d, "3"));
 
+        test_append_partial(bus);
+
         test_bus_label_escape();
         test_bus_path_encode();
         test_bus_path_encode_unique();
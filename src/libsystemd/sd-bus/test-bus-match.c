@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include "alloc-util.h"
 #include "bus-match.h"
 #include "bus-message.h"
 #include "bus-slot.h"
@@ -7,7 +8,11 @@
 #include "log.h"
 #include "macro.h"
 #include "memory-util.h"
+#include "stdio-util.h"
 #include "tests.h"
+#include "time-util.h"
+
+#define N_BENCHMARK_RULES 10000U
 
 static bool mask[32];
 
@@ -59,6 +64,88 @@ static int match_add(sd_bus_slot *slots, struct bus_match_node *root, const char
         return r;
 }
 
+static unsigned n_benchmark_hits;
+
+static int benchmark_filter(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        n_benchmark_hits++;
+        return 0;
+}
+
+static void test_benchmark(sd_bus *bus) {
+        struct bus_match_node root = {
+                .type = BUS_MATCH_ROOT,
+        };
+        _cleanup_free_ sd_bus_slot *slots = NULL;
+        char b[FORMAT_TIMESPAN_MAX];
+        unsigned i, n;
+        usec_t ts;
+
+        /* Lots of rules of the kinds that used to be tested one by one: every message should only be tested
+         * against the few rules that may actually match it. */
+
+        slots = new(sd_bus_slot, N_BENCHMARK_RULES);
+        assert_se(slots);
+
+        for (i = 0; i < N_BENCHMARK_RULES; i++) {
+                char match[STRLEN("type='signal',interface='org.example.I',member='Changed'") + DECIMAL_STR_MAX(unsigned)];
+
+                switch (i % 4) {
+
+                case 0:
+                        xsprintf(match, "type='signal',interface='org.example.I%u',member='Changed'", i / 4);
+                        break;
+
+                case 1:
+                        xsprintf(match, "path_namespace='/org/example/%u'", i / 4);
+                        break;
+
+                case 2:
+                        xsprintf(match, "arg0namespace='org.example.N%u'", i / 4);
+                        break;
+
+                case 3:
+                        xsprintf(match, "arg1path='/org/example/p%u/'", i / 4);
+                        break;
+                }
+
+                assert_se(match_add(slots, &root, match, i) >= 0);
+                slots[i].match_callback.callback = benchmark_filter;
+        }
+
+        n = slow_tests_enabled() ? 100000 : 10000;
+        n_benchmark_hits = 0;
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                char path[STRLEN("/org/example//sub") + DECIMAL_STR_MAX(unsigned)],
+                        interface[STRLEN("org.example.I") + DECIMAL_STR_MAX(unsigned)],
+                        arg0[STRLEN("org.example.N.sub") + DECIMAL_STR_MAX(unsigned)],
+                        arg1[STRLEN("/org/example/p/sub") + DECIMAL_STR_MAX(unsigned)];
+                unsigned k = i % (N_BENCHMARK_RULES / 4);
+
+                xsprintf(path, "/org/example/%u/sub", k);
+                xsprintf(interface, "org.example.I%u", k);
+                xsprintf(arg0, "org.example.N%u.sub", k);
+                xsprintf(arg1, "/org/example/p%u/sub", k);
+
+                assert_se(sd_bus_message_new_signal(bus, &m, path, interface, "Changed") >= 0);
+                assert_se(sd_bus_message_append(m, "ss", arg0, arg1) >= 0);
+                assert_se(sd_bus_message_seal(m, 1, 0) >= 0);
+
+                assert_se(bus_match_run(NULL, &root, m) == 0);
+        }
+
+        log_info("Matching %u messages against %u rules: %s",
+                 n, N_BENCHMARK_RULES, format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - ts, 1));
+
+        /* Each message matches exactly one rule of each kind */
+        assert_se(n_benchmark_hits == n * 4);
+
+        bus_match_free(&root);
+}
+
 static void test_match_scope(const char *match, enum bus_match_scope scope) {
         struct bus_match_component *components = NULL;
         unsigned n_components = 0;
@@ -137,6 +224,8 @@ int main(int argc, char *argv[]) {
 
         bus_match_free(&root);
 
+        test_benchmark(bus);
+
         test_match_scope("interface='foobar'", BUS_MATCH_GENERIC);
         test_match_scope("", BUS_MATCH_GENERIC);
         test_match_scope("interface='org.freedesktop.DBus.Local'", BUS_MATCH_LOCAL);
@@ -2,6 +2,7 @@
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "sd-bus.h"
 
@@ -9,6 +10,7 @@
 #include "bus-dump.h"
 #include "bus-internal.h"
 #include "bus-message.h"
+#include "bus-objects.h"
 #include "bus-util.h"
 #include "log.h"
 #include "macro.h"
@@ -95,11 +97,16 @@ static int set_handler(sd_bus *bus, const char *path, const char *interface, con
         return 1;
 }
 
+static unsigned n_const_get = 0;
+
 static int value_handler(sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, void *userdata, sd_bus_error *error) {
         _cleanup_free_ char *s = NULL;
         const char *x;
         int r;
 
+        if (streq(property, "Value3"))
+                __atomic_add_fetch(&n_const_get, 1, __ATOMIC_SEQ_CST);
+
         assert_se(asprintf(&s, "object %p, path %s", userdata, path) >= 0);
         r = sd_bus_message_append(reply, "s", s);
         assert_se(r >= 0);
@@ -133,6 +140,27 @@ static int notify_test2(sd_bus_message *m, void *userdata, sd_bus_error *error)
         return 1;
 }
 
+static char *value5 = NULL;
+
+static int value5_handler(sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+        return sd_bus_message_append(reply, "s", strempty(value5));
+}
+
+static int notify_test3(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        const char *v;
+        int r;
+
+        assert_se(sd_bus_message_read(m, "s", &v) >= 0);
+        assert_se(free_and_strdup(&value5, v) >= 0);
+
+        assert_se(bus_emit_properties_changed_diff(sd_bus_message_get_bus(m), m->path, "org.freedesktop.systemd.ValueTest") >= 0);
+
+        r = sd_bus_reply_method_return(m, NULL);
+        assert_se(r >= 0);
+
+        return 1;
+}
+
 static int emit_interfaces_added(sd_bus_message *m, void *userdata, sd_bus_error *error) {
         int r;
 
@@ -177,6 +205,38 @@ static int emit_object_removed(sd_bus_message *m, void *userdata, sd_bus_error *
         return 1;
 }
 
+static int get_values(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **paths = NULL, **names = NULL;
+        char **p;
+        int r;
+
+        assert_se(sd_bus_message_read_strv(m, &paths) >= 0);
+        assert_se(sd_bus_message_read_strv(m, &names) >= 0);
+
+        assert_se(sd_bus_message_new_method_return(m, &reply) >= 0);
+        assert_se(sd_bus_message_open_container(reply, 'a', "(oa{sv})") >= 0);
+
+        STRV_FOREACH(p, paths) {
+                assert_se(sd_bus_message_open_container(reply, 'r', "oa{sv}") >= 0);
+                assert_se(sd_bus_message_append(reply, "o", *p) >= 0);
+                assert_se(sd_bus_message_open_container(reply, 'a', "{sv}") >= 0);
+
+                r = bus_append_object_properties(sd_bus_message_get_bus(m), reply, *p, names, error);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return sd_bus_error_setf(error, SD_BUS_ERROR_UNKNOWN_OBJECT, "Unknown object %s.", *p);
+
+                assert_se(sd_bus_message_close_container(reply) >= 0);
+                assert_se(sd_bus_message_close_container(reply) >= 0);
+        }
+
+        assert_se(sd_bus_message_close_container(reply) >= 0);
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static const sd_bus_vtable vtable[] = {
         SD_BUS_VTABLE_START(0),
         SD_BUS_METHOD("AlterSomething", "s", "s", something_handler, 0),
@@ -189,17 +249,20 @@ static const sd_bus_vtable vtable[] = {
         SD_BUS_METHOD("EmitInterfacesRemoved", NULL, NULL, emit_interfaces_removed, 0),
         SD_BUS_METHOD("EmitObjectAdded", NULL, NULL, emit_object_added, 0),
         SD_BUS_METHOD("EmitObjectRemoved", NULL, NULL, emit_object_removed, 0),
+        SD_BUS_METHOD("GetValues", "asas", "a(oa{sv})", get_values, 0),
         SD_BUS_VTABLE_END
 };
 
 static const sd_bus_vtable vtable2[] = {
-        SD_BUS_VTABLE_START(0),
+        SD_BUS_VTABLE_START(SD_BUS_VTABLE_CACHE_CONST),
         SD_BUS_METHOD("NotifyTest", "", "", notify_test, 0),
         SD_BUS_METHOD("NotifyTest2", "", "", notify_test2, 0),
+        SD_BUS_METHOD("NotifyTest3", "s", "", notify_test3, 0),
         SD_BUS_PROPERTY("Value", "s", value_handler, 10, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
         SD_BUS_PROPERTY("Value2", "s", value_handler, 10, SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION),
         SD_BUS_PROPERTY("Value3", "s", value_handler, 10, SD_BUS_VTABLE_PROPERTY_CONST),
         SD_BUS_PROPERTY("Value4", "s", value_handler, 10, 0),
+        SD_BUS_PROPERTY("Value5", "s", value5_handler, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
         SD_BUS_PROPERTY("AnExplicitProperty", "s", NULL, offsetof(struct context, something), SD_BUS_VTABLE_PROPERTY_EXPLICIT|SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION),
         SD_BUS_VTABLE_END
 };
@@ -233,6 +296,7 @@ static void *server(void *p) {
         assert_se(sd_bus_new(&bus) >= 0);
         assert_se(sd_bus_set_fd(bus, c->fds[0], c->fds[0]) >= 0);
         assert_se(sd_bus_set_server(bus, 1, id) >= 0);
+        assert_se(sd_bus_set_statistics(bus, true) >= 0);
 
         assert_se(sd_bus_add_object_vtable(bus, NULL, "/foo", "org.freedesktop.systemd.test", vtable, c) >= 0);
         assert_se(sd_bus_add_object_vtable(bus, NULL, "/foo", "org.freedesktop.systemd.test2", vtable, c) >= 0);
@@ -277,10 +341,150 @@ fail:
         return INT_TO_PTR(r);
 }
 
+static void get_all_values(sd_bus *bus, const char *path) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_free_ char *expected = NULL;
+        const char *name, *value;
+        unsigned n = 0;
+
+        assert_se(asprintf(&expected, "object %p, path %s", UINT_TO_PTR(30), path) >= 0);
+
+        assert_se(sd_bus_call_method(bus, "org.freedesktop.systemd.test", path, "org.freedesktop.DBus.Properties", "GetAll", &error, &reply, "s", "org.freedesktop.systemd.ValueTest") >= 0);
+
+        assert_se(sd_bus_message_enter_container(reply, 'a', "{sv}") > 0);
+        while (sd_bus_message_enter_container(reply, 'e', "sv") > 0) {
+                assert_se(sd_bus_message_read(reply, "s", &name) > 0);
+                assert_se(sd_bus_message_read(reply, "v", "s", &value) > 0);
+                assert_se(sd_bus_message_exit_container(reply) >= 0);
+
+                if (streq(name, "Value5"))
+                        continue;
+
+                assert_se(STR_IN_SET(name, "Value", "Value2", "Value3", "Value4"));
+                assert_se(streq(value, expected));
+                n++;
+        }
+        assert_se(sd_bus_message_exit_container(reply) >= 0);
+        assert_se(n == 4);
+}
+
+static void get_values_bulk(sd_bus *bus) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *reply = NULL;
+        const char *path, *name, *value;
+        unsigned n = 0, k;
+
+        assert_se(sd_bus_message_new_method_call(bus, &m, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "GetValues") >= 0);
+        assert_se(sd_bus_message_append_strv(m, STRV_MAKE("/value/a", "/value/b", "/value/a/x")) >= 0);
+        assert_se(sd_bus_message_append_strv(m, STRV_MAKE("Value", "Value3", "NoSuchValue")) >= 0);
+        assert_se(sd_bus_call(bus, m, 0, &error, &reply) >= 0);
+
+        assert_se(sd_bus_message_enter_container(reply, 'a', "(oa{sv})") > 0);
+        while (sd_bus_message_enter_container(reply, 'r', "oa{sv}") > 0) {
+                _cleanup_free_ char *expected = NULL;
+
+                assert_se(sd_bus_message_read(reply, "o", &path) > 0);
+                assert_se(asprintf(&expected, "object %p, path %s", UINT_TO_PTR(30), path) >= 0);
+
+                k = 0;
+                assert_se(sd_bus_message_enter_container(reply, 'a', "{sv}") > 0);
+                while (sd_bus_message_enter_container(reply, 'e', "sv") > 0) {
+                        assert_se(sd_bus_message_read(reply, "s", &name) > 0);
+                        assert_se(sd_bus_message_read(reply, "v", "s", &value) > 0);
+                        assert_se(sd_bus_message_exit_container(reply) >= 0);
+
+                        assert_se(STR_IN_SET(name, "Value", "Value3"));
+                        assert_se(streq(value, expected));
+                        k++;
+                }
+                assert_se(sd_bus_message_exit_container(reply) >= 0);
+                assert_se(sd_bus_message_exit_container(reply) >= 0);
+
+                assert_se(k == 2);
+                n++;
+        }
+        assert_se(sd_bus_message_exit_container(reply) >= 0);
+        assert_se(n == 3);
+
+        m = sd_bus_message_unref(m);
+        reply = sd_bus_message_unref(reply);
+
+        assert_se(sd_bus_message_new_method_call(bus, &m, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "GetValues") >= 0);
+        assert_se(sd_bus_message_append_strv(m, STRV_MAKE("/value/b", "/nothing/here")) >= 0);
+        assert_se(sd_bus_message_append_strv(m, NULL) >= 0);
+        assert_se(sd_bus_call(bus, m, 0, &error, &reply) < 0);
+        assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_OBJECT));
+}
+
+static void notify_and_check(sd_bus *bus, const char *value, char **changed, char **invalidated) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        _cleanup_strv_free_ char **names = NULL, **l = NULL;
+        const char *name;
+
+        assert_se(sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/value/b", "org.freedesktop.systemd.ValueTest", "NotifyTest3", &error, NULL, "s", value) >= 0);
+
+        assert_se(sd_bus_process(bus, &m) > 0);
+        assert_se(sd_bus_message_is_signal(m, "org.freedesktop.DBus.Properties", "PropertiesChanged"));
+
+        assert_se(sd_bus_message_skip(m, "s") >= 0);
+        assert_se(sd_bus_message_enter_container(m, 'a', "{sv}") > 0);
+        while (sd_bus_message_enter_container(m, 'e', "sv") > 0) {
+                assert_se(sd_bus_message_read(m, "s", &name) > 0);
+                assert_se(sd_bus_message_skip(m, "v") >= 0);
+                assert_se(sd_bus_message_exit_container(m) >= 0);
+
+                assert_se(strv_extend(&names, name) >= 0);
+        }
+        assert_se(sd_bus_message_exit_container(m) >= 0);
+        assert_se(sd_bus_message_read_strv(m, &l) >= 0);
+
+        assert_se(strv_equal(names, changed));
+        assert_se(strv_equal(l, invalidated));
+}
+
+static int ignore_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        return 0;
+}
+
+static void check_statistics(sd_bus *bus) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL, *m = NULL;
+        _cleanup_free_ char *local = NULL, *pending = NULL;
+        const char *remote;
+
+        /* A call is forgotten once its own timeout passed, not the connection's. Nothing is read in
+         * between, so the first call is still waiting for its reply when the second one goes out. */
+        assert_se(sd_bus_message_new_method_call(bus, &m, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "NoOperation") >= 0);
+        assert_se(sd_bus_call_async(bus, NULL, m, ignore_reply, NULL, 1) >= 0);
+        m = sd_bus_message_unref(m);
+        (void) usleep(10 * USEC_PER_MSEC);
+        assert_se(sd_bus_message_new_method_call(bus, &m, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "NoOperation") >= 0);
+        assert_se(sd_bus_call_async(bus, NULL, m, ignore_reply, NULL, 0) >= 0);
+        assert_se(sd_bus_get_statistics(bus, &pending) >= 0);
+        assert_se(strstr(pending, "Calls waiting for a reply: 1\n"));
+
+        /* What we called... */
+        assert_se(sd_bus_get_statistics(bus, &local) >= 0);
+        fputs(local, stdout);
+        assert_se(strstr(local, "out org.freedesktop.systemd.test"));
+        assert_se(strstr(local, "AlterSomething"));
+
+        /* ... and what the server saw, queried over the bus */
+        assert_se(sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/", BUS_STATISTICS_INTERFACE, "GetStatistics", &error, &reply, NULL) >= 0);
+        assert_se(sd_bus_message_read(reply, "s", &remote) >= 0);
+        fputs(remote, stdout);
+        assert_se(strstr(remote, "in  org.freedesktop.systemd.test"));
+        assert_se(strstr(remote, "Doesntexist"));
+        assert_se(strstr(remote, "GetStatistics"));
+}
+
 static int client(struct context *c) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
         _cleanup_(sd_bus_unrefp) sd_bus *bus = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ char *t = NULL;
         const char *s;
         int r;
 
@@ -288,6 +492,9 @@ static int client(struct context *c) {
         assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
+        assert_se(sd_bus_get_statistics(bus, &t) == -ENODATA);
+        assert_se(sd_bus_set_statistics(bus, true) >= 0);
+
         r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "NoOperation", &error, NULL, NULL);
         assert_se(r >= 0);
 
@@ -409,6 +616,35 @@ static int client(struct context *c) {
         assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_INTERFACE));
         sd_bus_error_free(&error);
 
+        /* Const properties are looked up once per object, until the object is announced to have changed */
+        n_const_get = 0;
+        get_all_values(bus, "/value/b");
+        get_all_values(bus, "/value/b");
+        get_all_values(bus, "/value/c");
+        get_all_values(bus, "/value/b");
+        assert_se(n_const_get == 2);
+
+        r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/value/b", "org.freedesktop.systemd.ValueTest", "NotifyTest2", &error, NULL, "");
+        assert_se(r >= 0);
+
+        r = sd_bus_process(bus, &reply);
+        assert_se(r > 0);
+        assert_se(sd_bus_message_is_signal(reply, "org.freedesktop.DBus.Properties", "PropertiesChanged"));
+        reply = sd_bus_message_unref(reply);
+
+        get_all_values(bus, "/value/b");
+        get_all_values(bus, "/value/c");
+        assert_se(n_const_get == 3);
+
+        /* Properties of several objects can be put into a single reply, optionally limited to some names */
+        get_values_bulk(bus);
+
+        /* Only what changed since the last signal is sent, if so requested. Invalidated and explicit
+         * properties are always listed, since we never look at them. */
+        notify_and_check(bus, "a", STRV_MAKE("Value", "Value5"), STRV_MAKE("Value2", "AnExplicitProperty"));
+        notify_and_check(bus, "a", NULL, STRV_MAKE("Value2", "AnExplicitProperty"));
+        notify_and_check(bus, "b", STRV_MAKE("Value5"), STRV_MAKE("Value2", "AnExplicitProperty"));
+
         r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", &error, &reply, "");
         assert_se(r < 0);
         assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD));
@@ -494,6 +730,8 @@ static int client(struct context *c) {
         sd_bus_message_unref(reply);
         reply = NULL;
 
+        check_statistics(bus);
+
         r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "Exit", &error, NULL, "");
         assert_se(r >= 0);
 
@@ -531,6 +769,7 @@ int main(int argc, char *argv[]) {
 
         free(c.something);
         free(c.automatic_string_property);
+        free(value5);
 
         return EXIT_SUCCESS;
 }
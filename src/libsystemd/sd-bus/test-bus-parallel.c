@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "sd-bus.h"
+#include "sd-event.h"
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "log.h"
+#include "macro.h"
+#include "tests.h"
+#include "time-util.h"
+
+#define N_CLIENTS 8U
+#define N_CALLS 1000U
+#define N_RENDEZVOUS 4U
+
+#define INTERFACE "org.freedesktop.systemd.test"
+
+struct server {
+        sd_event *event;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        unsigned n_inside;
+
+        unsigned n_quit;
+};
+
+struct call {
+        struct client *client;
+        uint64_t x;
+        bool got_signal;
+        bool got_reply;
+};
+
+struct client {
+        int fd;
+        unsigned index;
+
+        struct call calls[N_CALLS];
+        unsigned n_replies, n_errors, n_signals, n_pings;
+        uint64_t last_cookie;
+
+        bool rendezvous;
+        int call_result;
+};
+
+static int method_echo(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        sd_bus *bus = sd_bus_message_get_bus(m);
+        uint64_t x;
+        int r;
+
+        /* Other methods are processed on the bus thread meanwhile, but what we see is still about our call */
+        assert_se(sd_bus_get_current_message(bus) == m);
+        assert_se(sd_bus_get_current_userdata(bus) == userdata);
+        assert_se(sd_bus_get_current_handler(bus) == method_echo);
+
+        r = sd_bus_message_read(m, "t", &x);
+        if (r < 0)
+                return r;
+
+        if (x % 7 == 0) {
+                r = sd_bus_emit_signal(bus, "/foo", INTERFACE, "Echoing", "t", x);
+                if (r < 0)
+                        return r;
+        }
+
+        if (x % 13 == 0)
+                return sd_bus_error_setf(error, SD_BUS_ERROR_FAILED, "Unlucky number %" PRIu64 ".", x);
+
+        return sd_bus_reply_method_return(m, "t", x * 2);
+}
+
+static int method_rendezvous(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        struct server *s = userdata;
+        struct timespec ts;
+        bool met;
+
+        /* Wait until all callers are in here at the same time, which can only work if they are run in
+         * parallel */
+
+        timespec_store(&ts, now(CLOCK_REALTIME) + 20 * USEC_PER_SEC);
+
+        assert_se(pthread_mutex_lock(&s->mutex) == 0);
+
+        s->n_inside++;
+        assert_se(pthread_cond_broadcast(&s->cond) == 0);
+
+        while (s->n_inside < N_RENDEZVOUS)
+                if (pthread_cond_timedwait(&s->cond, &s->mutex, &ts) == ETIMEDOUT)
+                        break;
+
+        met = s->n_inside >= N_RENDEZVOUS;
+
+        assert_se(pthread_mutex_unlock(&s->mutex) == 0);
+
+        return sd_bus_reply_method_return(m, "b", met);
+}
+
+static int method_call_out(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        sd_bus *bus = sd_bus_message_get_bus(m);
+        int r;
+
+        /* Neither is walking the object tree */
+        assert_se(sd_bus_emit_properties_changed(bus, "/foo", INTERFACE, "Foo", NULL) == -EPERM);
+        assert_se(sd_bus_emit_object_added(bus, "/foo") == -EPERM);
+
+        /* Waiting for replies is the bus thread's business, this has to be refused */
+        r = sd_bus_call_method(bus, NULL, "/foo", INTERFACE, "Ping", NULL, NULL, NULL);
+
+        return sd_bus_reply_method_return(m, "i", r);
+}
+
+static int method_ping(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_quit(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        struct server *s = userdata;
+
+        if (++s->n_quit >= N_CLIENTS)
+                assert_se(sd_event_exit(s->event, 0) >= 0);
+
+        return sd_bus_reply_method_return(m, NULL);
+}
+
+static const sd_bus_vtable vtable[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_METHOD("Echo", "t", "t", method_echo, SD_BUS_VTABLE_UNPRIVILEGED|SD_BUS_VTABLE_METHOD_PARALLEL),
+        SD_BUS_METHOD("Rendezvous", NULL, "b", method_rendezvous, SD_BUS_VTABLE_UNPRIVILEGED|SD_BUS_VTABLE_METHOD_PARALLEL),
+        SD_BUS_METHOD("CallOut", NULL, "i", method_call_out, SD_BUS_VTABLE_UNPRIVILEGED|SD_BUS_VTABLE_METHOD_PARALLEL),
+        SD_BUS_METHOD("Ping", NULL, NULL, method_ping, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("Quit", NULL, NULL, method_quit, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_SIGNAL("Echoing", "t", 0),
+        SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable vtable_bad[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_SIGNAL("Echoing", "t", SD_BUS_VTABLE_METHOD_PARALLEL),
+        SD_BUS_VTABLE_END
+};
+
+static void check_cookie(struct client *c, sd_bus_message *m) {
+        uint64_t cookie;
+
+        /* Replies are sealed on the bus thread only, hence the serials we see must be strictly increasing, no
+         * matter in which order the handlers finished */
+        assert_se(sd_bus_message_get_cookie(m, &cookie) >= 0);
+        assert_se(cookie > c->last_cookie);
+        c->last_cookie = cookie;
+}
+
+static int echo_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        struct call *call = userdata;
+        struct client *c = call->client;
+        uint64_t y;
+
+        check_cookie(c, m);
+
+        assert_se(!call->got_reply);
+        call->got_reply = true;
+
+        /* Signals the handler emitted are sent before its reply */
+        assert_se(call->got_signal == (call->x % 7 == 0));
+
+        if (call->x % 13 == 0) {
+                assert_se(sd_bus_message_is_method_error(m, SD_BUS_ERROR_FAILED));
+                c->n_errors++;
+        } else {
+                assert_se(sd_bus_message_read(m, "t", &y) >= 0);
+                assert_se(y == call->x * 2);
+        }
+
+        c->n_replies++;
+        return 0;
+}
+
+static int ping_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        struct client *c = userdata;
+
+        check_cookie(c, m);
+        assert_se(!sd_bus_message_is_method_error(m, NULL));
+
+        c->n_pings++;
+        return 0;
+}
+
+static int rendezvous_reply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        struct client *c = userdata;
+        int b;
+
+        check_cookie(c, m);
+        assert_se(sd_bus_message_read(m, "b", &b) >= 0);
+
+        c->rendezvous = b;
+        return 0;
+}
+
+static int echoing(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        struct client *c = userdata;
+        uint64_t x;
+
+        check_cookie(c, m);
+        assert_se(sd_bus_message_read(m, "t", &x) >= 0);
+        assert_se(x < N_CALLS);
+        assert_se(x % 7 == 0);
+
+        assert_se(!c->calls[x].got_signal);
+        assert_se(!c->calls[x].got_reply);
+        c->calls[x].got_signal = true;
+
+        c->n_signals++;
+        return 0;
+}
+
+static void *client(void *p) {
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        struct client *c = p;
+        unsigned i, n_pings = 0;
+        int32_t result;
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c->fd, c->fd) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        assert_se(sd_bus_match_signal(bus, NULL, NULL, "/foo", INTERFACE, "Echoing", echoing, c) >= 0);
+
+        if (c->index < N_RENDEZVOUS)
+                assert_se(sd_bus_call_method_async(bus, NULL, NULL, "/foo", INTERFACE, "Rendezvous", rendezvous_reply, c, NULL) >= 0);
+
+        /* Fire off everything at once, and mix in methods processed on the bus thread */
+        for (i = 0; i < N_CALLS; i++) {
+                c->calls[i] = (struct call) {
+                        .client = c,
+                        .x = i,
+                };
+
+                assert_se(sd_bus_call_method_async(bus, NULL, NULL, "/foo", INTERFACE, "Echo", echo_reply, c->calls + i, "t", (uint64_t) i) >= 0);
+
+                if (i % 10 == 0) {
+                        assert_se(sd_bus_call_method_async(bus, NULL, NULL, "/foo", INTERFACE, "Ping", ping_reply, c, NULL) >= 0);
+                        n_pings++;
+                }
+        }
+
+        while (c->n_replies < N_CALLS || c->n_pings < n_pings || (c->index < N_RENDEZVOUS && !c->rendezvous)) {
+                int r;
+
+                r = sd_bus_process(bus, NULL);
+                assert_se(r >= 0);
+                if (r == 0)
+                        assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+        }
+
+        assert_se(c->n_errors == DIV_ROUND_UP(N_CALLS, 13));
+        assert_se(c->n_signals == DIV_ROUND_UP(N_CALLS, 7));
+
+        if (c->index == 0) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+
+                assert_se(sd_bus_call_method(bus, NULL, "/foo", INTERFACE, "CallOut", NULL, &reply, NULL) >= 0);
+                assert_se(sd_bus_message_read(reply, "i", &result) >= 0);
+                c->call_result = result;
+        }
+
+        assert_se(sd_bus_call_method(bus, NULL, "/foo", INTERFACE, "Quit", NULL, NULL, NULL) >= 0);
+
+        return NULL;
+}
+
+int main(int argc, char *argv[]) {
+        struct server s = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .cond = PTHREAD_COND_INITIALIZER,
+        };
+        _cleanup_free_ struct client *clients = NULL;
+        sd_bus *buses[N_CLIENTS] = {};
+        pthread_t threads[N_CLIENTS];
+        usec_t t;
+        unsigned i;
+
+        test_setup_logging(LOG_INFO);
+
+        clients = new0(struct client, N_CLIENTS);
+        assert_se(clients);
+
+        assert_se(sd_event_new(&s.event) >= 0);
+        assert_se(sd_event_set_work_threads_max(s.event, N_RENDEZVOUS) >= 0);
+
+        for (i = 0; i < N_CLIENTS; i++) {
+                int fds[2];
+                sd_id128_t id;
+
+                assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) >= 0);
+                assert_se(sd_id128_randomize(&id) >= 0);
+
+                assert_se(sd_bus_new(buses + i) >= 0);
+                assert_se(sd_bus_set_fd(buses[i], fds[0], fds[0]) >= 0);
+                assert_se(sd_bus_set_server(buses[i], 1, id) >= 0);
+                assert_se(sd_bus_start(buses[i]) >= 0);
+                assert_se(sd_bus_attach_event(buses[i], s.event, SD_EVENT_PRIORITY_NORMAL) >= 0);
+
+                assert_se(sd_bus_add_object_vtable(buses[i], NULL, "/foo", INTERFACE, vtable, &s) >= 0);
+
+                clients[i].fd = fds[1];
+                clients[i].index = i;
+        }
+
+        /* Only methods may be run in parallel */
+        assert_se(sd_bus_add_object_vtable(buses[0], NULL, "/bar", INTERFACE, vtable_bad, &s) == -EINVAL);
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < N_CLIENTS; i++)
+                assert_se(pthread_create(threads + i, NULL, client, clients + i) == 0);
+
+        assert_se(sd_event_loop(s.event) >= 0);
+
+        for (i = 0; i < N_CLIENTS; i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
+
+        log_info("%u clients with %u calls each done in %s.",
+                 N_CLIENTS, N_CALLS, format_timespan((char[FORMAT_TIMESPAN_MAX]) {}, FORMAT_TIMESPAN_MAX, now(CLOCK_MONOTONIC) - t, USEC_PER_MSEC));
+
+        for (i = 0; i < N_RENDEZVOUS; i++)
+                assert_se(clients[i].rendezvous);
+
+        assert_se(clients[0].call_result == -EOPNOTSUPP);
+
+        for (i = 0; i < N_CLIENTS; i++)
+                sd_bus_flush_close_unref(buses[i]);
+
+        sd_event_unref(s.event);
+
+        return 0;
+}
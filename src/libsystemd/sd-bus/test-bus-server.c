@@ -1,19 +1,30 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "sd-bus.h"
 
 #include "bus-internal.h"
+#include "bus-message.h"
 #include "bus-util.h"
+#include "fd-util.h"
+#include "io-util.h"
 #include "log.h"
 #include "macro.h"
 #include "memory-util.h"
 
+#define N_BURST 64U
+#define ECHO_SIZE (1024U*1024U)
+
 struct context {
         int fds[2];
 
+        unsigned n_burst;
+
         bool client_negotiate_unix_fds;
         bool server_negotiate_unix_fds;
 
@@ -66,6 +77,9 @@ static void *server(void *p) {
                         assert_se((sd_bus_can_send(bus, 'h') >= 1) ==
                                   (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
 
+                        /* Two more if the glued and the undeclared writes went out */
+                        assert_se(c->n_burst == N_BURST + 2 * (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
+
                         r = sd_bus_message_new_method_return(m, &reply);
                         if (r < 0) {
                                 log_error_errno(r, "Failed to allocate return: %m");
@@ -74,6 +88,52 @@ static void *server(void *p) {
 
                         quit = true;
 
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Echo")) {
+                        const void *data;
+                        size_t size;
+
+                        r = sd_bus_message_read_array(m, 'y', &data, &size);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to read array: %m");
+                                goto fail;
+                        }
+
+                        r = sd_bus_message_new_method_return(m, &reply);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to allocate return: %m");
+                                goto fail;
+                        }
+
+                        r = sd_bus_message_append_array(reply, 'y', data, size);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to append array: %m");
+                                goto fail;
+                        }
+
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Burst")) {
+                        uint32_t i, j;
+                        int fd;
+
+                        r = sd_bus_message_read(m, "u", &i);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to read index: %m");
+                                goto fail;
+                        }
+
+                        /* Make sure we got them in order, and each fd with the message it was sent with */
+                        assert_se(i == c->n_burst++);
+
+                        if (sd_bus_message_has_signature(m, "uh")) {
+                                r = sd_bus_message_read(m, "h", &fd);
+                                if (r < 0) {
+                                        log_error_errno(r, "Failed to read fd: %m");
+                                        goto fail;
+                                }
+
+                                assert_se(read(fd, &j, sizeof(j)) == sizeof(j));
+                                assert_se(j == i);
+                        }
+
                 } else if (sd_bus_message_is_method_call(m, NULL, NULL)) {
                         r = sd_bus_message_new_method_error(
                                         m,
@@ -105,6 +165,228 @@ fail:
         return INT_TO_PTR(r);
 }
 
+static int client_burst(struct context *c, sd_bus *bus) {
+        uint32_t i;
+        int r;
+
+        /* Queue up a bunch of calls while the connection is still being set up, so that they go out in as few
+         * writes as possible, and are read in as few reads. Every few carry an fd. */
+
+        for (i = 0; i < N_BURST; i++) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                _cleanup_close_pair_ int pipe_fds[2] = { -1, -1 };
+
+                r = sd_bus_message_new_method_call(
+                                bus,
+                                &m,
+                                "org.freedesktop.systemd.test",
+                                "/",
+                                "org.freedesktop.systemd.test",
+                                "Burst");
+                if (r < 0)
+                        return log_error_errno(r, "Failed to allocate method call: %m");
+
+                r = sd_bus_message_append(m, "u", i);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to append index: %m");
+
+                if (c->client_negotiate_unix_fds && c->server_negotiate_unix_fds && i % 8 == 7) {
+                        assert_se(pipe2(pipe_fds, O_CLOEXEC) >= 0);
+                        assert_se(write(pipe_fds[1], &i, sizeof(i)) == sizeof(i));
+
+                        r = sd_bus_message_append(m, "h", pipe_fds[0]);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to append fd: %m");
+                }
+
+                r = sd_bus_send(bus, m, NULL);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to send message: %m");
+        }
+
+        return 0;
+}
+
+static int client_echo(sd_bus *bus) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *reply = NULL;
+        _cleanup_free_ uint8_t *buf = NULL;
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        const void *data;
+        size_t size, i;
+        int r;
+
+        size = ECHO_SIZE;
+        buf = malloc(size);
+        assert_se(buf);
+        for (i = 0; i < size; i++)
+                buf[i] = (uint8_t) (i * 7);
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        &m,
+                        "org.freedesktop.systemd.test",
+                        "/",
+                        "org.freedesktop.systemd.test",
+                        "Echo");
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate method call: %m");
+
+        r = sd_bus_message_append_array(m, 'y', buf, size);
+        if (r < 0)
+                return log_error_errno(r, "Failed to append array: %m");
+
+        r = sd_bus_call(bus, m, 0, &error, &reply);
+        if (r < 0)
+                return log_error_errno(r, "Failed to issue method call: %s", bus_error_message(&error, -r));
+
+        r = sd_bus_message_read_array(reply, 'y', &data, &size);
+        if (r < 0)
+                return log_error_errno(r, "Failed to read array: %m");
+
+        assert_se(size == ECHO_SIZE);
+        assert_se(memcmp(data, buf, size) == 0);
+
+        return 0;
+}
+
+static int client_make_blob(sd_bus *bus, const char *path, uint32_t i, int fd, uint64_t cookie, void **ret, size_t *ret_size) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        int r;
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        &m,
+                        "org.freedesktop.systemd.test",
+                        path,
+                        "org.freedesktop.systemd.test",
+                        "Burst");
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate method call: %m");
+
+        if (fd >= 0)
+                r = sd_bus_message_append(m, "uh", i, fd);
+        else
+                r = sd_bus_message_append(m, "u", i);
+        if (r < 0)
+                return log_error_errno(r, "Failed to append arguments: %m");
+
+        r = sd_bus_message_seal(m, cookie, 0);
+        if (r < 0)
+                return log_error_errno(r, "Failed to seal message: %m");
+
+        r = bus_message_get_blob(m, ret, ret_size);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get message blob: %m");
+
+        return 0;
+}
+
+static int client_glued(struct context *c, sd_bus *bus) {
+        _cleanup_close_pair_ int pipe_fds[2] = { -1, -1 };
+        _cleanup_free_ void *a = NULL, *b = NULL;
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int) * 2)];
+        } control = {};
+        struct iovec iov[2];
+        struct msghdr mh = {
+                .msg_iov = iov,
+                .msg_iovlen = ELEMENTSOF(iov),
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+        size_t a_size, b_size;
+        uint32_t i = N_BURST;
+        int r;
+
+        /* sd-bus never sends the fds of two messages with a single write, but other implementations
+         * might. Send an invalid message and a valid one in one go, each carrying an fd. Dropping the
+         * invalid message must only close its own fd, and leave the valid one's alone. */
+
+        if (!c->client_negotiate_unix_fds || !c->server_negotiate_unix_fds)
+                return 0;
+
+        assert_se(pipe2(pipe_fds, O_CLOEXEC) >= 0);
+        assert_se(write(pipe_fds[1], &i, sizeof(i)) == sizeof(i));
+
+        r = client_make_blob(bus, "/org/freedesktop/DBus/Local", i, pipe_fds[0], 0xf000, &a, &a_size);
+        if (r < 0)
+                return r;
+
+        r = client_make_blob(bus, "/", i, pipe_fds[0], 0xf001, &b, &b_size);
+        if (r < 0)
+                return r;
+
+        iov[0] = IOVEC_MAKE(a, a_size);
+        iov[1] = IOVEC_MAKE(b, b_size);
+
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 2);
+        ((int*) CMSG_DATA(cmsg))[0] = pipe_fds[0];
+        ((int*) CMSG_DATA(cmsg))[1] = pipe_fds[0];
+
+        assert_se(sendmsg(c->fds[1], &mh, MSG_NOSIGNAL) == (ssize_t) (a_size + b_size));
+
+        return 0;
+}
+
+static void client_send_with_fd(struct context *c, const void *p, size_t size, int fd) {
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int))];
+        } control = {};
+        struct iovec iov = IOVEC_MAKE((void*) p, size);
+        struct msghdr mh = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        *(int*) CMSG_DATA(cmsg) = fd;
+
+        assert_se(sendmsg(c->fds[1], &mh, MSG_NOSIGNAL) == (ssize_t) size);
+}
+
+static int client_undeclared(struct context *c, sd_bus *bus) {
+        _cleanup_close_pair_ int pipe_fds[2] = { -1, -1 };
+        _cleanup_free_ void *a = NULL, *b = NULL;
+        size_t a_size, b_size;
+        uint32_t i = N_BURST + 1;
+        int r;
+
+        /* A message that comes with an fd it doesn't declare is dropped, and its fd must not be handed to
+         * the next message that declares one. Send the write end of the pipe with the first one: the
+         * server can't read from it if it ends up with the second one. */
+
+        if (!c->client_negotiate_unix_fds || !c->server_negotiate_unix_fds)
+                return 0;
+
+        assert_se(pipe2(pipe_fds, O_CLOEXEC) >= 0);
+        assert_se(write(pipe_fds[1], &i, sizeof(i)) == sizeof(i));
+
+        r = client_make_blob(bus, "/", i, -1, 0xf002, &a, &a_size);
+        if (r < 0)
+                return r;
+
+        r = client_make_blob(bus, "/", i, pipe_fds[0], 0xf003, &b, &b_size);
+        if (r < 0)
+                return r;
+
+        client_send_with_fd(c, a, a_size, pipe_fds[1]);
+        client_send_with_fd(c, b, b_size, pipe_fds[0]);
+
+        return 0;
+}
+
 static int client(struct context *c) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *reply = NULL;
         _cleanup_(sd_bus_unrefp) sd_bus *bus = NULL;
@@ -117,6 +399,22 @@ static int client(struct context *c) {
         assert_se(sd_bus_set_anonymous(bus, c->client_anonymous_auth) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
+        r = client_burst(c, bus);
+        if (r < 0)
+                return r;
+
+        r = client_echo(bus);
+        if (r < 0)
+                return r;
+
+        r = client_glued(c, bus);
+        if (r < 0)
+                return r;
+
+        r = client_undeclared(c, bus);
+        if (r < 0)
+                return r;
+
         r = sd_bus_message_new_method_call(
                         bus,
                         &m,
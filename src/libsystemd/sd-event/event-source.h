@@ -7,10 +7,12 @@
 
 #include "sd-event.h"
 
+#include "event-work.h"
 #include "fs-util.h"
 #include "hashmap.h"
 #include "list.h"
 #include "prioq.h"
+#include "ratelimit.h"
 
 typedef enum EventSourceType {
         SOURCE_IO,
@@ -26,6 +28,7 @@ typedef enum EventSourceType {
         SOURCE_EXIT,
         SOURCE_WATCHDOG,
         SOURCE_INOTIFY,
+        SOURCE_WORK,
         _SOURCE_EVENT_SOURCE_TYPE_MAX,
         _SOURCE_EVENT_SOURCE_TYPE_INVALID = -1
 } EventSourceType;
@@ -38,6 +41,7 @@ typedef enum WakeupType {
         WAKEUP_CLOCK_DATA,
         WAKEUP_SIGNAL_DATA,
         WAKEUP_INOTIFY_DATA,
+        WAKEUP_WORK_DATA,
         _WAKEUP_TYPE_MAX,
         _WAKEUP_TYPE_INVALID = -1,
 } WakeupType;
@@ -60,12 +64,25 @@ struct sd_event_source {
         bool pending:1;
         bool dispatching:1;
         bool floating:1;
+        bool ratelimited:1;
 
         int64_t priority;
         unsigned pending_index;
         unsigned prepare_index;
         uint64_t pending_iteration;
         uint64_t prepare_iteration;
+        uint64_t dispatch_iteration;
+
+        /* If the source is dispatched more often than allowed by this, it is taken offline until the
+         * interval ends. While that's the case it is queued in the event loop's ratelimited prioq. */
+        RateLimit rate_limit;
+        unsigned ratelimit_index;
+        sd_event_handler_t ratelimit_callback;
+
+        /* Accounting, only maintained while enabled with sd_event_set_statistics() */
+        usec_t pending_timestamp;
+        uint64_t n_dispatched;
+        usec_t dispatch_usec, dispatch_usec_max, pending_usec;
 
         sd_event_destroy_t destroy_callback;
 
@@ -96,6 +113,8 @@ struct sd_event_source {
                         siginfo_t siginfo;
                         pid_t pid;
                         int options;
+                        int pidfd;
+                        bool registered:1; /* whether the pidfd is registered in the epoll */
                 } child;
                 struct {
                         sd_event_handler_t callback;
@@ -113,6 +132,12 @@ struct sd_event_source {
                         struct inode_data *inode_data;
                         LIST_FIELDS(sd_event_source, by_inode_data);
                 } inotify;
+                struct {
+                        sd_event_work_handler_t work;
+                        sd_event_work_done_handler_t callback;
+                        EventWorkItem *item; /* while queued or running */
+                        int result;
+                } work;
         };
 };
 
@@ -147,6 +172,14 @@ struct signal_data {
         sd_event_source *current;
 };
 
+/* Work event sources are run on a pool of threads, which is created on first use. The pool signals finished work
+ * through an eventfd, which is watched by the epoll fd. */
+struct work_data {
+        WakeupType wakeup;
+
+        EventWorkPool *pool;
+};
+
 /* A structure listing all event sources currently watching a specific inode */
 struct inode_data {
         /* The identifier for the inode, the combination of the .st_dev + .st_ino fields of the file */
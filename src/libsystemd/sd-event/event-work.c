@@ -0,0 +1,363 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "event-work.h"
+#include "fd-util.h"
+#include "list.h"
+
+typedef enum EventWorkState {
+        EVENT_WORK_QUEUED,
+        EVENT_WORK_RUNNING,
+        EVENT_WORK_FINISHED,
+} EventWorkState;
+
+struct EventWorkItem {
+        event_work_func_t func;
+        void *userdata;
+
+        /* Whom to report the completion to. Reset to NULL if the item is cancelled after a thread picked it
+         * up already, in which case we simply drop the completion. */
+        void *owner;
+
+        EventWorkState state;
+        int result;
+
+        LIST_FIELDS(EventWorkItem, items);
+};
+
+struct EventWorkPool {
+        int fd;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        /* Everything below is protected by the mutex */
+
+        LIST_HEAD(EventWorkItem, queued);
+        EventWorkItem *queued_tail;
+        unsigned n_queued;
+
+        LIST_HEAD(EventWorkItem, finished);
+        EventWorkItem *finished_tail;
+
+        pthread_t threads[EVENT_WORK_THREADS_MAX];
+        unsigned n_threads;
+        unsigned n_running;
+        unsigned threads_max;
+
+        bool shutdown;
+};
+
+static void *work_thread(void *userdata) {
+        EventWorkPool *p = userdata;
+
+        (void) pthread_setname_np(pthread_self(), "sd-event-work");
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        for (;;) {
+                EventWorkItem *i;
+                int r;
+
+                /* The limit may have been lowered since we were started, hence check it here rather than
+                 * only when starting threads */
+                while (!p->shutdown && (!p->queued || p->n_running >= p->threads_max))
+                        assert_se(pthread_cond_wait(&p->cond, &p->mutex) == 0);
+
+                if (p->shutdown)
+                        break;
+
+                i = p->queued;
+                if (p->queued_tail == i)
+                        p->queued_tail = NULL;
+                LIST_REMOVE(items, p->queued, i);
+                p->n_queued--;
+
+                i->state = EVENT_WORK_RUNNING;
+                p->n_running++;
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+                r = i->func(i->userdata);
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                i->result = r;
+                i->state = EVENT_WORK_FINISHED;
+                p->n_running--;
+
+                /* Completions are handed back in the order the work finished */
+                LIST_INSERT_AFTER(items, p->finished, p->finished_tail, i);
+                p->finished_tail = i;
+
+                /* Wake up the owner. This only fails if the counter is about to overflow, in which case it is
+                 * readable anyway. */
+                (void) eventfd_write(p->fd, 1);
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return NULL;
+}
+
+static int work_pool_start_threads(EventWorkPool *p) {
+        sigset_t ss, saved_ss;
+        int r, k;
+
+        assert(p);
+
+        /* Called with the mutex held. Start as many threads as there are queued items that no thread is
+         * available for already, within the limit. */
+
+        if (p->n_queued <= p->n_threads - p->n_running || p->n_threads >= p->threads_max)
+                return 0;
+
+        assert_se(sigfillset(&ss) >= 0);
+
+        /* No signals in forked off threads please, see start_threads() in sd-resolve. Synchronous SIGBUS is
+         * left alone though, as work items might well access memory mapped files. */
+        assert_se(sigdelset(&ss, SIGBUS) >= 0);
+
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0)
+                return -r;
+
+        while (p->n_queued > p->n_threads - p->n_running && p->n_threads < p->threads_max) {
+                r = pthread_create(&p->threads[p->n_threads], NULL, work_thread, p);
+                if (r > 0) {
+                        r = -r;
+                        goto finish;
+                }
+
+                p->n_threads++;
+        }
+
+        r = 0;
+
+finish:
+        k = pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+        if (k > 0 && r >= 0)
+                r = -k;
+
+        /* If we got at least one thread, the queue will be worked on eventually */
+        if (r < 0 && p->n_threads > 0)
+                r = 0;
+
+        return r;
+}
+
+int event_work_pool_new(EventWorkPool **ret) {
+        _cleanup_(event_work_pool_freep) EventWorkPool *p = NULL;
+        long n;
+
+        assert(ret);
+
+        p = new(EventWorkPool, 1);
+        if (!p)
+                return -ENOMEM;
+
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        *p = (EventWorkPool) {
+                .fd = -1,
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .cond = PTHREAD_COND_INITIALIZER,
+                .threads_max = n > 0 ? MIN((unsigned long) n, EVENT_WORK_THREADS_MAX) : 1,
+        };
+
+        p->fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (p->fd < 0)
+                return -errno;
+
+        p->fd = fd_move_above_stdio(p->fd);
+
+        *ret = TAKE_PTR(p);
+        return 0;
+}
+
+EventWorkPool *event_work_pool_free(EventWorkPool *p) {
+        EventWorkItem *i;
+        unsigned k;
+
+        if (!p)
+                return NULL;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        /* Items nobody picked up yet are simply dropped, but we have to wait for the running ones, there's no
+         * way to interrupt them */
+        while ((i = p->queued)) {
+                LIST_REMOVE(items, p->queued, i);
+                free(i);
+        }
+        p->queued_tail = NULL;
+        p->n_queued = 0;
+
+        p->shutdown = true;
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        for (k = 0; k < p->n_threads; k++)
+                (void) pthread_join(p->threads[k], NULL);
+
+        while ((i = p->finished)) {
+                LIST_REMOVE(items, p->finished, i);
+                free(i);
+        }
+        p->finished_tail = NULL;
+
+        (void) pthread_cond_destroy(&p->cond);
+        (void) pthread_mutex_destroy(&p->mutex);
+
+        safe_close(p->fd);
+
+        return mfree(p);
+}
+
+EventWorkPool *event_work_pool_free_after_fork(EventWorkPool *p) {
+        if (!p)
+                return NULL;
+
+        /* None of the threads exist in a forked off child, and one of them might have held the mutex, or been
+         * in the middle of updating the lists, in that moment. Hence neither lock nor look at anything, and
+         * just release the eventfd and the pool itself. The items are leaked. */
+        safe_close(p->fd);
+
+        return mfree(p);
+}
+
+int event_work_pool_get_fd(EventWorkPool *p) {
+        assert(p);
+
+        return p->fd;
+}
+
+void event_work_pool_set_threads_max(EventWorkPool *p, unsigned n) {
+        assert(p);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        p->threads_max = CLAMP(n, 1U, EVENT_WORK_THREADS_MAX);
+
+        /* If the limit was raised, threads waiting for their turn may go ahead now, and we might need more of
+         * them. Not being able to start any more is not fatal, those we have will get to the queue
+         * eventually. */
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        (void) work_pool_start_threads(p);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+}
+
+int event_work_pool_submit(EventWorkPool *p, event_work_func_t func, void *userdata, void *owner, EventWorkItem **ret) {
+        EventWorkItem *i;
+        int r;
+
+        assert(p);
+        assert(func);
+        assert(owner);
+        assert(ret);
+
+        i = new(EventWorkItem, 1);
+        if (!i)
+                return -ENOMEM;
+
+        *i = (EventWorkItem) {
+                .func = func,
+                .userdata = userdata,
+                .owner = owner,
+                .state = EVENT_WORK_QUEUED,
+        };
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        LIST_INSERT_AFTER(items, p->queued, p->queued_tail, i);
+        p->queued_tail = i;
+        p->n_queued++;
+
+        r = work_pool_start_threads(p);
+        if (r < 0) {
+                if (p->queued_tail == i)
+                        p->queued_tail = i->items_prev;
+                LIST_REMOVE(items, p->queued, i);
+                p->n_queued--;
+        } else
+                assert_se(pthread_cond_signal(&p->cond) == 0);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        if (r < 0) {
+                free(i);
+                return r;
+        }
+
+        *ret = i;
+        return 0;
+}
+
+void event_work_pool_cancel(EventWorkPool *p, EventWorkItem *i) {
+        assert(p);
+        assert(i);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        if (i->state == EVENT_WORK_QUEUED) {
+                if (p->queued_tail == i)
+                        p->queued_tail = i->items_prev;
+                LIST_REMOVE(items, p->queued, i);
+                p->n_queued--;
+                free(i);
+        } else
+                /* Too late, the item is freed once it finished and the completion got picked up */
+                i->owner = NULL;
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+}
+
+int event_work_pool_flush(EventWorkPool *p) {
+        eventfd_t x;
+
+        assert(p);
+
+        if (eventfd_read(p->fd, &x) < 0 && !IN_SET(errno, EAGAIN, EINTR))
+                return -errno;
+
+        return 0;
+}
+
+int event_work_pool_next_completion(EventWorkPool *p, void **ret_owner, int *ret_result) {
+        assert(p);
+        assert(ret_owner);
+        assert(ret_result);
+
+        for (;;) {
+                _cleanup_free_ EventWorkItem *i = NULL;
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                i = p->finished;
+                if (i) {
+                        if (p->finished_tail == i)
+                                p->finished_tail = NULL;
+                        LIST_REMOVE(items, p->finished, i);
+                }
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                if (!i)
+                        return 0;
+
+                /* Cancelled items are only ever orphaned by the owner's thread, i.e. ours, hence it's safe to
+                 * look at this without the lock */
+                if (!i->owner)
+                        continue;
+
+                *ret_owner = i->owner;
+                *ret_result = i->result;
+                return 1;
+        }
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include "macro.h"
+
+/* A minimal thread pool, just good enough for sd-event to run work items off the event loop thread. Items are
+ * queued by the owner, picked up by up to a configurable number of threads, and handed back through a list of
+ * finished items, whose arrival is signalled on an eventfd the owner can watch. The pool is not thread-safe
+ * towards its owner: everything but the work functions themselves is supposed to be called from a single
+ * thread. */
+
+#define EVENT_WORK_THREADS_MAX 16U
+
+typedef struct EventWorkPool EventWorkPool;
+typedef struct EventWorkItem EventWorkItem;
+
+typedef int (*event_work_func_t)(void *userdata);
+
+int event_work_pool_new(EventWorkPool **ret);
+EventWorkPool *event_work_pool_free(EventWorkPool *p);
+DEFINE_TRIVIAL_CLEANUP_FUNC(EventWorkPool*, event_work_pool_free);
+EventWorkPool *event_work_pool_free_after_fork(EventWorkPool *p);
+
+int event_work_pool_get_fd(EventWorkPool *p);
+void event_work_pool_set_threads_max(EventWorkPool *p, unsigned n);
+
+int event_work_pool_submit(EventWorkPool *p, event_work_func_t func, void *userdata, void *owner, EventWorkItem **ret);
+void event_work_pool_cancel(EventWorkPool *p, EventWorkItem *i);
+
+int event_work_pool_flush(EventWorkPool *p);
+int event_work_pool_next_completion(EventWorkPool *p, void **ret_owner, int *ret_result);
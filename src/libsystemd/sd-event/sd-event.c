@@ -9,8 +9,11 @@
 #include "sd-id128.h"
 
 #include "alloc-util.h"
+#include "env-util.h"
+#include "errno-util.h"
 #include "event-source.h"
 #include "fd-util.h"
+#include "fileio.h"
 #include "fs-util.h"
 #include "hashmap.h"
 #include "list.h"
@@ -21,6 +24,7 @@
 #include "process-util.h"
 #include "set.h"
 #include "signal-util.h"
+#include "sort-util.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strxcpyx.h"
@@ -28,6 +32,11 @@
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* Child sources that only wait for the process to exit are watched through a pidfd in the epoll, all others
+ * through SIGCHLD and a waitid() sweep over all of them */
+#define EVENT_SOURCE_WATCH_PIDFD(s) \
+        ((s)->type == SOURCE_CHILD && (s)->child.pidfd >= 0 && (s)->child.options == WEXITED)
+
 static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX] = {
         [SOURCE_IO] = "io",
         [SOURCE_TIME_REALTIME] = "realtime",
@@ -42,12 +51,17 @@ static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX]
         [SOURCE_EXIT] = "exit",
         [SOURCE_WATCHDOG] = "watchdog",
         [SOURCE_INOTIFY] = "inotify",
+        [SOURCE_WORK] = "work",
 };
 
 DEFINE_PRIVATE_STRING_TABLE_LOOKUP_TO_STRING(event_source_type, int);
 
 #define EVENT_SOURCE_IS_TIME(t) IN_SET((t), SOURCE_TIME_REALTIME, SOURCE_TIME_BOOTTIME, SOURCE_TIME_MONOTONIC, SOURCE_TIME_REALTIME_ALARM, SOURCE_TIME_BOOTTIME_ALARM)
 
+/* Signal, child and inotify sources share their kernel objects with other sources, hence cannot be taken
+ * offline individually. Exit sources are dispatched only once anyway. */
+#define EVENT_SOURCE_CAN_RATE_LIMIT(t) (IN_SET((t), SOURCE_IO, SOURCE_DEFER, SOURCE_POST) || EVENT_SOURCE_IS_TIME(t))
+
 struct sd_event {
         unsigned n_ref;
 
@@ -78,8 +92,14 @@ struct sd_event {
 
         Prioq *exit;
 
+        /* Event sources that exceeded their rate limit, ordered by the time the limit ends */
+        Prioq *ratelimited;
+
         Hashmap *inotify_data; /* indexed by priority */
 
+        struct work_data *work;
+        unsigned work_threads_max;
+
         /* A list of inode structures that still have an fd open, that we need to close before the next loop iteration */
         LIST_HEAD(struct inode_data, inode_data_to_close);
 
@@ -96,6 +116,9 @@ struct sd_event {
         bool need_process_child:1;
         bool watchdog:1;
         bool profile_delays:1;
+        bool batch_dispatch:1;
+        bool use_pidfd:1;
+        bool statistics:1;
 
         int exit_code;
 
@@ -108,6 +131,9 @@ struct sd_event {
 
         LIST_HEAD(sd_event_source, sources);
 
+        struct epoll_event *event_queue;
+        size_t event_queue_allocated;
+
         usec_t last_run, last_log;
         unsigned delays[sizeof(usec_t) * 8];
 };
@@ -116,6 +142,7 @@ static thread_local sd_event *default_event = NULL;
 
 static void source_disconnect(sd_event_source *s);
 static void event_gc_inode_data(sd_event *e, struct inode_data *d);
+static bool event_pid_changed(sd_event *e);
 
 static sd_event *event_resolve(sd_event *e) {
         return e == SD_EVENT_DEFAULT ? default_event : e;
@@ -139,6 +166,14 @@ static int pending_prioq_compare(const void *a, const void *b) {
         if (r != 0)
                 return r;
 
+        /* Move most recently dispatched ones last, so that sources which stay pending after being dispatched
+         * (i.e. defer sources) don't keep others of the same priority from running, and so that we can
+         * stop dispatching a batch as soon as we hit one that has already been dispatched in the current
+         * iteration */
+        r = CMP(x->dispatch_iteration, y->dispatch_iteration);
+        if (r != 0)
+                return r;
+
         /* Older entries first */
         return CMP(x->pending_iteration, y->pending_iteration);
 }
@@ -167,25 +202,15 @@ static int prepare_prioq_compare(const void *a, const void *b) {
         return CMP(x->priority, y->priority);
 }
 
+/* Only time event sources that are enabled and not pending yet are kept in the earliest/latest prioqs, see
+ * event_source_time_prioq_put(). Hence, those are simply ordered by time. */
+
 static int earliest_time_prioq_compare(const void *a, const void *b) {
         const sd_event_source *x = a, *y = b;
 
         assert(EVENT_SOURCE_IS_TIME(x->type));
         assert(x->type == y->type);
 
-        /* Enabled ones first */
-        if (x->enabled != SD_EVENT_OFF && y->enabled == SD_EVENT_OFF)
-                return -1;
-        if (x->enabled == SD_EVENT_OFF && y->enabled != SD_EVENT_OFF)
-                return 1;
-
-        /* Move the pending ones to the end */
-        if (!x->pending && y->pending)
-                return -1;
-        if (x->pending && !y->pending)
-                return 1;
-
-        /* Order by time */
         return CMP(x->time.next, y->time.next);
 }
 
@@ -199,20 +224,20 @@ static int latest_time_prioq_compare(const void *a, const void *b) {
         assert(EVENT_SOURCE_IS_TIME(x->type));
         assert(x->type == y->type);
 
-        /* Enabled ones first */
-        if (x->enabled != SD_EVENT_OFF && y->enabled == SD_EVENT_OFF)
-                return -1;
-        if (x->enabled == SD_EVENT_OFF && y->enabled != SD_EVENT_OFF)
-                return 1;
+        return CMP(time_event_source_latest(x), time_event_source_latest(y));
+}
 
-        /* Move the pending ones to the end */
-        if (!x->pending && y->pending)
-                return -1;
-        if (x->pending && !y->pending)
-                return 1;
+static usec_t event_source_ratelimit_end(const sd_event_source *s) {
+        return usec_add(s->rate_limit.begin, s->rate_limit.interval);
+}
 
-        /* Order by time */
-        return CMP(time_event_source_latest(x), time_event_source_latest(y));
+static int ratelimited_prioq_compare(const void *a, const void *b) {
+        const sd_event_source *x = a, *y = b;
+
+        assert(x->ratelimited);
+        assert(y->ratelimited);
+
+        return CMP(event_source_ratelimit_end(x), event_source_ratelimit_end(y));
 }
 
 static int exit_prioq_compare(const void *a, const void *b) {
@@ -240,6 +265,22 @@ static void free_clock_data(struct clock_data *d) {
         prioq_free(d->latest);
 }
 
+static void event_free_work(sd_event *e) {
+        assert(e);
+
+        if (!e->work)
+                return;
+
+        /* This waits for work items that are still running. After fork() there are no threads left to wait
+         * for though, and one of them might have held the pool's lock in that moment, hence only release
+         * the memory and the eventfd then. */
+        if (event_pid_changed(e))
+                event_work_pool_free_after_fork(e->work->pool);
+        else
+                event_work_pool_free(e->work->pool);
+        e->work = mfree(e->work);
+}
+
 static sd_event *event_free(sd_event *e) {
         sd_event_source *s;
 
@@ -253,6 +294,8 @@ static sd_event *event_free(sd_event *e) {
 
         assert(e->n_sources == 0);
 
+        event_free_work(e);
+
         if (e->default_event_ptr)
                 *(e->default_event_ptr) = NULL;
 
@@ -268,6 +311,7 @@ static sd_event *event_free(sd_event *e) {
         prioq_free(e->pending);
         prioq_free(e->prepare);
         prioq_free(e->exit);
+        prioq_free(e->ratelimited);
 
         free(e->signal_sources);
         hashmap_free(e->signal_data);
@@ -277,9 +321,51 @@ static sd_event *event_free(sd_event *e) {
         hashmap_free(e->child_sources);
         set_free(e->post_sources);
 
+        free(e->event_queue);
+
         return mfree(e);
 }
 
+static int event_setup_work(sd_event *e) {
+        _cleanup_free_ struct work_data *d = NULL;
+        struct epoll_event ev;
+        int r;
+
+        assert(e);
+
+        if (e->work)
+                return 0;
+
+        d = new(struct work_data, 1);
+        if (!d)
+                return -ENOMEM;
+
+        *d = (struct work_data) {
+                .wakeup = WAKEUP_WORK_DATA,
+        };
+
+        r = event_work_pool_new(&d->pool);
+        if (r < 0)
+                return r;
+
+        if (e->work_threads_max > 0)
+                event_work_pool_set_threads_max(d->pool, e->work_threads_max);
+
+        ev = (struct epoll_event) {
+                .events = EPOLLIN,
+                .data.ptr = d,
+        };
+
+        if (epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, event_work_pool_get_fd(d->pool), &ev) < 0) {
+                r = -errno;
+                event_work_pool_free(d->pool);
+                return r;
+        }
+
+        e->work = TAKE_PTR(d);
+        return 0;
+}
+
 _public_ int sd_event_new(sd_event** ret) {
         sd_event *e;
         int r;
@@ -330,6 +416,11 @@ _public_ int sd_event_new(sd_event** ret) {
                 e->profile_delays = true;
         }
 
+        r = getenv_bool_secure("SD_EVENT_PIDFD");
+        if (r < 0 && r != -ENXIO)
+                log_debug_errno(r, "Failed to parse $SD_EVENT_PIDFD, ignoring: %m");
+        e->use_pidfd = r != 0;
+
         *ret = e;
         return 0;
 
@@ -355,6 +446,51 @@ static bool event_pid_changed(sd_event *e) {
         return e->original_pid != getpid_cached();
 }
 
+static int source_child_pidfd_register(sd_event_source *s) {
+        struct epoll_event ev;
+        int r;
+
+        assert(s);
+        assert(EVENT_SOURCE_WATCH_PIDFD(s));
+
+        if (s->child.registered)
+                return 0;
+
+        /* Level-triggered, not oneshot: if a wakeup turns out to be spurious, process_pidfd() leaves the
+         * pidfd registered and we'll simply be told again once the process actually exited. */
+        ev = (struct epoll_event) {
+                .events = EPOLLIN,
+                .data.ptr = s,
+        };
+
+        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_ADD, s->child.pidfd, &ev);
+        if (r < 0)
+                return -errno;
+
+        s->child.registered = true;
+        return 0;
+}
+
+static void source_child_pidfd_unregister(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_CHILD);
+
+        if (event_pid_changed(s->event))
+                return;
+
+        if (!s->child.registered)
+                return;
+
+        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->child.pidfd, NULL);
+        if (r < 0)
+                log_debug_errno(errno, "Failed to remove source %s (type %s) from epoll: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+
+        s->child.registered = false;
+}
+
 static void source_io_unregister(sd_event_source *s) {
         int r;
 
@@ -654,6 +790,91 @@ static void event_gc_signal_data(sd_event *e, const int64_t *priority, int sig)
                 event_unmask_signal_data(e, d, sig);
 }
 
+static int event_source_time_prioq_put(sd_event_source *s, struct clock_data *d) {
+        int r;
+
+        assert(s);
+        assert(d);
+
+        /* Disabled and pending time event sources cannot elapse (again), hence we don't keep them in the
+         * prioqs at all. This keeps the prioqs small if most timers are disabled, as is typical for PID 1,
+         * and makes changing disabled timers cheap. */
+
+        if (s->time.earliest_index != PRIOQ_IDX_NULL) {
+                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
+                prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        } else {
+                r = prioq_put(d->earliest, s, &s->time.earliest_index);
+                if (r < 0)
+                        return r;
+
+                r = prioq_put(d->latest, s, &s->time.latest_index);
+                if (r < 0) {
+                        assert_se(prioq_remove(d->earliest, s, &s->time.earliest_index) > 0);
+                        s->time.earliest_index = PRIOQ_IDX_NULL;
+                        return r;
+                }
+        }
+
+        d->needs_rearm = true;
+        return 0;
+}
+
+static void event_source_time_prioq_reshuffle(sd_event_source *s, struct clock_data *d) {
+        assert(s);
+        assert(d);
+
+        if (s->time.earliest_index == PRIOQ_IDX_NULL)
+                return;
+
+        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
+        prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        d->needs_rearm = true;
+}
+
+static void event_source_time_prioq_remove(sd_event_source *s, struct clock_data *d) {
+        assert(s);
+        assert(d);
+
+        if (s->time.earliest_index == PRIOQ_IDX_NULL)
+                return;
+
+        assert_se(prioq_remove(d->earliest, s, &s->time.earliest_index) > 0);
+        assert_se(prioq_remove(d->latest, s, &s->time.latest_index) > 0);
+        s->time.earliest_index = s->time.latest_index = PRIOQ_IDX_NULL;
+        d->needs_rearm = true;
+}
+
+static int event_source_work_queue(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_WORK);
+        assert(!s->work.item);
+
+        /* The pool might have been released in the meantime, see sd_event_set_work_threads_max() */
+        r = event_setup_work(s->event);
+        if (r < 0)
+                return r;
+
+        /* The work function is passed the userdata pointer as it is right now */
+        return event_work_pool_submit(s->event->work->pool, s->work.work, s->userdata, s, &s->work.item);
+}
+
+static void event_source_work_cancel(sd_event_source *s) {
+        assert(s);
+        assert(s->type == SOURCE_WORK);
+
+        if (!s->work.item)
+                return;
+
+        /* If the work is running already we can't stop it, but we won't hear of it anymore. After fork()
+         * the pool must not be touched anymore, see event_free_work(). */
+        if (!event_pid_changed(s->event))
+                event_work_pool_cancel(s->event->work->pool, s->work.item);
+        s->work.item = NULL;
+}
+
 static void source_disconnect(sd_event_source *s) {
         sd_event *event;
 
@@ -682,9 +903,7 @@ static void source_disconnect(sd_event_source *s) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
-                prioq_remove(d->earliest, s, &s->time.earliest_index);
-                prioq_remove(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
+                event_source_time_prioq_remove(s, d);
                 break;
         }
 
@@ -706,6 +925,9 @@ static void source_disconnect(sd_event_source *s) {
                                 s->event->n_enabled_child_sources--;
                         }
 
+                        source_child_pidfd_unregister(s);
+                        s->child.pidfd = safe_close(s->child.pidfd);
+
                         (void) hashmap_remove(s->event->child_sources, PID_TO_PTR(s->child.pid));
                         event_gc_signal_data(s->event, &s->priority, SIGCHLD);
                 }
@@ -759,6 +981,10 @@ static void source_disconnect(sd_event_source *s) {
                 break;
         }
 
+        case SOURCE_WORK:
+                event_source_work_cancel(s);
+                break;
+
         default:
                 assert_not_reached("Wut? I shouldn't exist.");
         }
@@ -769,6 +995,11 @@ static void source_disconnect(sd_event_source *s) {
         if (s->prepare)
                 prioq_remove(s->event->prepare, s, &s->prepare_index);
 
+        if (s->ratelimited) {
+                prioq_remove(s->event->ratelimited, s, &s->ratelimit_index);
+                s->event->monotonic.needs_rearm = true;
+        }
+
         event = s->event;
 
         s->type = _SOURCE_EVENT_SOURCE_TYPE_INVALID;
@@ -805,6 +1036,14 @@ static int source_set_pending(sd_event_source *s, bool b) {
         if (s->pending == b)
                 return 0;
 
+        if (EVENT_SOURCE_IS_TIME(s->type) && !b && s->enabled != SD_EVENT_OFF && !s->ratelimited) {
+                /* The time event source may elapse again once it is not pending anymore. Queue it first,
+                 * since that's the only step that might fail. */
+                r = event_source_time_prioq_put(s, event_get_clock_data(s->event, s->type));
+                if (r < 0)
+                        return r;
+        }
+
         s->pending = b;
 
         if (b) {
@@ -815,20 +1054,17 @@ static int source_set_pending(sd_event_source *s, bool b) {
                         s->pending = false;
                         return r;
                 }
-        } else
-                assert_se(prioq_remove(s->event->pending, s, &s->pending_index));
-
-        if (EVENT_SOURCE_IS_TIME(s->type)) {
-                struct clock_data *d;
 
-                d = event_get_clock_data(s->event, s->type);
-                assert(d);
-
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
+                if (s->event->statistics)
+                        s->pending_timestamp = now(CLOCK_MONOTONIC);
+        } else {
+                assert_se(prioq_remove(s->event->pending, s, &s->pending_index));
+                s->pending_timestamp = 0;
         }
 
+        if (EVENT_SOURCE_IS_TIME(s->type) && b)
+                event_source_time_prioq_remove(s, event_get_clock_data(s->event, s->type));
+
         if (s->type == SOURCE_SIGNAL && !b) {
                 struct signal_data *d;
 
@@ -869,6 +1105,7 @@ static sd_event_source *source_new(sd_event *e, bool floating, EventSourceType t
                 .type = type,
                 .pending_index = PRIOQ_IDX_NULL,
                 .prepare_index = PRIOQ_IDX_NULL,
+                .ratelimit_index = PRIOQ_IDX_NULL,
         };
 
         if (!floating)
@@ -1039,13 +1276,7 @@ _public_ int sd_event_add_time(
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
-        d->needs_rearm = true;
-
-        r = prioq_put(d->earliest, s, &s->time.earliest_index);
-        if (r < 0)
-                return r;
-
-        r = prioq_put(d->latest, s, &s->time.latest_index);
+        r = event_source_time_prioq_put(s, d);
         if (r < 0)
                 return r;
 
@@ -1153,26 +1384,48 @@ _public_ int sd_event_add_child(
         if (!s)
                 return -ENOMEM;
 
-        s->child.pid = pid;
+        s->wakeup = WAKEUP_EVENT_SOURCE;
+        s->child.pidfd = -1;
         s->child.options = options;
         s->child.callback = callback;
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
+        /* If the kernel supports it, watch the child through a pidfd. That way we are woken up for exactly the
+         * child that exited, instead of sweeping through all child sources with waitid() on each SIGCHLD. */
+        if (e->use_pidfd && options == WEXITED) {
+                s->child.pidfd = pidfd_open(pid, 0);
+                if (s->child.pidfd < 0) {
+                        /* Propagate errors, unless the syscall is not supported or blocked */
+                        if (!ERRNO_IS_NOT_SUPPORTED(errno) && !ERRNO_IS_PRIVILEGE(errno))
+                                return -errno;
+
+                        log_debug_errno(errno, "Failed to allocate pidfd, watching children via SIGCHLD: %m");
+                        e->use_pidfd = false;
+                } else
+                        s->child.pidfd = fd_move_above_stdio(s->child.pidfd);
+        }
+
+        /* From here on source_disconnect() undoes everything, including the accounting below */
+        s->child.pid = pid;
+        e->n_enabled_child_sources++;
+
         r = hashmap_put(e->child_sources, PID_TO_PTR(pid), s);
         if (r < 0)
                 return r;
 
-        e->n_enabled_child_sources++;
+        if (EVENT_SOURCE_WATCH_PIDFD(s)) {
+                r = source_child_pidfd_register(s);
+                if (r < 0)
+                        return r;
+        } else {
+                r = event_make_signal_data(e, SIGCHLD, NULL);
+                if (r < 0)
+                        return r;
 
-        r = event_make_signal_data(e, SIGCHLD, NULL);
-        if (r < 0) {
-                e->n_enabled_child_sources--;
-                return r;
+                e->need_process_child = true;
         }
 
-        e->need_process_child = true;
-
         if (ret)
                 *ret = s;
         TAKE_PTR(s);
@@ -1666,6 +1919,42 @@ _public_ int sd_event_add_inotify(
         return 0;
 }
 
+_public_ int sd_event_add_work(
+                sd_event *e,
+                sd_event_source **ret,
+                sd_event_work_handler_t work,
+                sd_event_work_done_handler_t callback,
+                void *userdata) {
+
+        _cleanup_(source_freep) sd_event_source *s = NULL;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(work, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        s = source_new(e, !ret, SOURCE_WORK);
+        if (!s)
+                return -ENOMEM;
+
+        s->work.work = work;
+        s->work.callback = callback;
+        s->userdata = userdata;
+        s->enabled = SD_EVENT_ONESHOT;
+
+        r = event_source_work_queue(s);
+        if (r < 0)
+                return r;
+
+        if (ret)
+                *ret = s;
+        TAKE_PTR(s);
+
+        return 0;
+}
+
 static sd_event_source* event_source_free(sd_event_source *s) {
         if (!s)
                 return NULL;
@@ -1744,7 +2033,7 @@ _public_ int sd_event_source_set_io_fd(sd_event_source *s, int fd) {
         if (s->io.fd == fd)
                 return 0;
 
-        if (s->enabled == SD_EVENT_OFF) {
+        if (s->enabled == SD_EVENT_OFF || s->ratelimited) {
                 s->io.fd = fd;
                 s->io.registered = false;
         } else {
@@ -1811,7 +2100,7 @@ _public_ int sd_event_source_set_io_events(sd_event_source *s, uint32_t events)
         if (r < 0)
                 return r;
 
-        if (s->enabled != SD_EVENT_OFF) {
+        if (s->enabled != SD_EVENT_OFF && !s->ratelimited) {
                 r = source_io_register(s, s->enabled, events);
                 if (r < 0)
                         return r;
@@ -1981,8 +2270,9 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
         if (m == SD_EVENT_OFF) {
 
-                /* Unset the pending flag when this event source is disabled */
-                if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
+                /* Unset the pending flag when this event source is disabled. Time event sources do that
+                 * below, once they are marked disabled, so that they aren't queued in the prioqs again. */
+                if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT) && !EVENT_SOURCE_IS_TIME(s->type)) {
                         r = source_set_pending(s, false);
                         if (r < 0)
                                 return r;
@@ -2003,12 +2293,15 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         struct clock_data *d;
 
                         s->enabled = m;
+
+                        r = source_set_pending(s, false);
+                        if (r < 0)
+                                return r;
+
                         d = event_get_clock_data(s->event, s->type);
                         assert(d);
 
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        event_source_time_prioq_remove(s, d);
                         break;
                 }
 
@@ -2024,6 +2317,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         assert(s->event->n_enabled_child_sources > 0);
                         s->event->n_enabled_child_sources--;
 
+                        source_child_pidfd_unregister(s);
                         event_gc_signal_data(s->event, &s->priority, SIGCHLD);
                         break;
 
@@ -2038,6 +2332,11 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         s->enabled = m;
                         break;
 
+                case SOURCE_WORK:
+                        event_source_work_cancel(s);
+                        s->enabled = m;
+                        break;
+
                 default:
                         assert_not_reached("Wut? I shouldn't exist.");
                 }
@@ -2054,9 +2353,12 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 switch (s->type) {
 
                 case SOURCE_IO:
-                        r = source_io_register(s, m, s->io.events);
-                        if (r < 0)
-                                return r;
+                        /* A rate limited source is registered again once its limit ends */
+                        if (!s->ratelimited) {
+                                r = source_io_register(s, m, s->io.events);
+                                if (r < 0)
+                                        return r;
+                        }
 
                         s->enabled = m;
                         break;
@@ -2068,13 +2370,16 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_TIME_BOOTTIME_ALARM: {
                         struct clock_data *d;
 
-                        s->enabled = m;
                         d = event_get_clock_data(s->event, s->type);
                         assert(d);
 
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        if (!s->pending && !s->ratelimited) {
+                                r = event_source_time_prioq_put(s, d);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        s->enabled = m;
                         break;
                 }
 
@@ -2098,6 +2403,17 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
                         s->enabled = m;
 
+                        if (EVENT_SOURCE_WATCH_PIDFD(s)) {
+                                r = source_child_pidfd_register(s);
+                                if (r < 0) {
+                                        s->enabled = SD_EVENT_OFF;
+                                        s->event->n_enabled_child_sources--;
+                                        return r;
+                                }
+
+                                break;
+                        }
+
                         r = event_make_signal_data(s->event, SIGCHLD, NULL);
                         if (r < 0) {
                                 s->enabled = SD_EVENT_OFF;
@@ -2119,7 +2435,19 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         s->enabled = m;
                         break;
 
-                default:
+                case SOURCE_WORK:
+                        /* Enabling a disabled work source runs the work function once more, unless the
+                         * result of the previous run wasn't dispatched yet */
+                        if (s->enabled == SD_EVENT_OFF && !s->pending) {
+                                r = event_source_work_queue(s);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        s->enabled = m;
+                        break;
+
+                default:
                         assert_not_reached("Wut? I shouldn't exist.");
                 }
         }
@@ -2161,9 +2489,7 @@ _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
-        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        event_source_time_prioq_reshuffle(s, d);
 
         return 0;
 }
@@ -2200,8 +2526,7 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        event_source_time_prioq_reshuffle(s, d);
 
         return 0;
 }
@@ -2369,9 +2694,9 @@ static int event_arm_timer(
                 sd_event *e,
                 struct clock_data *d) {
 
+        usec_t earliest = USEC_INFINITY, latest = USEC_INFINITY, t;
         struct itimerspec its = {};
         sd_event_source *a, *b;
-        usec_t t;
         int r;
 
         assert(e);
@@ -2383,7 +2708,25 @@ static int event_arm_timer(
                 d->needs_rearm = false;
 
         a = prioq_peek(d->earliest);
-        if (!a || a->enabled == SD_EVENT_OFF || a->time.next == USEC_INFINITY) {
+        if (a) {
+                b = prioq_peek(d->latest);
+                assert_se(b);
+
+                earliest = a->time.next;
+                latest = time_event_source_latest(b);
+        }
+
+        /* Rate limited event sources are brought back online by the monotonic clock, right when their limit
+         * ends. There's no point in delaying that for coalescing wakeups, the source is ready already. */
+        if (d == &e->monotonic) {
+                a = prioq_peek(e->ratelimited);
+                if (a) {
+                        earliest = MIN(earliest, event_source_ratelimit_end(a));
+                        latest = MIN(latest, event_source_ratelimit_end(a));
+                }
+        }
+
+        if (earliest == USEC_INFINITY) {
 
                 if (d->fd < 0)
                         return 0;
@@ -2400,10 +2743,7 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
-        assert_se(b && b->enabled != SD_EVENT_OFF);
-
-        t = sleep_between(e, a->time.next, time_event_source_latest(b));
+        t = sleep_between(e, earliest, latest);
         if (d->next == t)
                 return 0;
 
@@ -2482,19 +2822,122 @@ static int process_timer(
 
         for (;;) {
                 s = prioq_peek(d->earliest);
-                if (!s ||
-                    s->time.next > n ||
-                    s->enabled == SD_EVENT_OFF ||
-                    s->pending)
+                if (!s || s->time.next > n)
                         break;
 
+                assert(s->enabled != SD_EVENT_OFF);
+                assert(!s->pending);
+
+                /* This removes the source from the prioqs */
                 r = source_set_pending(s, true);
                 if (r < 0)
                         return r;
+        }
 
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
+        return 0;
+}
+
+static int event_source_leave_ratelimit(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->ratelimited);
+
+        prioq_remove(s->event->ratelimited, s, &s->ratelimit_index);
+        s->ratelimited = false;
+        s->event->monotonic.needs_rearm = true;
+
+        /* Undo what event_source_enter_ratelimit() did, and pick up where we left off */
+        switch (s->type) {
+
+        case SOURCE_IO:
+                if (s->enabled == SD_EVENT_OFF)
+                        return 0;
+
+                return source_io_register(s, s->enabled, s->io.events);
+
+        case SOURCE_TIME_REALTIME:
+        case SOURCE_TIME_BOOTTIME:
+        case SOURCE_TIME_MONOTONIC:
+        case SOURCE_TIME_REALTIME_ALARM:
+        case SOURCE_TIME_BOOTTIME_ALARM:
+                if (s->enabled == SD_EVENT_OFF || s->pending)
+                        return 0;
+
+                return event_source_time_prioq_put(s, event_get_clock_data(s->event, s->type));
+
+        case SOURCE_DEFER:
+                r = source_set_pending(s, true);
+                if (r < 0)
+                        return r;
+
+                return 0;
+
+        case SOURCE_POST:
+                /* Marked pending again the next time another source is dispatched */
+                return 0;
+
+        default:
+                assert_not_reached("Wut? I shouldn't be rate limited.");
+        }
+}
+
+static int process_ratelimited(sd_event *e, usec_t n) {
+        int r;
+
+        assert(e);
+
+        for (;;) {
+                sd_event_source *s;
+
+                s = prioq_peek(e->ratelimited);
+                if (!s || event_source_ratelimit_end(s) > n)
+                        break;
+
+                r = event_source_leave_ratelimit(s);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to bring rate limited event source %s (type %s) back online, disabling: %m",
+                                        strna(s->description), event_source_type_to_string(s->type));
+                        (void) sd_event_source_set_enabled(s, SD_EVENT_OFF);
+                }
+        }
+
+        return 0;
+}
+
+static int process_work(sd_event *e, struct work_data *d, uint32_t events) {
+        int r;
+
+        assert(e);
+        assert(d);
+
+        assert_return(events == EPOLLIN, -EIO);
+
+        /* Reset the eventfd first, so that we are woken up again for anything finishing after this */
+        r = event_work_pool_flush(d->pool);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                sd_event_source *s;
+                void *owner;
+                int result;
+
+                r = event_work_pool_next_completion(d->pool, &owner, &result);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        break;
+
+                s = owner;
+                assert(s->type == SOURCE_WORK);
+
+                s->work.item = NULL;
+                s->work.result = result;
+
+                r = source_set_pending(s, true);
+                if (r < 0)
+                        return r;
         }
 
         return 0;
@@ -2536,6 +2979,10 @@ static int process_child(sd_event *e) {
                 if (s->enabled == SD_EVENT_OFF)
                         continue;
 
+                /* Those are taken care of by process_pidfd() */
+                if (EVENT_SOURCE_WATCH_PIDFD(s))
+                        continue;
+
                 zero(s->child.siginfo);
                 r = waitid(P_PID, s->child.pid, &s->child.siginfo,
                            WNOHANG | (s->child.options & WEXITED ? WNOWAIT : 0) | s->child.options);
@@ -2564,6 +3011,37 @@ static int process_child(sd_event *e) {
         return 0;
 }
 
+static int process_pidfd(sd_event *e, sd_event_source *s, uint32_t revents) {
+        assert(e);
+        assert(s);
+        assert(s->type == SOURCE_CHILD);
+
+        if (s->pending)
+                return 0;
+
+        if (s->enabled == SD_EVENT_OFF)
+                return 0;
+
+        /* The pidfd became readable, hence the process exited. As in process_child(), don't reap it yet, so
+         * that the callback still sees it as zombie. */
+        zero(s->child.siginfo);
+        if (waitid(P_PID, s->child.pid, &s->child.siginfo, WNOHANG|WNOWAIT|WEXITED) < 0) {
+                if (errno != ECHILD)
+                        return -errno;
+
+                /* Somebody else reaped it already, there's nothing to wait for anymore. Stop watching the
+                 * pidfd, it would stay readable forever. */
+                source_child_pidfd_unregister(s);
+                return 0;
+        }
+
+        /* Not exited after all, the pidfd stays registered and we'll be woken up again once it did */
+        if (s->child.siginfo.si_pid == 0)
+                return 0;
+
+        return source_set_pending(s, true);
+}
+
 static int process_signal(sd_event *e, struct signal_data *d, uint32_t events) {
         bool read_one = false;
         int r;
@@ -2780,8 +3258,80 @@ static int process_inotify(sd_event *e) {
         return done;
 }
 
+static int event_source_enter_ratelimit(sd_event_source *s) {
+        sd_event *e;
+        int r;
+
+        assert(s);
+        assert(s->event);
+        assert(EVENT_SOURCE_CAN_RATE_LIMIT(s->type));
+        assert(!s->ratelimited);
+
+        e = s->event;
+
+        r = prioq_ensure_allocated(&e->ratelimited, ratelimited_prioq_compare);
+        if (r < 0)
+                return r;
+
+        /* We are woken up through the monotonic timerfd once the limit ends */
+        r = event_setup_timer_fd(e, &e->monotonic, CLOCK_MONOTONIC);
+        if (r < 0)
+                return r;
+
+        s->ratelimited = true;
+
+        r = prioq_put(e->ratelimited, s, &s->ratelimit_index);
+        if (r < 0) {
+                s->ratelimited = false;
+                return r;
+        }
+
+        e->monotonic.needs_rearm = true;
+
+        /* Take the source offline: stop watching its fd, and forget that it is ready. Whatever made it
+         * ready is still there once the limit ends, hence nothing gets lost. Time event sources are not
+         * queued in the clock prioqs again while rate limited, see source_set_pending(). */
+        if (s->type == SOURCE_IO)
+                source_io_unregister(s);
+
+        return source_set_pending(s, false);
+}
+
+static int source_dispatch_ratelimited(sd_event_source *s) {
+        int r;
+
+        assert(s);
+
+        r = event_source_enter_ratelimit(s);
+        if (r < 0) {
+                /* Better to dispatch the source once too often than to stall it */
+                log_debug_errno(r, "Failed to rate limit event source %s (type %s), dispatching anyway: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+                return 0;
+        }
+
+        if (!s->ratelimit_callback)
+                return 1;
+
+        s->dispatching = true;
+        r = s->ratelimit_callback(s, s->userdata);
+        s->dispatching = false;
+
+        if (r < 0)
+                log_debug_errno(r, "Rate limit callback of event source %s (type %s) returned error, disabling: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+
+        if (s->n_ref == 0)
+                source_free(s);
+        else if (r < 0)
+                sd_event_source_set_enabled(s, SD_EVENT_OFF);
+
+        return 1;
+}
+
 static int source_dispatch(sd_event_source *s) {
         EventSourceType saved_type;
+        usec_t dispatch_start = USEC_INFINITY;
         int r = 0;
 
         assert(s);
@@ -2791,6 +3341,28 @@ static int source_dispatch(sd_event_source *s) {
          * the event. */
         saved_type = s->type;
 
+        if (!ratelimit_below(&s->rate_limit)) {
+                r = source_dispatch_ratelimited(s);
+                if (r != 0)
+                        return r;
+        }
+
+        if (s->event->statistics) {
+                dispatch_start = now(CLOCK_MONOTONIC);
+
+                if (s->pending_timestamp > 0)
+                        s->pending_usec += usec_sub_unsigned(dispatch_start, s->pending_timestamp);
+        }
+
+        /* Unsetting the pending flag of an enabled time event source queues it in the clock prioqs again,
+         * hence disable oneshot ones first, instead of queueing them only to remove them right after. This
+         * unsets the pending flag, too. */
+        if (EVENT_SOURCE_IS_TIME(s->type) && s->enabled == SD_EVENT_ONESHOT) {
+                r = sd_event_source_set_enabled(s, SD_EVENT_OFF);
+                if (r < 0)
+                        return r;
+        }
+
         if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
                 r = source_set_pending(s, false);
                 if (r < 0)
@@ -2805,7 +3377,7 @@ static int source_dispatch(sd_event_source *s) {
                  * post sources as pending */
 
                 SET_FOREACH(z, s->event->post_sources, i) {
-                        if (z->enabled == SD_EVENT_OFF)
+                        if (z->enabled == SD_EVENT_OFF || z->ratelimited)
                                 continue;
 
                         r = source_set_pending(z, true);
@@ -2888,6 +3460,10 @@ static int source_dispatch(sd_event_source *s) {
                 break;
         }
 
+        case SOURCE_WORK:
+                r = s->work.callback ? s->work.callback(s, s->work.result, s->userdata) : 0;
+                break;
+
         case SOURCE_WATCHDOG:
         case _SOURCE_EVENT_SOURCE_TYPE_MAX:
         case _SOURCE_EVENT_SOURCE_TYPE_INVALID:
@@ -2896,6 +3472,25 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        if (dispatch_start != USEC_INFINITY) {
+                usec_t t;
+
+                t = usec_sub_unsigned(now(CLOCK_MONOTONIC), dispatch_start);
+
+                s->n_dispatched++;
+                s->dispatch_usec += t;
+                s->dispatch_usec_max = MAX(s->dispatch_usec_max, t);
+
+                /* Defer sources stay pending, count their waiting time from the end of this dispatch */
+                if (s->pending)
+                        s->pending_timestamp = dispatch_start + t;
+        }
+
+        /* Work sources that are still enabled run their work function again, unless the callback
+         * requeued it already by reenabling the source. */
+        if (r >= 0 && s->type == SOURCE_WORK && s->enabled == SD_EVENT_ON && !s->work.item && !s->pending)
+                r = event_source_work_queue(s);
+
         if (r < 0)
                 log_debug_errno(r, "Event source %s (type %s) returned error, disabling: %m",
                                 strna(s->description), event_source_type_to_string(saved_type));
@@ -3100,7 +3695,6 @@ pending:
 }
 
 _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
-        struct epoll_event *ev_queue;
         unsigned ev_queue_max;
         int r, m, i;
 
@@ -3115,14 +3709,19 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
                 return 1;
         }
 
+        /* Keep the event queue around between iterations, it is sized by the number of sources, and there
+         * might be many */
         ev_queue_max = MAX(e->n_sources, 1u);
-        ev_queue = newa(struct epoll_event, ev_queue_max);
+        if (!GREEDY_REALLOC(e->event_queue, e->event_queue_allocated, ev_queue_max)) {
+                r = -ENOMEM;
+                goto finish;
+        }
 
         /* If we still have inotify data buffered, then query the other fds, but don't wait on it */
         if (e->inotify_data_buffered)
                 timeout = 0;
 
-        m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
+        m = epoll_wait(e->epoll_fd, e->event_queue, ev_queue_max,
                        timeout == (uint64_t) -1 ? -1 : (int) DIV_ROUND_UP(timeout, USEC_PER_MSEC));
         if (m < 0) {
                 if (errno == EINTR) {
@@ -3138,29 +3737,49 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
 
         for (i = 0; i < m; i++) {
 
-                if (ev_queue[i].data.ptr == INT_TO_PTR(SOURCE_WATCHDOG))
-                        r = flush_timer(e, e->watchdog_fd, ev_queue[i].events, NULL);
+                if (e->event_queue[i].data.ptr == INT_TO_PTR(SOURCE_WATCHDOG))
+                        r = flush_timer(e, e->watchdog_fd, e->event_queue[i].events, NULL);
                 else {
-                        WakeupType *t = ev_queue[i].data.ptr;
+                        WakeupType *t = e->event_queue[i].data.ptr;
 
                         switch (*t) {
 
-                        case WAKEUP_EVENT_SOURCE:
-                                r = process_io(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                        case WAKEUP_EVENT_SOURCE: {
+                                sd_event_source *s = e->event_queue[i].data.ptr;
+
+                                switch (s->type) {
+
+                                case SOURCE_IO:
+                                        r = process_io(e, s, e->event_queue[i].events);
+                                        break;
+
+                                case SOURCE_CHILD:
+                                        r = process_pidfd(e, s, e->event_queue[i].events);
+                                        break;
+
+                                default:
+                                        assert_not_reached("Wut? I shouldn't exist.");
+                                }
+
                                 break;
+                        }
 
                         case WAKEUP_CLOCK_DATA: {
-                                struct clock_data *d = ev_queue[i].data.ptr;
-                                r = flush_timer(e, d->fd, ev_queue[i].events, &d->next);
+                                struct clock_data *d = e->event_queue[i].data.ptr;
+                                r = flush_timer(e, d->fd, e->event_queue[i].events, &d->next);
                                 break;
                         }
 
                         case WAKEUP_SIGNAL_DATA:
-                                r = process_signal(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                                r = process_signal(e, e->event_queue[i].data.ptr, e->event_queue[i].events);
                                 break;
 
                         case WAKEUP_INOTIFY_DATA:
-                                r = event_inotify_data_read(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                                r = event_inotify_data_read(e, e->event_queue[i].data.ptr, e->event_queue[i].events);
+                                break;
+
+                        case WAKEUP_WORK_DATA:
+                                r = process_work(e, e->event_queue[i].data.ptr, e->event_queue[i].events);
                                 break;
 
                         default:
@@ -3175,6 +3794,12 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
         if (r < 0)
                 goto finish;
 
+        /* Bring rate limited sources back first, so that time event sources among them are considered
+         * right away */
+        r = process_ratelimited(e, e->timestamp.monotonic);
+        if (r < 0)
+                goto finish;
+
         r = process_timer(e, e->timestamp.realtime, &e->realtime);
         if (r < 0)
                 goto finish;
@@ -3235,10 +3860,34 @@ _public_ int sd_event_dispatch(sd_event *e) {
         p = event_next_pending(e);
         if (p) {
                 _cleanup_(sd_event_unrefp) sd_event *ref = NULL;
+                int64_t priority;
 
                 ref = sd_event_ref(e);
                 e->state = SD_EVENT_RUNNING;
-                r = source_dispatch(p);
+
+                priority = p->priority;
+
+                for (;;) {
+                        p->dispatch_iteration = e->iteration;
+                        prioq_reshuffle(e->pending, p, &p->pending_index);
+
+                        r = source_dispatch(p);
+                        if (r < 0)
+                                break;
+
+                        /* In batch mode, continue with all other sources of the same priority that are
+                         * pending, without going through another prepare/wait cycle first. Each source is
+                         * dispatched at most once per iteration, so that sources which are always pending
+                         * (such as defer sources) cannot keep us here forever. Those that were already
+                         * dispatched sort last, see pending_prioq_compare(). */
+                        if (!e->batch_dispatch || e->exit_requested)
+                                break;
+
+                        p = event_next_pending(e);
+                        if (!p || p->priority != priority || p->dispatch_iteration == e->iteration)
+                                break;
+                }
+
                 e->state = SD_EVENT_INITIAL;
                 return r;
         }
@@ -3495,6 +4144,144 @@ _public_ int sd_event_get_watchdog(sd_event *e) {
         return e->watchdog;
 }
 
+_public_ int sd_event_set_batch_dispatch(sd_event *e, int b) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        e->batch_dispatch = b;
+        return 0;
+}
+
+_public_ int sd_event_get_batch_dispatch(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->batch_dispatch;
+}
+
+_public_ int sd_event_set_statistics(sd_event *e, int b) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        /* The accounting costs at most three reads of CLOCK_MONOTONIC per dispatched event source: one
+         * when the source becomes pending, and one each before and after its callback. That's cheap enough
+         * for daemons to keep it turned on all the time. */
+        e->statistics = b;
+        return 0;
+}
+
+static int event_source_dispatch_usec_compare(sd_event_source * const *a, sd_event_source * const *b) {
+        /* Most expensive sources first */
+        return -CMP((*a)->dispatch_usec, (*b)->dispatch_usec);
+}
+
+_public_ int sd_event_get_statistics(sd_event *e, char **ret) {
+        _cleanup_free_ sd_event_source **sources = NULL;
+        _cleanup_free_ char *dump = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        sd_event_source *s;
+        size_t n = 0, size, i;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (!e->statistics)
+                return -ENODATA;
+
+        sources = new(sd_event_source*, MAX(e->n_sources, 1u));
+        if (!sources)
+                return -ENOMEM;
+
+        LIST_FOREACH(sources, s, e->sources)
+                sources[n++] = s;
+
+        typesafe_qsort(sources, n, event_source_dispatch_usec_compare);
+
+        f = open_memstream_unlocked(&dump, &size);
+        if (!f)
+                return -ENOMEM;
+
+        fprintf(f, "%-32s %-10s %8s %10s %12s %12s %12s\n",
+                "DESCRIPTION", "TYPE", "PRIORITY", "DISPATCHED", "RUNTIME", "MAX", "PENDING");
+
+        for (i = 0; i < n; i++) {
+                char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_TIMESPAN_MAX];
+
+                s = sources[i];
+
+                fprintf(f, "%-32s %-10s %8" PRIi64 " %10" PRIu64 " %12s %12s %12s\n",
+                        strna(s->description),
+                        event_source_type_to_string(s->type),
+                        s->priority,
+                        s->n_dispatched,
+                        format_timespan(a, sizeof(a), s->dispatch_usec, 1),
+                        format_timespan(b, sizeof(b), s->dispatch_usec_max, 1),
+                        format_timespan(c, sizeof(c), s->pending_usec, 1));
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return r;
+
+        f = safe_fclose(f);
+
+        *ret = TAKE_PTR(dump);
+        return 0;
+}
+
+_public_ int sd_event_set_work_threads_max(sd_event *e, unsigned n) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(n <= EVENT_WORK_THREADS_MAX, -ERANGE);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (n == 0 && e->work) {
+                sd_event_source *s;
+
+                /* Going back to the default, release the pool and its threads, a new one is set up when
+                 * work is queued the next time. That's only possible while no work is outstanding. */
+                LIST_FOREACH(sources, s, e->sources)
+                        if (s->type == SOURCE_WORK && (s->work.item || s->pending))
+                                return -EBUSY;
+
+                event_free_work(e);
+        }
+
+        e->work_threads_max = n;
+
+        if (e->work && n > 0)
+                event_work_pool_set_threads_max(e->work->pool, n);
+
+        return 0;
+}
+
+_public_ int sd_event_get_work_threads_max(sd_event *e, unsigned *ret) {
+        long n;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->work_threads_max > 0) {
+                *ret = e->work_threads_max;
+                return 0;
+        }
+
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        *ret = n > 0 ? MIN((unsigned long) n, EVENT_WORK_THREADS_MAX) : 1;
+        return 0;
+}
+
 _public_ int sd_event_get_iteration(sd_event *e, uint64_t *ret) {
         assert_return(e, -EINVAL);
         assert_return(e = event_resolve(e), -ENOPKG);
@@ -3547,3 +4334,52 @@ _public_ int sd_event_source_set_floating(sd_event_source *s, int b) {
 
         return 1;
 }
+
+_public_ int sd_event_source_set_ratelimit(sd_event_source *s, uint64_t interval_usec, unsigned burst) {
+        int r;
+
+        assert_return(s, -EINVAL);
+        assert_return(EVENT_SOURCE_CAN_RATE_LIMIT(s->type), -EDOM);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        /* A new limit starts with a clean slate, hence end any period the old one imposed */
+        if (s->ratelimited) {
+                r = event_source_leave_ratelimit(s);
+                if (r < 0)
+                        return r;
+        }
+
+        RATELIMIT_INIT(s->rate_limit, interval_usec, burst);
+        return 0;
+}
+
+_public_ int sd_event_source_get_ratelimit(sd_event_source *s, uint64_t *ret_interval_usec, unsigned *ret_burst) {
+        assert_return(s, -EINVAL);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        if (s->rate_limit.interval == 0 || s->rate_limit.burst == 0)
+                return -ENODATA;
+
+        if (ret_interval_usec)
+                *ret_interval_usec = s->rate_limit.interval;
+        if (ret_burst)
+                *ret_burst = s->rate_limit.burst;
+
+        return 0;
+}
+
+_public_ int sd_event_source_is_ratelimited(sd_event_source *s) {
+        assert_return(s, -EINVAL);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        return s->ratelimited;
+}
+
+_public_ int sd_event_source_set_ratelimit_callback(sd_event_source *s, sd_event_handler_t callback) {
+        assert_return(s, -EINVAL);
+        assert_return(EVENT_SOURCE_CAN_RATE_LIMIT(s->type), -EDOM);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        s->ratelimit_callback = callback;
+        return 0;
+}
@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 
 #include "sd-event.h"
@@ -187,6 +189,7 @@ static void test_basic(void) {
         assert_se(got_unref);
 
         got_a = false, got_b = false, got_c = false, got_d = 0;
+        do_quit = false, got_post = false, got_exit = false;
 
         /* Add a oneshot handler, trigger it, reenable it, and trigger
          * it again. */
@@ -482,6 +485,662 @@ static void test_inotify(unsigned n_create_events) {
         sd_event_unref(e);
 }
 
+static int dummy_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        return 0;
+}
+
+static void test_io_unpollable(void) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_close_ int fd = -1;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        fd = open("/proc/self/cmdline", O_RDONLY|O_CLOEXEC);
+        assert_se(fd >= 0);
+
+        /* Regular files cannot be polled, and some callers rely on being told so */
+        assert_se(sd_event_add_io(e, NULL, fd, EPOLLIN, dummy_io_handler, NULL) == -EPERM);
+}
+
+static unsigned n_time_benchmark = 0;
+
+static int time_benchmark_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        n_time_benchmark++;
+        return 0;
+}
+
+static void test_time_benchmark(void) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_free_ sd_event_source **sources = NULL;
+        char buf[FORMAT_TIMESPAN_MAX];
+        const size_t n = 100000;
+        usec_t base, ts;
+        unsigned k;
+        size_t i;
+
+        if (!slow_tests_enabled()) {
+                log_info("/* %s (skipped, slow tests disabled) */", __func__);
+                return;
+        }
+
+#define RANDOM_TIME() (base + USEC_PER_HOUR + (usec_t) rand() % USEC_PER_HOUR)
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_now(e, CLOCK_MONOTONIC, &base) >= 0);
+
+        sources = new0(sd_event_source*, n);
+        assert_se(sources);
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+                assert_se(sd_event_add_time(e, sources + i, CLOCK_MONOTONIC, RANDOM_TIME(), 0, time_benchmark_handler, NULL) >= 0);
+        log_info("Adding %zu timers: %s", n, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (k = 0; k < 10; k++)
+                for (i = 0; i < n; i++)
+                        assert_se(sd_event_source_set_time(sources[i], RANDOM_TIME()) >= 0);
+        log_info("Moving %zu timers 10x: %s", n, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        /* This is what event_reset_time() does */
+        ts = now(CLOCK_MONOTONIC);
+        for (k = 0; k < 10; k++)
+                for (i = 0; i < n; i++) {
+                        assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_OFF) >= 0);
+                        assert_se(sd_event_source_set_time(sources[i], RANDOM_TIME()) >= 0);
+                        assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_ONESHOT) >= 0);
+                }
+        log_info("Resetting %zu timers 10x: %s", n, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        /* Most timers of a big PID 1 are disabled most of the time, while few of them are moved a lot */
+        for (i = 1000; i < n; i++)
+                assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_OFF) >= 0);
+
+        ts = now(CLOCK_MONOTONIC);
+        for (k = 0; k < 100; k++)
+                for (i = 0; i < 1000; i++)
+                        assert_se(sd_event_source_set_time(sources[i], RANDOM_TIME()) >= 0);
+        log_info("Moving 1000 of %zu timers 100x: %s", n, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (k = 0; k < 10; k++)
+                for (i = 1000; i < n; i++)
+                        assert_se(sd_event_source_set_time(sources[i], RANDOM_TIME()) >= 0);
+        log_info("Moving %zu disabled timers 10x: %s", n - 1000, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - ts, 1));
+
+        /* Let a few of them elapse, each iteration dispatches one */
+        for (i = 0; i < 100; i++)
+                assert_se(sd_event_source_set_time(sources[i], base) >= 0);
+
+        for (k = 0; k < 100; k++)
+                assert_se(sd_event_run(e, 0) > 0);
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(n_time_benchmark == 100);
+
+        for (i = 0; i < n; i++)
+                sd_event_source_unref(sources[i]);
+
+#undef RANDOM_TIME
+}
+
+static unsigned n_batch = 0;
+static int64_t last_batch_priority = 0;
+
+static int batch_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        int64_t priority;
+        uint64_t x;
+
+        assert_se(read(fd, &x, sizeof(x)) == sizeof(x));
+
+        /* Batching must not break priority ordering */
+        assert_se(sd_event_source_get_priority(s, &priority) >= 0);
+        assert_se(priority >= last_batch_priority);
+        last_batch_priority = priority;
+
+        n_batch++;
+        return 0;
+}
+
+static void test_batch_dispatch_one(bool batch, size_t n) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_free_ sd_event_source **sources = NULL;
+        _cleanup_free_ int *fds = NULL;
+        char buf[FORMAT_TIMESPAN_MAX];
+        unsigned n_runs = 0;
+        usec_t ts;
+        size_t i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_batch_dispatch(e, batch) >= 0);
+        assert_se(sd_event_get_batch_dispatch(e) == batch);
+
+        sources = new0(sd_event_source*, n);
+        assert_se(sources);
+        fds = new(int, n);
+        assert_se(fds);
+
+        /* Two halves at different priorities, everything ready right away */
+        for (i = 0; i < n; i++) {
+                fds[i] = eventfd(1, EFD_CLOEXEC|EFD_NONBLOCK);
+                assert_se(fds[i] >= 0);
+
+                assert_se(sd_event_add_io(e, sources + i, fds[i], EPOLLIN, batch_handler, NULL) >= 0);
+                assert_se(sd_event_source_set_priority(sources[i], i < n / 2 ? 0 : 1) >= 0);
+        }
+
+        n_batch = 0;
+        last_batch_priority = 0;
+
+        ts = now(CLOCK_MONOTONIC);
+        while (n_batch < n) {
+                assert_se(sd_event_run(e, 0) > 0);
+                n_runs++;
+        }
+        ts = now(CLOCK_MONOTONIC) - ts;
+
+        log_info("%s: dispatching %zu ready sources took %u iterations, %s",
+                 batch ? "batched" : "unbatched", n, n_runs, format_timespan(buf, sizeof(buf), ts, 1));
+
+        assert_se(n_runs == (batch ? 2 : n));
+
+        for (i = 0; i < n; i++) {
+                sd_event_source_unref(sources[i]);
+                safe_close(fds[i]);
+        }
+}
+
+static unsigned n_batch_defer = 0;
+
+static int batch_defer_handler(sd_event_source *s, void *userdata) {
+        n_batch_defer++;
+        return 0;
+}
+
+static void test_batch_dispatch_defer(size_t n) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *d = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_free_ sd_event_source **sources = NULL;
+        _cleanup_free_ int *fds = NULL;
+        size_t i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_batch_dispatch(e, true) >= 0);
+
+        sources = new0(sd_event_source*, n);
+        assert_se(sources);
+        fds = new(int, n);
+        assert_se(fds);
+
+        /* A defer source that is always pending must not end the batch early, nor starve the others */
+        assert_se(sd_event_add_defer(e, &d, batch_defer_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_enabled(d, SD_EVENT_ON) >= 0);
+
+        for (i = 0; i < n; i++) {
+                fds[i] = eventfd(1, EFD_CLOEXEC|EFD_NONBLOCK);
+                assert_se(fds[i] >= 0);
+
+                assert_se(sd_event_add_io(e, sources + i, fds[i], EPOLLIN, batch_handler, NULL) >= 0);
+        }
+
+        n_batch = n_batch_defer = 0;
+        last_batch_priority = 0;
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch == n);
+        assert_se(n_batch_defer == 1);
+
+        /* In the next iteration it's the defer source's turn first again, but only once */
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_defer == 2);
+
+        for (i = 0; i < n; i++) {
+                sd_event_source_unref(sources[i]);
+                safe_close(fds[i]);
+        }
+}
+
+static void test_batch_dispatch(void) {
+        struct rlimit rl;
+
+        test_batch_dispatch_one(true, 100);
+        test_batch_dispatch_defer(100);
+
+        /* The rest only compares timings */
+        if (!slow_tests_enabled()) {
+                log_info("/* %s (skipped, slow tests disabled) */", __func__);
+                return;
+        }
+
+        test_batch_dispatch_one(false, 2000);
+        test_batch_dispatch_one(true, 2000);
+
+        /* We need a lot of fds for this one */
+        assert_se(getrlimit(RLIMIT_NOFILE, &rl) >= 0);
+        rl.rlim_cur = rl.rlim_max;
+        (void) setrlimit(RLIMIT_NOFILE, &rl);
+        assert_se(getrlimit(RLIMIT_NOFILE, &rl) >= 0);
+
+        test_batch_dispatch_one(true, MIN(10000U, rl.rlim_cur - 100));
+}
+
+static unsigned n_children_exited = 0;
+
+static int child_benchmark_handler(sd_event_source *s, const siginfo_t *si, void *userdata) {
+        assert_se(si->si_code == CLD_EXITED);
+        assert_se(si->si_status == EXIT_SUCCESS);
+
+        n_children_exited++;
+        return 0;
+}
+
+static void test_child_benchmark_one(bool pidfd, size_t n) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_close_pair_ int p[2] = { -1, -1 };
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t ts;
+        size_t i;
+
+        assert_se(setenv("SD_EVENT_PIDFD", one_zero(pidfd), 1) >= 0);
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(unsetenv("SD_EVENT_PIDFD") >= 0);
+
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+
+        /* Each child waits for one byte on the pipe before it exits, so that they exit one by one while
+         * all others are still around */
+        for (i = 0; i < n; i++) {
+                pid_t pid;
+
+                pid = fork();
+                assert_se(pid >= 0);
+
+                if (pid == 0) {
+                        char c;
+
+                        p[1] = safe_close(p[1]);
+                        _exit(read(p[0], &c, 1) == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+                }
+
+                assert_se(sd_event_add_child(e, NULL, pid, WEXITED, child_benchmark_handler, NULL) >= 0);
+        }
+
+        n_children_exited = 0;
+
+        /* Let them go one at a time, and wait for each before releasing the next one */
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                assert_se(write(p[1], "x", 1) == 1);
+
+                while (n_children_exited <= i)
+                        assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        }
+        ts = now(CLOCK_MONOTONIC) - ts;
+
+        assert_se(n_children_exited == n);
+
+        log_info("%s: %zu children exited and reaped in %s",
+                 pidfd ? "pidfd" : "SIGCHLD", n, format_timespan(buf, sizeof(buf), ts, 1));
+}
+
+static void test_child_benchmark(void) {
+        assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGCHLD, -1) >= 0);
+
+        test_child_benchmark_one(false, 5);
+        test_child_benchmark_one(true, 5);
+
+        /* The rest only compares timings */
+        if (!slow_tests_enabled()) {
+                log_info("/* %s (skipped, slow tests disabled) */", __func__);
+                return;
+        }
+
+        test_child_benchmark_one(false, 500);
+        test_child_benchmark_one(true, 500);
+}
+
+static int statistics_handler(sd_event_source *s, void *userdata) {
+        return 0;
+}
+
+static void test_statistics(void) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *x = NULL, *y = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_free_ char *dump = NULL;
+        const char *line;
+        unsigned n, i;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        /* Accounting is opt-in */
+        assert_se(sd_event_get_statistics(e, &dump) == -ENODATA);
+        assert_se(sd_event_set_statistics(e, true) >= 0);
+
+        assert_se(sd_event_add_defer(e, &x, statistics_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_description(x, "statistics-defer") >= 0);
+        assert_se(sd_event_source_set_enabled(x, SD_EVENT_ON) >= 0);
+        assert_se(sd_event_source_set_priority(x, SD_EVENT_PRIORITY_IDLE) >= 0);
+
+        assert_se(sd_event_add_post(e, &y, statistics_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_description(y, "statistics-post") >= 0);
+
+        /* The post source is dispatched in every second iteration, after the defer source */
+        for (i = 0; i < 10; i++)
+                assert_se(sd_event_run(e, 0) > 0);
+
+        assert_se(sd_event_get_statistics(e, &dump) >= 0);
+        log_info("%s", dump);
+
+        assert_se(line = strstr(dump, "\nstatistics-defer "));
+        assert_se(sscanf(line, " statistics-defer defer %*d %u", &n) == 1);
+        assert_se(n == 5);
+
+        assert_se(line = strstr(dump, "\nstatistics-post "));
+        assert_se(sscanf(line, " statistics-post post %*d %u", &n) == 1);
+        assert_se(n == 5);
+}
+
+static int ratelimit_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        unsigned *c = userdata;
+
+        /* Never drain the pipe, so that the source stays ready forever */
+        (*c)++;
+        return 0;
+}
+
+static int ratelimit_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        unsigned *c = userdata;
+
+        (*c)++;
+        return sd_event_source_set_enabled(s, SD_EVENT_ON);
+}
+
+static int ratelimit_callback(sd_event_source *s, void *userdata) {
+        unsigned *c = userdata;
+
+        c[2]++;
+        return 0;
+}
+
+static void test_ratelimit(void) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *x = NULL, *y = NULL, *z = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_close_pair_ int p[2] = { -1, -1 };
+        unsigned counters[3] = {}, burst;
+        uint64_t interval;
+        usec_t start;
+        unsigned i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(pipe2(p, O_CLOEXEC|O_NONBLOCK) >= 0);
+        assert_se(write(p[1], "x", 1) == 1);
+
+        assert_se(sd_event_add_io(e, &x, p[0], EPOLLIN, ratelimit_io_handler, &counters[0]) >= 0);
+        assert_se(sd_event_source_get_ratelimit(x, NULL, NULL) == -ENODATA);
+        assert_se(sd_event_source_set_ratelimit(x, 200 * USEC_PER_MSEC, 5) >= 0);
+        assert_se(sd_event_source_get_ratelimit(x, &interval, &burst) >= 0);
+        assert_se(interval == 200 * USEC_PER_MSEC && burst == 5);
+        assert_se(sd_event_source_set_ratelimit_callback(x, ratelimit_callback) >= 0);
+
+        /* Signal sources cannot be rate limited */
+        assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGUSR2, -1) >= 0);
+        assert_se(sd_event_add_signal(e, &z, SIGUSR2, NULL, NULL) >= 0);
+        assert_se(sd_event_source_set_ratelimit(z, USEC_PER_SEC, 1) == -EDOM);
+        assert_se(sd_event_source_set_ratelimit_callback(z, ratelimit_callback) == -EDOM);
+
+        start = now(CLOCK_MONOTONIC);
+
+        /* The source is ready all the time, but dispatched only five times in the first interval, and then
+         * left alone until it ends */
+        for (i = 0; i < 20; i++)
+                (void) sd_event_run(e, 0);
+
+        assert_se(counters[0] == 5);
+        assert_se(counters[2] == 1);
+        assert_se(sd_event_source_is_ratelimited(x) > 0);
+
+        /* Nothing else is ready, hence this sleeps until the limit ends, give or take spurious wakeups */
+        while (sd_event_source_is_ratelimited(x) > 0)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        assert_se(now(CLOCK_MONOTONIC) - start >= 200 * USEC_PER_MSEC);
+        assert_se(sd_event_source_is_ratelimited(x) == 0);
+
+        for (i = 0; i < 20 && counters[0] < 10; i++)
+                (void) sd_event_run(e, 0);
+        assert_se(counters[0] == 10);
+
+        for (i = 0; i < 20; i++)
+                (void) sd_event_run(e, 0);
+        assert_se(counters[0] == 10);
+        assert_se(counters[2] == 2);
+
+        /* Turning the limit off brings the source back right away */
+        assert_se(sd_event_source_is_ratelimited(x) > 0);
+        assert_se(sd_event_source_set_ratelimit(x, 0, 0) >= 0);
+        assert_se(sd_event_source_is_ratelimited(x) == 0);
+        for (i = 0; i < 20; i++)
+                assert_se(sd_event_run(e, 0) > 0);
+        assert_se(counters[0] == 30);
+
+        /* The same for a timer that elapses immediately, again and again */
+        x = sd_event_source_disable_unref(x);
+        assert_se(sd_event_add_time(e, &y, CLOCK_MONOTONIC, 0, 0, ratelimit_time_handler, &counters[1]) >= 0);
+        assert_se(sd_event_source_set_ratelimit(y, 200 * USEC_PER_MSEC, 3) >= 0);
+
+        for (i = 0; i < 20; i++)
+                (void) sd_event_run(e, 0);
+        assert_se(counters[1] == 3);
+        assert_se(sd_event_source_is_ratelimited(y) > 0);
+
+        while (sd_event_source_is_ratelimited(y) > 0)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        assert_se(counters[1] == 4);
+}
+
+static unsigned n_work_running = 0, n_work_running_max = 0;
+
+static int work_func(void *userdata) {
+        unsigned n;
+
+        /* Runs in a worker thread, hence only touch atomics here */
+        n = __atomic_add_fetch(&n_work_running, 1, __ATOMIC_SEQ_CST);
+        for (unsigned m = __atomic_load_n(&n_work_running_max, __ATOMIC_SEQ_CST); n > m; )
+                if (__atomic_compare_exchange_n(&n_work_running_max, &m, n, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                        break;
+
+        (void) usleep(20 * USEC_PER_MSEC);
+
+        __atomic_sub_fetch(&n_work_running, 1, __ATOMIC_SEQ_CST);
+        return PTR_TO_INT(userdata) * 2;
+}
+
+static int work_cancelled_func(void *userdata) {
+        bool *ran = userdata;
+
+        *ran = true;
+        return 0;
+}
+
+static unsigned n_work_done = 0;
+static int work_result_sum = 0;
+
+static int work_done_handler(sd_event_source *s, int result, void *userdata) {
+        n_work_done++;
+        work_result_sum += result;
+        return 0;
+}
+
+static int work_again_func(void *userdata) {
+        return 0;
+}
+
+static int work_again_handler(sd_event_source *s, int result, void *userdata) {
+        unsigned *c = userdata;
+
+        /* Run the work function once more, then let the source go off */
+        if (++(*c) == 1)
+                return sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+
+        return 0;
+}
+
+static void test_work(void) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *x = NULL, *y = NULL, *z = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        unsigned n, again = 0;
+        bool ran = false;
+        pid_t pid;
+        int i, m;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(sd_event_get_work_threads_max(e, &n) >= 0);
+        assert_se(n >= 1 && n <= 16);
+        assert_se(sd_event_set_work_threads_max(e, 17) == -ERANGE);
+        assert_se(sd_event_set_work_threads_max(e, 2) >= 0);
+        assert_se(sd_event_get_work_threads_max(e, &n) >= 0);
+        assert_se(n == 2);
+
+        /* Six items, but never more than two of them at a time */
+        for (i = 1; i <= 6; i++)
+                assert_se(sd_event_add_work(e, NULL, work_func, work_done_handler, INT_TO_PTR(i)) >= 0);
+
+        while (n_work_done < 6)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        assert_se(work_result_sum == 2 * (1 + 2 + 3 + 4 + 5 + 6));
+        assert_se(n_work_running_max == 2);
+
+        /* With a single thread, x keeps it busy while y and z wait in the queue. y is cancelled before it
+         * ever runs, x while it is running. Only z is reported back. */
+        assert_se(sd_event_set_work_threads_max(e, 1) >= 0);
+        n_work_done = 0;
+        work_result_sum = 0;
+
+        assert_se(sd_event_add_work(e, &x, work_func, work_done_handler, INT_TO_PTR(10)) >= 0);
+        assert_se(sd_event_source_get_enabled(x, &m) > 0);
+        assert_se(m == SD_EVENT_ONESHOT);
+        assert_se(sd_event_add_work(e, &y, work_cancelled_func, work_done_handler, &ran) >= 0);
+        assert_se(sd_event_add_work(e, &z, work_func, work_done_handler, INT_TO_PTR(100)) >= 0);
+
+        y = sd_event_source_unref(y);
+        x = sd_event_source_unref(x);
+
+        while (n_work_done < 1)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        assert_se(!ran);
+        assert_se(work_result_sum == 200);
+        assert_se(sd_event_source_get_enabled(z, NULL) == 0);
+
+        /* Reenabling a work source runs the work function once more */
+        z = sd_event_source_unref(z);
+        assert_se(sd_event_add_work(e, &z, work_again_func, work_again_handler, &again) >= 0);
+
+        while (again < 2)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        assert_se(sd_event_source_get_enabled(z, NULL) == 0);
+
+        /* Going back to the default releases the pool, unless work is outstanding. It's set up again once
+         * work is queued. */
+        assert_se(sd_event_set_work_threads_max(e, 0) >= 0);
+        assert_se(sd_event_source_set_enabled(z, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_set_work_threads_max(e, 0) == -EBUSY);
+
+        while (again < 3)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        assert_se(sd_event_set_work_threads_max(e, 0) >= 0);
+
+        /* Freeing the loop waits for items still running, but not in a forked off child, where the threads
+         * don't exist */
+        assert_se(sd_event_add_work(e, NULL, work_func, NULL, INT_TO_PTR(1)) >= 0);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                z = sd_event_source_unref(z);
+                e = sd_event_unref(e);
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(wait_for_terminate_and_check("work-child", pid, WAIT_LOG) == EXIT_SUCCESS);
+}
+
+static usec_t work_latency_max = 0;
+static unsigned n_work_blocking = 0;
+
+static int work_latency_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        usec_t n;
+
+        n = now(CLOCK_MONOTONIC);
+        work_latency_max = MAX(work_latency_max, n - usec);
+
+        assert_se(sd_event_source_set_time(s, n + 5 * USEC_PER_MSEC) >= 0);
+        return sd_event_source_set_enabled(s, SD_EVENT_ON);
+}
+
+static int work_blocking(void *userdata) {
+        /* Stand-in for a blocking operation, e.g. some synchronous disk I/O */
+        (void) usleep(20 * USEC_PER_MSEC);
+        return 0;
+}
+
+static int work_blocking_defer_handler(sd_event_source *s, void *userdata) {
+        (void) work_blocking(NULL);
+
+        if (++n_work_blocking >= 20)
+                return sd_event_source_set_enabled(s, SD_EVENT_OFF);
+
+        return 0;
+}
+
+static int work_blocking_done_handler(sd_event_source *s, int result, void *userdata) {
+        n_work_blocking++;
+        return 0;
+}
+
+static void test_work_latency_one(bool offload) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *t = NULL, *d = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        char buf[FORMAT_TIMESPAN_MAX];
+        unsigned i;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        /* A periodic timer stands in for everything else the loop is supposed to react to in time */
+        assert_se(sd_event_add_time(e, &t, CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + 5 * USEC_PER_MSEC, 1,
+                                    work_latency_time_handler, NULL) >= 0);
+
+        if (offload)
+                for (i = 0; i < 20; i++)
+                        assert_se(sd_event_add_work(e, NULL, work_blocking, work_blocking_done_handler, NULL) >= 0);
+        else {
+                /* Even at idle priority the timer has to wait for each operation to finish */
+                assert_se(sd_event_add_defer(e, &d, work_blocking_defer_handler, NULL) >= 0);
+                assert_se(sd_event_source_set_enabled(d, SD_EVENT_ON) >= 0);
+                assert_se(sd_event_source_set_priority(d, SD_EVENT_PRIORITY_IDLE) >= 0);
+        }
+
+        work_latency_max = 0;
+        n_work_blocking = 0;
+
+        while (n_work_blocking < 20)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        log_info("%s: 20 blocking operations of 20ms, timer latency at most %s",
+                 offload ? "offloaded" : "inline", format_timespan(buf, sizeof(buf), work_latency_max, 1));
+}
+
+static void test_work_latency(void) {
+        if (!slow_tests_enabled()) {
+                log_info("/* %s (skipped, slow tests disabled) */", __func__);
+                return;
+        }
+
+        test_work_latency_one(false);
+        test_work_latency_one(true);
+}
+
 int main(int argc, char *argv[]) {
         test_setup_logging(LOG_INFO);
 
@@ -492,5 +1151,15 @@ int main(int argc, char *argv[]) {
         test_inotify(100); /* should work without overflow */
         test_inotify(33000); /* should trigger a q overflow */
 
+        test_time_benchmark();
+        test_batch_dispatch();
+        test_child_benchmark();
+        test_statistics();
+        test_ratelimit();
+        test_work();
+        test_work_latency();
+
+        test_io_unpollable();
+
         return 0;
 }
@@ -5460,6 +5460,7 @@ static int show_one(
                 sd_bus *bus,
                 const char *path,
                 const char *unit,
+                sd_bus_message *properties,
                 SystemctlShowMode show_mode,
                 bool *new_line,
                 bool *ellipsized) {
@@ -5577,15 +5578,26 @@ static int show_one(
 
         log_debug("Showing one %s", path);
 
-        r = bus_map_all_properties(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        show_mode == SYSTEMCTL_SHOW_STATUS ? status_map : property_map,
-                        BUS_MAP_BOOLEAN_AS_BOOL,
-                        &error,
-                        &reply,
-                        &info);
+        /* The properties might have been fetched in bulk already, see get_units_properties() */
+        if (properties) {
+                reply = sd_bus_message_ref(properties);
+
+                r = bus_message_map_all_properties(
+                                reply,
+                                show_mode == SYSTEMCTL_SHOW_STATUS ? status_map : property_map,
+                                BUS_MAP_BOOLEAN_AS_BOOL,
+                                &error,
+                                &info);
+        } else
+                r = bus_map_all_properties(
+                                bus,
+                                "org.freedesktop.systemd1",
+                                path,
+                                show_mode == SYSTEMCTL_SHOW_STATUS ? status_map : property_map,
+                                BUS_MAP_BOOLEAN_AS_BOOL,
+                                &error,
+                                &reply,
+                                &info);
         if (r < 0)
                 return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
 
@@ -5666,15 +5678,140 @@ static int get_unit_dbus_path_by_pid(
         return 0;
 }
 
+DEFINE_PRIVATE_HASH_OPS_FULL(unit_properties_hash_ops, char, string_hash_func, string_compare_func, free,
+                             sd_bus_message, sd_bus_message_unref);
+
+static int get_units_properties(
+                sd_bus *bus,
+                char **names,
+                SystemctlShowMode show_mode,
+                Hashmap **ret) {
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *reply = NULL;
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(hashmap_freep) Hashmap *h = NULL;
+        _cleanup_strv_free_ char **properties = NULL;
+        int r;
+
+        assert(bus);
+        assert(ret);
+
+        /* Fetches the properties of all listed units with a single call, and splits the reply up into one
+         * message per unit, which show_one() then consumes as if it had called GetAll() itself. With many
+         * units this is a lot cheaper for both sides. If the service manager is too old to know the method,
+         * or the call fails for any other reason, we return 0 and the caller falls back to querying the
+         * units one by one, which also takes care of reporting errors properly per unit. */
+
+        if (strv_length(names) <= 1)
+                goto fallback;
+
+        /* When only specific properties are shown we don't need the others, except for those show_one()
+         * looks at in any case */
+        if (show_mode == SYSTEMCTL_SHOW_PROPERTIES && !strv_isempty(arg_properties)) {
+                properties = strv_copy(arg_properties);
+                if (!properties)
+                        return log_oom();
+
+                r = strv_extend_strv(&properties, STRV_MAKE("LoadState", "ActiveState", "Documentation"), true);
+                if (r < 0)
+                        return log_oom();
+        }
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        &m,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "GetUnitsProperties");
+        if (r < 0)
+                return bus_log_create_error(r);
+
+        r = sd_bus_message_append_strv(m, names);
+        if (r < 0)
+                return bus_log_create_error(r);
+
+        r = sd_bus_message_append_strv(m, properties);
+        if (r < 0)
+                return bus_log_create_error(r);
+
+        r = sd_bus_call(bus, m, 0, &error, &reply);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to get properties of units in bulk, querying them one by one: %s", bus_error_message(&error, r));
+                goto fallback;
+        }
+
+        h = hashmap_new(&unit_properties_hash_ops);
+        if (!h)
+                return log_oom();
+
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(sa{sv})");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        while ((r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_STRUCT, "sa{sv}")) > 0) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *p = NULL;
+                _cleanup_free_ char *n = NULL;
+                const char *name;
+
+                r = sd_bus_message_read(reply, "s", &name);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                r = sd_bus_message_new(bus, &p, SD_BUS_MESSAGE_METHOD_RETURN);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_copy(p, reply, false);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                r = sd_bus_message_seal(p, 0, 0);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_rewind(p, true);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                n = strdup(name);
+                if (!n)
+                        return log_oom();
+
+                r = hashmap_put(h, n, p);
+                if (r < 0)
+                        return log_oom();
+                if (r > 0) {
+                        n = NULL;
+                        p = NULL;
+                }
+
+                r = sd_bus_message_exit_container(reply);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        *ret = TAKE_PTR(h);
+        return 1;
+
+fallback:
+        *ret = NULL;
+        return 0;
+}
+
 static int show_all(
                 sd_bus *bus,
                 bool *new_line,
                 bool *ellipsized) {
 
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(hashmap_freep) Hashmap *properties = NULL;
         _cleanup_free_ UnitInfo *unit_infos = NULL;
+        _cleanup_free_ char **names = NULL;
         const UnitInfo *u;
-        unsigned c;
+        unsigned c, i;
         int r, ret = 0;
 
         r = get_unit_list(bus, NULL, NULL, &unit_infos, 0, &reply);
@@ -5687,6 +5824,18 @@ static int show_all(
 
         typesafe_qsort(unit_infos, c, compare_unit_info);
 
+        names = new(char*, c + 1);
+        if (!names)
+                return log_oom();
+
+        for (i = 0; i < c; i++)
+                names[i] = (char*) unit_infos[i].id;
+        names[c] = NULL;
+
+        r = get_units_properties(bus, names, SYSTEMCTL_SHOW_STATUS, &properties);
+        if (r < 0)
+                return r;
+
         for (u = unit_infos; u < unit_infos + c; u++) {
                 _cleanup_free_ char *p = NULL;
 
@@ -5694,7 +5843,7 @@ static int show_all(
                 if (!p)
                         return log_oom();
 
-                r = show_one(bus, p, u->id, SYSTEMCTL_SHOW_STATUS, new_line, ellipsized);
+                r = show_one(bus, p, u->id, hashmap_get(properties, u->id), SYSTEMCTL_SHOW_STATUS, new_line, ellipsized);
                 if (r < 0)
                         return r;
                 else if (r > 0 && ret == 0)
@@ -5795,7 +5944,7 @@ static int show(int argc, char *argv[], void *userdata) {
 
         /* If no argument is specified inspect the manager itself */
         if (show_mode == SYSTEMCTL_SHOW_PROPERTIES && argc <= 1)
-                return show_one(bus, "/org/freedesktop/systemd1", NULL, show_mode, &new_line, &ellipsized);
+                return show_one(bus, "/org/freedesktop/systemd1", NULL, NULL, show_mode, &new_line, &ellipsized);
 
         if (show_mode == SYSTEMCTL_SHOW_STATUS && argc <= 1) {
 
@@ -5835,7 +5984,7 @@ static int show(int argc, char *argv[], void *userdata) {
                                         return log_oom();
                         }
 
-                        r = show_one(bus, path, unit, show_mode, &new_line, &ellipsized);
+                        r = show_one(bus, path, unit, NULL, show_mode, &new_line, &ellipsized);
                         if (r < 0)
                                 return r;
                         else if (r > 0 && ret == 0)
@@ -5843,12 +5992,17 @@ static int show(int argc, char *argv[], void *userdata) {
                 }
 
                 if (!strv_isempty(patterns)) {
+                        _cleanup_(hashmap_freep) Hashmap *properties = NULL;
                         _cleanup_strv_free_ char **names = NULL;
 
                         r = expand_names(bus, patterns, NULL, &names);
                         if (r < 0)
                                 return log_error_errno(r, "Failed to expand names: %m");
 
+                        r = get_units_properties(bus, names, show_mode, &properties);
+                        if (r < 0)
+                                return r;
+
                         STRV_FOREACH(name, names) {
                                 _cleanup_free_ char *path;
 
@@ -5856,7 +6010,7 @@ static int show(int argc, char *argv[], void *userdata) {
                                 if (!path)
                                         return log_oom();
 
-                                r = show_one(bus, path, *name, show_mode, &new_line, &ellipsized);
+                                r = show_one(bus, path, *name, hashmap_get(properties, *name), show_mode, &new_line, &ellipsized);
                                 if (r < 0)
                                         return r;
                                 if (r > 0 && ret == 0)
@@ -735,6 +735,8 @@ static const struct hash_ops crippled_hashmap_ops = {
         .compare = trivial_compare_func,
 };
 
+extern const double max_load_factor;
+
 static void test_hashmap_many(void) {
         Hashmap *h;
         unsigned i, j;
@@ -765,10 +767,11 @@ static void test_hashmap_many(void) {
                 for (i = 1; i < tests[j].n_entries*3; i++)
                         assert_se(hashmap_contains(h, UINT_TO_PTR(i)) == (i % 3 == 1));
 
-                log_info("%s %u <= %u * 0.8 = %g",
-                         tests[j].title, hashmap_size(h), hashmap_buckets(h), hashmap_buckets(h) * 0.8);
+                log_info("%s %u <= %u * %g = %g",
+                         tests[j].title, hashmap_size(h), hashmap_buckets(h),
+                         max_load_factor, hashmap_buckets(h) * max_load_factor);
 
-                assert_se(hashmap_size(h) <= hashmap_buckets(h) * 0.8);
+                assert_se(hashmap_size(h) <= hashmap_buckets(h) * max_load_factor);
                 assert_se(hashmap_size(h) == tests[j].n_entries);
 
                 while (!hashmap_isempty(h)) {
@@ -784,6 +787,128 @@ static void test_hashmap_many(void) {
         }
 }
 
+static void test_hashmap_churn(void) {
+        Hashmap *h;
+        unsigned i, first, n = 1000, buckets;
+#ifdef ORDERED
+        Iterator iterator;
+        void *v;
+#endif
+
+        log_info("/* %s */", __func__);
+
+        assert_se(h = hashmap_new(NULL));
+
+        for (i = 1; i <= n; i++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+
+        /* Fill the table up as far as it goes without growing */
+        buckets = hashmap_buckets(h);
+        for (; hashmap_size(h) + 2 < buckets * max_load_factor; i++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+        assert_se(hashmap_buckets(h) == buckets);
+        n = hashmap_size(h);
+
+        /* Replace all entries many times over, keeping the size constant. Whatever removed entries leave
+         * behind must not pile up, neither make the table grow without bounds. The functions which do it
+         * in one go come first, as these never grow the table by themselves. */
+        for (first = 1; i <= 50 * n; i++, first++)
+                if (i > 25 * n) {
+                        assert_se(hashmap_remove(h, UINT_TO_PTR(first)) == UINT_TO_PTR(first));
+                        assert_se(hashmap_put(h, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+                } else if (i % 2 == 0)
+                        assert_se(hashmap_remove_and_put(h, UINT_TO_PTR(first), UINT_TO_PTR(i), UINT_TO_PTR(i)) == 0);
+                else
+                        assert_se(hashmap_remove_and_replace(h, UINT_TO_PTR(first), UINT_TO_PTR(i), UINT_TO_PTR(i)) == 0);
+
+        log_info("%u entries, %u buckets initially, %u buckets now", hashmap_size(h), buckets, hashmap_buckets(h));
+
+        assert_se(hashmap_size(h) == n);
+        assert_se(hashmap_buckets(h) < 3 * buckets);
+
+        for (i = 1; i < first + n; i++)
+                assert_se(hashmap_get(h, UINT_TO_PTR(i)) == (i >= first ? UINT_TO_PTR(i) : NULL));
+
+#ifdef ORDERED
+        i = first;
+        HASHMAP_FOREACH(v, h, iterator)
+                assert_se(v == UINT_TO_PTR(i++));
+        assert_se(i == first + n);
+#endif
+
+        hashmap_free(h);
+}
+
+static void log_throughput(const char *what, unsigned n, usec_t ts) {
+        char b[FORMAT_TIMESPAN_MAX];
+        usec_t t;
+
+        t = MAX(now(CLOCK_MONOTONIC) - ts, (usec_t) 1);
+        log_info("%-24s %10s %8.2f M/s", what, format_timespan(b, sizeof b, t, 1), (double) n / t);
+}
+
+static const void *benchmark_key(char **strings, unsigned i) {
+        return strings ? (const void*) strings[i] : UINT_TO_PTR(i + 1);
+}
+
+static void test_hashmap_benchmark(void) {
+        _cleanup_strv_free_ char **strings = NULL;
+        unsigned i, j, n = 1 << 20;
+        const struct {
+                const char *title;
+                const struct hash_ops *ops;
+        } tests[] = {
+                { "pointer keys", NULL             },
+                { "string keys",  &string_hash_ops },
+        };
+
+        /* Timings are only meaningful with a large map, and mean nothing as part of a regular test run */
+        if (!slow_tests_enabled()) {
+                log_info("/* %s (skipped, slow tests disabled) */", __func__);
+                return;
+        }
+
+        log_info("/* %s (%u entries) */", __func__, n);
+
+        /* Every other one is looked up, but never put */
+        assert_se(strings = new0(char*, 2 * n + 1));
+        for (i = 0; i < 2 * n; i++)
+                assert_se(asprintf(&strings[i], "benchmark-%u", i) >= 0);
+
+        for (j = 0; j < ELEMENTSOF(tests); j++) {
+                char **s = tests[j].ops ? strings : NULL;
+                const char *t = tests[j].title;
+                Hashmap *h;
+                usec_t ts;
+
+                assert_se(h = hashmap_new(tests[j].ops));
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++)
+                        assert_se(hashmap_put(h, benchmark_key(s, 2 * i), UINT_TO_PTR(i + 1)) == 1);
+                log_throughput(strjoina(t, ", put"), n, ts);
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++)
+                        assert_se(hashmap_get(h, benchmark_key(s, 2 * i)) == UINT_TO_PTR(i + 1));
+                log_throughput(strjoina(t, ", get"), n, ts);
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++)
+                        assert_se(!hashmap_get(h, benchmark_key(s, 2 * i + 1)));
+                log_throughput(strjoina(t, ", get missing"), n, ts);
+
+                log_info("%s: %u entries in %u buckets", t, hashmap_size(h), hashmap_buckets(h));
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++)
+                        assert_se(hashmap_remove(h, benchmark_key(s, 2 * i)) == UINT_TO_PTR(i + 1));
+                log_throughput(strjoina(t, ", remove"), n, ts);
+
+                hashmap_free(h);
+        }
+}
+
 extern unsigned custom_counter;
 extern const struct hash_ops boring_hash_ops, custom_hash_ops;
 
@@ -1085,6 +1210,8 @@ void test_hashmap_funcs(void) {
         test_hashmap_get2();
         test_hashmap_size();
         test_hashmap_many();
+        test_hashmap_churn();
+        test_hashmap_benchmark();
         test_hashmap_free();
         test_hashmap_free_with_destructor();
         test_hashmap_first();
@@ -12,6 +12,9 @@ static void custom_destruct(void* p) {
 DEFINE_HASH_OPS_FULL(boring_hash_ops, char, string_hash_func, string_compare_func, free, char, free);
 DEFINE_HASH_OPS_FULL(custom_hash_ops, char, string_hash_func, string_compare_func, custom_destruct, char, custom_destruct);
 
+/* Defined here, as test-hashmap-ordered.c would mangle the name of the constant */
+const double max_load_factor = 1.0 - 1.0 / HASHMAP_INV_KEEP_FREE;
+
 void test_hashmap_funcs(void);
 void test_ordered_hashmap_funcs(void);
 
@@ -3,10 +3,13 @@
 #include <stdlib.h>
 
 #include "alloc-util.h"
+#include "log.h"
 #include "prioq.h"
 #include "set.h"
 #include "siphash24.h"
 #include "sort-util.h"
+#include "tests.h"
+#include "time-util.h"
 
 #define SET_SIZE 1024*4
 
@@ -119,10 +122,124 @@ static void test_struct(void) {
         assert_se(set_isempty(s));
 }
 
+static void check_indexes(Prioq *q) {
+        struct test *t;
+        unsigned i;
+
+        for (i = 0; (t = prioq_peek_by_index(q, i)); i++)
+                assert_se(t->idx == i);
+}
+
+static void test_remove(void) {
+        _cleanup_(prioq_freep) Prioq *q = NULL;
+        _cleanup_free_ struct test *tests = NULL;
+        unsigned previous = 0, i, n = 0;
+        struct test *t;
+
+        srand(0);
+
+        assert_se(q = prioq_new((compare_func_t) test_compare));
+        assert_se(tests = new(struct test, SET_SIZE));
+
+        for (i = 0; i < SET_SIZE; i++) {
+                tests[i] = (struct test) {
+                        .value = (unsigned) rand(),
+                };
+                assert_se(prioq_put(q, tests + i, &tests[i].idx) >= 0);
+        }
+        check_indexes(q);
+
+        /* Removing from the middle fills the hole with the last item, which may need to move either way */
+        for (i = 0; i < SET_SIZE / 2; i++)
+                assert_se(prioq_remove(q, tests + i, &tests[i].idx) == 1);
+        check_indexes(q);
+        assert_se(prioq_remove(q, tests, &tests[0].idx) == 0);
+        assert_se(prioq_size(q) == SET_SIZE / 2);
+
+        /* Move some of the remaining ones around in either direction */
+        for (i = SET_SIZE / 2; i < SET_SIZE; i += 3) {
+                tests[i].value = i % 2 ? tests[i].value / 2 : tests[i].value * 2;
+                assert_se(prioq_reshuffle(q, tests + i, &tests[i].idx) == 1);
+        }
+        check_indexes(q);
+
+        while ((t = prioq_pop(q))) {
+                assert_se(t >= tests + SET_SIZE / 2);
+                assert_se(previous <= t->value);
+
+                previous = t->value;
+                n++;
+        }
+
+        assert_se(n == SET_SIZE / 2);
+}
+
+static void test_benchmark(void) {
+        _cleanup_(prioq_freep) Prioq *q = NULL;
+        _cleanup_free_ struct test *tests = NULL;
+        char b[FORMAT_TIMESPAN_MAX];
+        unsigned i, n = 1U << 20;
+        usec_t ts;
+
+        /* Timings are only meaningful with a large queue, and mean nothing as part of a regular test run */
+        if (!slow_tests_enabled()) {
+                log_info("/* %s (skipped, slow tests disabled) */", __func__);
+                return;
+        }
+
+        log_info("/* %s (%u items) */", __func__, n);
+
+        srand(0);
+
+        assert_se(q = prioq_new((compare_func_t) test_compare));
+        assert_se(tests = new(struct test, n));
+
+        for (i = 0; i < n; i++)
+                tests[i] = (struct test) {
+                        .value = (unsigned) rand(),
+                };
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+                assert_se(prioq_put(q, tests + i, &tests[i].idx) >= 0);
+        log_info("prioq_put(): %s", format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - ts, 1));
+
+        /* What sd-event does when a timer is moved to an earlier time, and what the DNS cache does when an
+         * entry is refreshed */
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                tests[i].value /= 2;
+                assert_se(prioq_reshuffle(q, tests + i, &tests[i].idx) == 1);
+        }
+        log_info("prioq_reshuffle() to earlier: %s", format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - ts, 1));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                tests[i].value = (unsigned) rand();
+                assert_se(prioq_reshuffle(q, tests + i, &tests[i].idx) == 1);
+        }
+        log_info("prioq_reshuffle() to random: %s", format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - ts, 1));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n / 2; i++)
+                assert_se(prioq_remove(q, tests + i, &tests[i].idx) == 1);
+        log_info("prioq_remove() of half: %s", format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - ts, 1));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n / 2; i++)
+                assert_se(prioq_pop(q));
+        log_info("prioq_pop(): %s", format_timespan(b, sizeof(b), now(CLOCK_MONOTONIC) - ts, 1));
+        assert_se(prioq_isempty(q));
+}
+
 int main(int argc, char* argv[]) {
 
+        test_setup_logging(LOG_INFO);
+
         test_unsigned();
         test_struct();
+        test_remove();
+        test_benchmark();
 
         return 0;
 }
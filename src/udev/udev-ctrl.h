@@ -18,6 +18,7 @@ enum udev_ctrl_msg_type {
         UDEV_CTRL_SET_CHILDREN_MAX,
         UDEV_CTRL_PING,
         UDEV_CTRL_EXIT,
+        UDEV_CTRL_DUMP_STATISTICS,
 };
 
 union udev_ctrl_msg_value {
@@ -76,4 +77,8 @@ static inline int udev_ctrl_send_exit(struct udev_ctrl *uctrl) {
         return udev_ctrl_send(uctrl, UDEV_CTRL_EXIT, 0, NULL);
 }
 
+static inline int udev_ctrl_send_dump_statistics(struct udev_ctrl *uctrl) {
+        return udev_ctrl_send(uctrl, UDEV_CTRL_DUMP_STATISTICS, 0, NULL);
+}
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct udev_ctrl*, udev_ctrl_unref);
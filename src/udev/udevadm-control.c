@@ -41,6 +41,7 @@ static int help(void) {
                "  -p --property=KEY=VALUE  Set a global property for all events\n"
                "  -m --children-max=N      Maximum number of children\n"
                "     --ping                Wait for udev to respond to a ping message\n"
+               "     --dump-statistics     Log event loop statistics of the daemon\n"
                "  -t --timeout=SECONDS     Maximum time to block for a reply\n"
                , program_invocation_short_name);
 
@@ -54,6 +55,7 @@ int control_main(int argc, char *argv[], void *userdata) {
 
         enum {
                 ARG_PING = 0x100,
+                ARG_DUMP_STATISTICS,
         };
 
         static const struct option options[] = {
@@ -67,6 +69,7 @@ int control_main(int argc, char *argv[], void *userdata) {
                 { "env",              required_argument, NULL, 'p'      }, /* alias for -p */
                 { "children-max",     required_argument, NULL, 'm'      },
                 { "ping",             no_argument,       NULL, ARG_PING },
+                { "dump-statistics",  no_argument,       NULL, ARG_DUMP_STATISTICS },
                 { "timeout",          required_argument, NULL, 't'      },
                 { "version",          no_argument,       NULL, 'V'      },
                 { "help",             no_argument,       NULL, 'h'      },
@@ -158,6 +161,13 @@ int control_main(int argc, char *argv[], void *userdata) {
                         else if (r < 0)
                                 return log_error_errno(r, "Failed to send a ping message: %m");
                         break;
+                case ARG_DUMP_STATISTICS:
+                        r = udev_ctrl_send_dump_statistics(uctrl);
+                        if (r == -ENOANO)
+                                log_warning("Cannot specify --dump-statistics after --exit, ignoring.");
+                        else if (r < 0)
+                                return log_error_errno(r, "Failed to send request to dump statistics: %m");
+                        break;
                 case 't':
                         r = parse_sec(optarg, &timeout);
                         if (r < 0)
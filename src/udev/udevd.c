@@ -1100,6 +1100,20 @@ static int on_ctrl_msg(struct udev_ctrl *uctrl, enum udev_ctrl_msg_type type, co
                 log_debug("Received udev control message (EXIT)");
                 manager_exit(manager);
                 break;
+        case UDEV_CTRL_DUMP_STATISTICS: {
+                _cleanup_free_ char *stats = NULL;
+
+                log_debug("Received udev control message (DUMP_STATISTICS)");
+
+                r = sd_event_get_statistics(manager->event, &stats);
+                if (r < 0) {
+                        log_warning_errno(r, "Failed to acquire event loop statistics, ignoring: %m");
+                        break;
+                }
+
+                log_info("Event loop statistics:\n%s", stats);
+                break;
+        }
         default:
                 log_debug("Received unknown udev control message, ignoring");
         }
@@ -1640,6 +1654,11 @@ static int main_loop(Manager *manager) {
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate event loop: %m");
 
+        /* Keep per event source accounting, for "udevadm control --dump-statistics" */
+        r = sd_event_set_statistics(manager->event, true);
+        if (r < 0)
+                return log_error_errno(r, "Failed to enable event loop statistics: %m");
+
         r = sd_event_add_signal(manager->event, NULL, SIGINT, on_sigterm, manager);
         if (r < 0)
                 return log_error_errno(r, "Failed to create SIGINT event source: %m");
@@ -1680,6 +1699,8 @@ static int main_loop(Manager *manager) {
         if (r < 0)
                 return log_error_errno(r, "Failed to create inotify event source: %m");
 
+        (void) sd_event_source_set_description(manager->inotify_event, "inotify");
+
         r = sd_device_monitor_attach_event(manager->monitor, manager->event);
         if (r < 0)
                 return log_error_errno(r, "Failed to attach event to device monitor: %m");